@@ -0,0 +1,134 @@
+/* Micro-benchmark of pmh_markdown_to_elements() against
+ * pmh_markdown_to_elements_in_arena().
+ *
+ * It is not part of the build. Build and run it from this folder with:
+ *
+ *   gcc -O2 -I.. -o pmh_arena_bench pmh_arena_bench.c ../pmh_parser.c
+ *   ./pmh_arena_bench [corpus size in KB] [runs]
+ *
+ * A Markdown corpus with headers, lists, links, reference links, images,
+ * code, quotes and CJK text is generated. Each mode parses it @runs times
+ * and the average time of parsing and of releasing the results is printed.
+ * The element lists of both modes are checked to be identical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pmh_parser.h"
+
+static const char *c_paragraphs[] = {
+    "# Header of section %d\n\n",
+    "Some *emphasized* and **strong** text with `inline code` and a [link](http://example.com/%d).\n\n",
+    "- list item %d with [reference link][ref%d]\n- another item\n    - nested item\n\n",
+    "1. ordered item %d\n2. ![image](images/image_%d.png)\n\n",
+    "> quote line %d\n> continued with ~~strike~~\n\n",
+    "    indented code block %d\n    second line\n\n",
+    "中文段落 %d，包含**强调**和[链接](http://example.com/%d)。\n\n",
+    "[ref%d]: http://example.com/ref \"Title\"\n\n",
+    "## Sub header %d\n\nPlain paragraph with <span>inline HTML</span> and an autolink <http://example.com/%d>.\n\n",
+};
+
+static char *generate_corpus(size_t p_size)
+{
+    size_t cap = p_size + 1024;
+    char *text = malloc(cap);
+    size_t len = 0;
+    int nr = sizeof(c_paragraphs) / sizeof(c_paragraphs[0]);
+    int i = 0;
+    while (len < p_size) {
+        len += snprintf(text + len, cap - len, c_paragraphs[i % nr], i, i);
+        ++i;
+    }
+
+    text[len] = '\0';
+    return text;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Compare the positions and types of two results. Return the number of
+ * elements, or -1 if they differ. */
+static long compare_results(pmh_element **p_a, pmh_element **p_b)
+{
+    long count = 0;
+    for (int i = 0; i < pmh_NUM_LANG_TYPES; ++i) {
+        pmh_element *a = p_a[i];
+        pmh_element *b = p_b[i];
+        while (a && b) {
+            if (a->type != b->type || a->pos != b->pos || a->end != b->end) {
+                return -1;
+            }
+
+            ++count;
+            a = a->next;
+            b = b->next;
+        }
+
+        if (a || b) {
+            return -1;
+        }
+    }
+
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = (argc > 1 ? atoi(argv[1]) : 200) * 1024;
+    int runs = argc > 2 ? atoi(argv[2]) : 10;
+    char *text = generate_corpus(size);
+
+    /* The parser may modify the text, so each parse gets a copy. */
+    size_t len = strlen(text);
+    char *buf = malloc(len + 1);
+
+    double mallocParse = 0, mallocFree = 0;
+    double arenaParse = 0, arenaReset = 0;
+    pmh_arena *arena = pmh_arena_new();
+    for (int i = 0; i < runs; ++i) {
+        pmh_element **result;
+        memcpy(buf, text, len + 1);
+        double t = now_ms();
+        pmh_markdown_to_elements(buf, pmh_EXT_NONE, &result);
+        mallocParse += now_ms() - t;
+
+        pmh_element **arenaResult;
+        memcpy(buf, text, len + 1);
+        t = now_ms();
+        pmh_markdown_to_elements_in_arena(buf, pmh_EXT_NONE, arena, &arenaResult);
+        arenaParse += now_ms() - t;
+
+        if (i == 0) {
+            long count = compare_results(result, arenaResult);
+            if (count < 0) {
+                fprintf(stderr, "results of malloc and arena differ\n");
+                return 1;
+            }
+
+            printf("corpus %zu KB, %ld elements\n", len / 1024, count);
+        }
+
+        t = now_ms();
+        pmh_free_elements(result);
+        mallocFree += now_ms() - t;
+
+        t = now_ms();
+        pmh_arena_reset(arena);
+        arenaReset += now_ms() - t;
+    }
+
+    printf("malloc: parse %.2f ms, free %.3f ms\n", mallocParse / runs, mallocFree / runs);
+    printf("arena:  parse %.2f ms, reset %.3f ms\n", arenaParse / runs, arenaReset / runs);
+
+    pmh_arena_free(arena);
+    free(buf);
+    free(text);
+    return 0;
+}
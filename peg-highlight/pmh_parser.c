@@ -56,6 +56,123 @@ char *strdup_or_null(char *s)
 }
 
 
+
+/*
+Bump allocator for the memory of a whole parse. Memory is taken from a chain
+of blocks and released all at once by resetting the arena. Blocks are kept
+for the following parses, up to pmh_ARENA_MAX_KEPT_SIZE bytes.
+*/
+#ifndef pmh_ARENA_BLOCK_SIZE
+#define pmh_ARENA_BLOCK_SIZE (64 * 1024)
+#endif
+#ifndef pmh_ARENA_MAX_KEPT_SIZE
+#define pmh_ARENA_MAX_KEPT_SIZE (8 * 1024 * 1024)
+#endif
+#define pmh_ARENA_ALIGN 16
+
+typedef struct pmh_ArenaBlock
+{
+    struct pmh_ArenaBlock *next;
+    size_t size;
+    size_t used;
+} pmh_arena_block;
+
+#define pmh_ARENA_HEADER_SIZE \
+    ((sizeof(pmh_arena_block) + pmh_ARENA_ALIGN - 1) & ~((size_t)pmh_ARENA_ALIGN - 1))
+
+struct pmh_Arena
+{
+    /* Chain of all blocks: */
+    pmh_arena_block *head;
+    
+    /* Block to allocate from: */
+    pmh_arena_block *current;
+};
+
+static pmh_arena_block *mk_arena_block(size_t size)
+{
+    pmh_arena_block *block = (pmh_arena_block *)
+                             malloc(pmh_ARENA_HEADER_SIZE + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+pmh_arena *pmh_arena_new(void)
+{
+    pmh_arena *arena = (pmh_arena *)malloc(sizeof(pmh_arena));
+    arena->head = arena->current = mk_arena_block(pmh_ARENA_BLOCK_SIZE);
+    return arena;
+}
+
+void pmh_arena_reset(pmh_arena *arena)
+{
+    size_t kept = 0;
+    pmh_arena_block *prev = NULL;
+    pmh_arena_block *block = arena->head;
+    while (block != NULL)
+    {
+        pmh_arena_block *next = block->next;
+        if (prev != NULL && kept + block->size > pmh_ARENA_MAX_KEPT_SIZE) {
+            prev->next = next;
+            free(block);
+        } else {
+            block->used = 0;
+            kept += block->size;
+            prev = block;
+        }
+        block = next;
+    }
+    arena->current = arena->head;
+}
+
+void pmh_arena_free(pmh_arena *arena)
+{
+    if (arena == NULL)
+        return;
+    pmh_arena_block *block = arena->head;
+    while (block != NULL)
+    {
+        pmh_arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+static void *arena_alloc(pmh_arena *arena, size_t size)
+{
+    size = (size + pmh_ARENA_ALIGN - 1) & ~((size_t)pmh_ARENA_ALIGN - 1);
+    pmh_arena_block *block = arena->current;
+    while (block->used + size > block->size)
+    {
+        if (block->next == NULL) {
+            // Append a new block, which is large enough for this request:
+            size_t block_size = (size > pmh_ARENA_BLOCK_SIZE)
+                                ? size : pmh_ARENA_BLOCK_SIZE;
+            block->next = mk_arena_block(block_size);
+        }
+        block = block->next;
+    }
+    arena->current = block;
+    
+    void *ret = (char *)block + pmh_ARENA_HEADER_SIZE + block->used;
+    block->used += size;
+    return ret;
+}
+
+static char *arena_strdup_or_null(pmh_arena *arena, char *s)
+{
+    if (s == NULL)
+        return NULL;
+    size_t len = strlen(s);
+    char *ret = (char *)arena_alloc(arena, len + 1);
+    memcpy(ret, s, len + 1);
+    return ret;
+}
+
+
 // Internal language element occurrence structure, containing
 // both public and private members:
 struct pmh_RealElement
@@ -124,6 +241,10 @@ typedef struct
     
     /* List of reference elements: */
     pmh_realelement *references;
+    
+    /* Arena to allocate elements and their strings from, or NULL */
+    /* to allocate them individually: */
+    pmh_arena *arena;
 } parser_data;
 
 static parser_data *mk_parser_data(char *original_input,
@@ -134,9 +255,11 @@ static parser_data *mk_parser_data(char *original_input,
                                    unsigned long offset,
                                    int extensions,
                                    pmh_realelement **head_elems,
-                                   pmh_realelement *references)
+                                   pmh_realelement *references,
+                                   pmh_arena *arena)
 {
     parser_data *p_data = (parser_data *)malloc(sizeof(parser_data));
+    p_data->arena = arena;
     p_data->extensions = extensions;
     p_data->original_input = original_input;
     p_data->strip_positions = strip_positions;
@@ -149,8 +272,10 @@ static parser_data *mk_parser_data(char *original_input,
     if (head_elems != NULL)
         p_data->head_elems = head_elems;
     else {
+        size_t size = sizeof(pmh_realelement *) * pmh_NUM_TYPES;
         p_data->head_elems = (pmh_realelement **)
-                             malloc(sizeof(pmh_realelement *) * pmh_NUM_TYPES);
+                             ((arena != NULL) ? arena_alloc(arena, size)
+                                              : malloc(size));
         int i;
         for (i = 0; i < pmh_NUM_TYPES; i++)
             p_data->head_elems[i] = NULL;
@@ -369,7 +494,8 @@ static void process_raw_blocks(parser_data *p_data)
                     subspan_list->pos,
                     p_data->extensions,
                     p_data->head_elems,
-                    p_data->references
+                    p_data->references,
+                    p_data->arena
                 );
                 parse_markdown(raw_p_data);
                 free(raw_p_data);
@@ -497,8 +623,9 @@ static int strcpy_preformat(char *str, char **out,
 
 
 
-void pmh_markdown_to_elements(char *text, int extensions,
-                              pmh_element **out_result[])
+static void markdown_to_elements(char *text, int extensions,
+                                 pmh_arena *arena,
+                                 pmh_element **out_result[])
 {
     char *text_copy = NULL;
     unsigned long *strip_positions = NULL;
@@ -522,7 +649,8 @@ void pmh_markdown_to_elements(char *text, int extensions,
         0,
         extensions,
         NULL,
-        NULL
+        NULL,
+        arena
     );
     pmh_realelement **result = p_data->head_elems;
     
@@ -553,6 +681,20 @@ void pmh_markdown_to_elements(char *text, int extensions,
     *out_result = (pmh_element**)result;
 }
 
+void pmh_markdown_to_elements(char *text, int extensions,
+                              pmh_element **out_result[])
+{
+    markdown_to_elements(text, extensions, NULL, out_result);
+}
+
+void pmh_markdown_to_elements_in_arena(char *text, int extensions,
+                                       pmh_arena *arena,
+                                       pmh_element **out_result[])
+{
+    pmh_arena_reset(arena);
+    markdown_to_elements(text, extensions, arena, out_result);
+}
+
 
 
 /*
@@ -707,11 +849,28 @@ static pmh_realelement *reverse(pmh_realelement *list)
 
 
 
+/* duplicate a string to be referenced by an element */
+static char *parser_strdup_or_null(parser_data *p_data, char *s)
+{
+    return (p_data->arena != NULL) ? arena_strdup_or_null(p_data->arena, s)
+                                   : strdup_or_null(s);
+}
+
+/* free a string referenced by an element */
+static void parser_free_string(parser_data *p_data, char *s)
+{
+    if (p_data->arena == NULL)
+        free(s);
+}
+
 /* construct pmh_realelement */
 static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
                                    long pos, long end)
 {
-    pmh_realelement *result = (pmh_realelement *)malloc(sizeof(pmh_realelement));
+    pmh_realelement *result = (pmh_realelement *)
+                              ((p_data->arena != NULL)
+                               ? arena_alloc(p_data->arena, sizeof(pmh_realelement))
+                               : malloc(sizeof(pmh_realelement)));
     memset(result, 0, sizeof(*result));
     result->type = type;
     result->pos = pos;
@@ -729,9 +888,9 @@ static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
 static pmh_realelement *copy_element(parser_data *p_data, pmh_realelement *elem)
 {
     pmh_realelement *result = mk_element(p_data, elem->type, elem->pos, elem->end);
-    result->label = strdup_or_null(elem->label);
-    result->text = strdup_or_null(elem->text);
-    result->address = strdup_or_null(elem->address);
+    result->label = parser_strdup_or_null(p_data, elem->label);
+    result->text = parser_strdup_or_null(p_data, elem->text);
+    result->address = parser_strdup_or_null(p_data, elem->address);
     return result;
 }
 
@@ -741,7 +900,7 @@ static pmh_realelement *mk_etext(parser_data *p_data, char *string)
     pmh_realelement *result;
     assert(string != NULL);
     result = mk_element(p_data, pmh_EXTRA_TEXT, 0,0);
-    result->text = strdup_or_null(string);
+    result->text = parser_strdup_or_null(p_data, string);
     return result;
 }
 
@@ -944,6 +1103,13 @@ static char *copy_input_span(parser_data *p_data,
         cursor = cursor->next;
     }
     
+    if (ret != NULL && p_data->arena != NULL)
+    {
+        char *arena_ret = arena_strdup_or_null(p_data->arena, ret);
+        free(ret);
+        ret = arena_ret;
+    }
+    
     return ret;
 }
 
@@ -1020,8 +1186,9 @@ static void yy_input_func(char *buf, int *result, int max_size,
 #define REF_EXISTS(x) reference_exists((parser_data *)G->data, x)
 #define GET_REF(x)  get_reference((parser_data *)G->data, x)
 #define PARSING_REFERENCES ((parser_data *)G->data)->parsing_only_references
-#define FREE_LABEL(l) { free(l->label); l->label = NULL; }
-#define FREE_ADDRESS(l) { free(l->address); l->address = NULL; }
+#define FREE_LABEL(l) { parser_free_string((parser_data *)G->data, l->label); l->label = NULL; }
+#define FREE_ADDRESS(l) { parser_free_string((parser_data *)G->data, l->address); l->address = NULL; }
+#define STRDUP(x)   parser_strdup_or_null((parser_data *)G->data, x)
 
 // This gives us the text matched with < > as it appears in the original input:
 #define COPY_YYTEXT_ORIG() copy_input_span((parser_data *)G->data, thunk->begin, thunk->end)
@@ -1582,8 +1749,8 @@ YY_ACTION(void) yy_1_Reference(GREG *G, char *yytext, int yyleng, yythunk *thunk
   yyprintf((stderr, "do yy_1_Reference\n"));
   
                 pmh_realelement *el = elem_s(pmh_REFERENCE);
-                el->label = strdup_or_null(l->label);
-                el->address = strdup_or_null(r->address);
+                el->label = STRDUP(l->label);
+                el->address = STRDUP(r->address);
                 ADD(el);
                 FREE_LABEL(l);
                 FREE_ADDRESS(r);
@@ -1663,7 +1830,7 @@ YY_ACTION(void) yy_1_ExplicitLink(GREG *G, char *yytext, int yyleng, yythunk *th
   
                     yy = elem_s(pmh_LINK);
                     if (l->address != NULL)
-                        yy->address = strdup_or_null(l->address);
+                        yy->address = STRDUP(l->address);
                     FREE_LABEL(s);
                     FREE_ADDRESS(l);
                 ;
@@ -1678,8 +1845,8 @@ YY_ACTION(void) yy_1_ReferenceLinkSingle(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(s->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(s->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = STRDUP(s->label);
+                                yy->address = STRDUP(reference->address);
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -1695,8 +1862,8 @@ YY_ACTION(void) yy_1_ReferenceLinkDouble(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(l->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(l->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = STRDUP(l->label);
+                                yy->address = STRDUP(reference->address);
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
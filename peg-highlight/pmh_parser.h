@@ -41,6 +41,65 @@
 void pmh_markdown_to_elements(char *text, int extensions,
                               pmh_element **out_result[]);
 
+/**
+* \brief Memory arena for parsing results
+* 
+* All the elements (and their strings) of a parse done with
+* pmh_markdown_to_elements_in_arena() are allocated from an arena, so they
+* can be released at once. An arena can be reused for many parses to avoid
+* allocating memory again.
+* 
+* \sa pmh_markdown_to_elements_in_arena
+*/
+typedef struct pmh_Arena pmh_arena;
+
+/**
+* \brief Create a new arena
+* 
+* \return The new arena. You must pass this to pmh_arena_free() when it's
+*         not needed anymore.
+*/
+pmh_arena *pmh_arena_new(void);
+
+/**
+* \brief Release all the memory allocated from an arena
+* 
+* The arena keeps (part of) its memory for later use. All the elements
+* allocated from the arena become invalid.
+* 
+* \param[in]  arena  The arena to reset.
+*/
+void pmh_arena_reset(pmh_arena *arena);
+
+/**
+* \brief Free an arena
+* 
+* \param[in]  arena  The arena returned by pmh_arena_new().
+*/
+void pmh_arena_free(pmh_arena *arena);
+
+/**
+* \brief Parse Markdown text, return elements allocated from an arena
+* 
+* The same as pmh_markdown_to_elements(), except that all the elements are
+* allocated from the given arena, which is reset before parsing. The
+* results stay valid until the arena is reset or freed, and must NOT be
+* passed to pmh_free_elements().
+* 
+* \param[in]  text        The Markdown text to parse for highlighting.
+* \param[in]  extensions  The extensions to use in parsing (a bitfield
+*                         of pmh_extensions values).
+* \param[in]  arena       The arena to allocate the results from.
+* \param[out] out_result  A pmh_element array, indexed by type, containing
+*                         the results of the parsing (linked lists of elements).
+* 
+* \sa pmh_markdown_to_elements
+* \sa pmh_arena_new
+*/
+void pmh_markdown_to_elements_in_arena(char *text, int extensions,
+                                       pmh_arena *arena,
+                                       pmh_element **out_result[]);
+
 /**
 * \brief Sort elements in list by start offset.
 * 
@@ -1,27 +1,37 @@
 #include <QtGui>
 #include <QtDebug>
 #include <QTextCursor>
+#include <QThread>
+#include <QElapsedTimer>
 #include <algorithm>
+#include <climits>
 #include "hgmarkdownhighlighter.h"
+#include "vmarkdownparseworker.h"
 #include "vconfigmanager.h"
 #include "utils/vutils.h"
 #include "vtextblockdata.h"
 
 extern VConfigManager *g_config;
 
-const int HGMarkdownHighlighter::initCapacity = 1024;
-
-void HGMarkdownHighlighter::resizeBuffer(int newCap)
+HLOffsetTable::HLOffsetTable(const QString &p_text)
+    : m_base(0)
 {
-    if (newCap == capacity) {
-        return;
+    int size = p_text.size();
+    int i = 0;
+    if (size > 0 && p_text[0] == QChar(0xfeff)) {
+        // BOM is stripped by the parser.
+        m_base = 1;
+        i = 1;
     }
-    if (capacity > 0) {
-        Q_ASSERT(content);
-        delete [] content;
+
+    const QChar *data = p_text.constData();
+    int cp = 0;
+    for (; i < size; ++i, ++cp) {
+        if (data[i].isHighSurrogate() && i + 1 < size && data[i + 1].isLowSurrogate()) {
+            m_pairs.append(cp);
+            ++i;
+        }
     }
-    capacity = newCap;
-    content = new char [capacity];
 }
 
 // Will be freeed by parent automatically
@@ -30,8 +40,11 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &s
                                              int waitInterval,
                                              QTextDocument *parent)
     : QSyntaxHighlighter(parent), highlightingStyles(styles),
-      m_codeBlockStyles(codeBlockStyles), m_numOfCodeBlockHighlightsToRecv(0),
-      parsing(0), waitInterval(waitInterval), content(NULL), capacity(0), result(NULL)
+      m_numOfCodeBlockHighlightsToRecv(0),
+      m_unclosedCodeBlockStart(-1), m_codeBlocksValid(false),
+      m_lastCharacterCount(0), m_fullParseNeeded(true), m_forceRegionsUpdate(true),
+      m_rehighlightCursor(-1), m_rehighlightVisibleFirst(0), m_rehighlightVisibleLast(-1),
+      waitInterval(waitInterval), m_revision(0), m_blockStartsRevision(-1)
 {
     codeBlockStartExp = QRegExp(VUtils::c_fencedCodeBlockStartRegExp);
     codeBlockEndExp = QRegExp(VUtils::c_fencedCodeBlockEndRegExp);
@@ -48,13 +61,21 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &s
         }
     }
 
+    // Intern the code block styles.
+    m_codeBlockFormats.reserve(codeBlockStyles.size());
+    for (auto it = codeBlockStyles.begin(); it != codeBlockStyles.end(); ++it) {
+        m_codeBlockStyleIndexes.insert(it.key(), m_codeBlockFormats.size());
+        m_codeBlockFormats.append(it.value());
+    }
+
     m_colorColumnFormat = codeBlockFormat;
     m_colorColumnFormat.setForeground(QColor(g_config->getEditorColorColumnFg()));
     m_colorColumnFormat.setBackground(QColor(g_config->getEditorColorColumnBg()));
 
-    resizeBuffer(initCapacity);
     document = parent;
 
+    resetChangeTracking();
+
     timer = new QTimer(this);
     timer->setSingleShot(true);
     timer->setInterval(this->waitInterval);
@@ -65,7 +86,29 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &s
     m_completeTimer->setSingleShot(true);
     m_completeTimer->setInterval(completeWaitTime);
     connect(m_completeTimer, &QTimer::timeout,
-            this, &HGMarkdownHighlighter::highlightCompleted);
+            this, &HGMarkdownHighlighter::tryToSignalHighlightCompleted);
+
+    // Rehighlight chunks when idle.
+    m_rehighlightTimer = new QTimer(this);
+    m_rehighlightTimer->setSingleShot(true);
+    m_rehighlightTimer->setInterval(0);
+    connect(m_rehighlightTimer, &QTimer::timeout,
+            this, &HGMarkdownHighlighter::rehighlightNextChunk);
+
+    qRegisterMetaType<HLParseRequest>();
+    qRegisterMetaType<QSharedPointer<HLParseResult>>();
+
+    // The worker will be deleted after the thread finishes.
+    m_parseThread = new QThread(this);
+    m_parseWorker = new VMarkdownParseWorker(highlightingStyles);
+    m_parseWorker->moveToThread(m_parseThread);
+    connect(m_parseThread, &QThread::finished,
+            m_parseWorker, &QObject::deleteLater);
+    connect(this, &HGMarkdownHighlighter::parseRequested,
+            m_parseWorker, &VMarkdownParseWorker::parse);
+    connect(m_parseWorker, &VMarkdownParseWorker::parseFinished,
+            this, &HGMarkdownHighlighter::handleParseResult);
+    m_parseThread->start();
 
     connect(document, &QTextDocument::contentsChange,
             this, &HGMarkdownHighlighter::handleContentChange);
@@ -73,15 +116,10 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &s
 
 HGMarkdownHighlighter::~HGMarkdownHighlighter()
 {
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
-    }
-    if (content) {
-        delete [] content;
-        capacity = 0;
-        content = NULL;
-    }
+    // Skip all pending requests.
+    m_parseWorker->setLatestRevision(-1);
+    m_parseThread->quit();
+    m_parseThread->wait();
 }
 
 void HGMarkdownHighlighter::updateBlockUserData(int p_blockNum, const QString &p_text)
@@ -124,9 +162,10 @@ void HGMarkdownHighlighter::updateBlockUserData(int p_blockNum, const QString &p
 void HGMarkdownHighlighter::highlightBlock(const QString &text)
 {
     int blockNum = currentBlock().blockNumber();
-    if (!parsing && blockHighlights.size() > blockNum) {
-        const QVector<HLUnit> &units = blockHighlights[blockNum];
-        for (int i = 0; i < units.size(); ++i) {
+    if (blockHighlights.blockCount() > blockNum) {
+        const HLUnit *units = blockHighlights.units(blockNum);
+        int nrUnits = blockHighlights.unitCount(blockNum);
+        for (int i = 0; i < nrUnits; ++i) {
             // TODO: merge two format within the same range
             const HLUnit &unit = units[i];
             setFormat(unit.start, unit.length, highlightingStyles[unit.styleIndex].format);
@@ -155,35 +194,28 @@ void HGMarkdownHighlighter::highlightBlock(const QString &text)
     // highlightLinkWithSpacesInURL(text);
 
     // Highlight CodeBlock using VCodeBlockHighlightHelper.
-    if (m_codeBlockHighlights.size() > blockNum) {
-        const QVector<HLUnitStyle> &units = m_codeBlockHighlights[blockNum];
+    if (m_codeBlockHighlights.blockCount() > blockNum
+        && m_codeBlockHighlights.unitCount(blockNum) > 0) {
+        const HLUnitStyle *units = m_codeBlockHighlights.units(blockNum);
+        int nrUnits = m_codeBlockHighlights.unitCount(blockNum);
         // Manually simply merge the format of all the units within the same block.
         // Using QTextCursor to get the char format after setFormat() seems
         // not to work.
-        QVector<QTextCharFormat> formats;
-        formats.reserve(units.size());
-        // formatIndex[i] is the index in @formats which is the format of the
-        // ith character.
-        QVector<int> formatIndex(currentBlock().length(), -1);
-        for (int i = 0; i < units.size(); ++i) {
+        // m_blockFormatIndexes[i] is the format index of the ith character.
+        int length = currentBlock().length();
+        m_blockFormatIndexes.fill(-1, length);
+        for (int i = 0; i < nrUnits; ++i) {
             const HLUnitStyle &unit = units[i];
-            auto it = m_codeBlockStyles.find(unit.style);
-            if (it != m_codeBlockStyles.end()) {
-                QTextCharFormat newFormat;
-                if (unit.start < (unsigned int)formatIndex.size() && formatIndex[unit.start] != -1) {
-                    newFormat = formats[formatIndex[unit.start]];
-                    newFormat.merge(*it);
-                } else {
-                    newFormat = *it;
-                }
-                setFormat(unit.start, unit.length, newFormat);
+            int idx = unit.styleIndex;
+            if (unit.start < (unsigned int)length && m_blockFormatIndexes[unit.start] != -1) {
+                idx = mergedCodeBlockFormat(m_blockFormatIndexes[unit.start], idx);
+            }
 
-                formats.append(newFormat);
-                int idx = formats.size() - 1;
-                unsigned int endIdx = unit.length + unit.start;
-                for (unsigned int i = unit.start; i < endIdx && i < (unsigned int)formatIndex.size(); ++i) {
-                    formatIndex[i] = idx;
-                }
+            setFormat(unit.start, unit.length, m_codeBlockFormats[idx]);
+
+            unsigned int endIdx = unit.length + unit.start;
+            for (unsigned int j = unit.start; j < endIdx && j < (unsigned int)length; ++j) {
+                m_blockFormatIndexes[j] = idx;
             }
         }
     }
@@ -194,172 +226,180 @@ exit:
     highlightChanged();
 }
 
-void HGMarkdownHighlighter::initBlockHighlightFromResult(int nrBlocks)
+// Estimate the memory taken by @p_units if stored as one QVector of
+// @p_unitSize bytes units per block.
+template<typename T>
+static qint64 perBlockVectorsMemory(const HLBlockUnits<T> &p_units, int p_unitSize)
 {
-    blockHighlights.resize(nrBlocks);
-    for (int i = 0; i < blockHighlights.size(); ++i) {
-        blockHighlights[i].clear();
+    qint64 bytes = (qint64)p_units.blockCount() * sizeof(QVector<T>);
+    for (int i = 0; i < p_units.blockCount(); ++i) {
+        int nrUnits = p_units.unitCount(i);
+        if (nrUnits > 0) {
+            bytes += sizeof(QArrayData) + (qint64)nrUnits * p_unitSize;
+        }
     }
 
-    if (!result) {
-        return;
-    }
+    return bytes;
+}
 
-    for (int i = 0; i < highlightingStyles.size(); i++)
-    {
-        const HighlightingStyle &style = highlightingStyles[i];
-        pmh_element *elem_cursor = result[style.type];
-        while (elem_cursor != NULL)
-        {
-            // elem_cursor->pos and elem_cursor->end is the start
-            // and end position of the element in document.
-            if (elem_cursor->end <= elem_cursor->pos) {
-                elem_cursor = elem_cursor->next;
-                continue;
-            }
-            initBlockHighlihgtOne(elem_cursor->pos, elem_cursor->end, i);
-            elem_cursor = elem_cursor->next;
-        }
+void HGMarkdownHighlighter::dumpMemoryUsage() const
+{
+    // Units used to be two unsigned long and an unsigned int or a QString.
+    const int oldUnitSize = 2 * sizeof(unsigned long) + sizeof(void *);
+    qint64 flat = blockHighlights.memoryUsage() + m_codeBlockHighlights.memoryUsage();
+    qint64 perBlock = perBlockVectorsMemory(blockHighlights, oldUnitSize)
+                      + perBlockVectorsMemory(m_codeBlockHighlights, oldUnitSize);
+    qDebug() << "highlighter:" << blockHighlights.unitCount() << "units of"
+             << blockHighlights.blockCount() << "blocks take" << flat
+             << "bytes, per-block vectors would take about" << perBlock << "bytes";
+}
+
+int HGMarkdownHighlighter::mergedCodeBlockFormat(int p_outer, int p_inner)
+{
+    quint64 key = ((quint64)p_outer << 32) | (quint32)p_inner;
+    auto it = m_mergedCodeBlockFormats.find(key);
+    if (it != m_mergedCodeBlockFormats.end()) {
+        return it.value();
     }
+
+    QTextCharFormat format = m_codeBlockFormats[p_outer];
+    format.merge(m_codeBlockFormats[p_inner]);
+    int idx = m_codeBlockFormats.size();
+    m_codeBlockFormats.append(format);
+    m_mergedCodeBlockFormats.insert(key, idx);
+    return idx;
 }
 
-void HGMarkdownHighlighter::initHtmlCommentRegionsFromResult()
+void HGMarkdownHighlighter::initHtmlCommentRegionsFromResult(const HLParseResult &p_result)
 {
     // From Qt5.7, the capacity is preserved.
     m_commentRegions.clear();
 
-    if (!result) {
-        return;
-    }
-
-    pmh_element *elem = result[pmh_COMMENT];
-    while (elem != NULL) {
-        if (elem->end <= elem->pos) {
-            elem = elem->next;
-            continue;
+    QVector<VElementRegion> regs = p_result.m_elements[pmh_COMMENT];
+    std::sort(regs.begin(), regs.end(),
+              [](const VElementRegion &p_a, const VElementRegion &p_b) {
+                return p_a.m_startPos < p_b.m_startPos;
+              });
+
+    // Merge overlapping regions.
+    for (auto const &reg : regs) {
+        if (!m_commentRegions.isEmpty() && reg.m_startPos <= m_commentRegions.last().m_endPos) {
+            VElementRegion &last = m_commentRegions.last();
+            last.m_endPos = qMax(last.m_endPos, reg.m_endPos);
+        } else {
+            m_commentRegions.append(reg);
         }
-
-        m_commentRegions.push_back(VElementRegion(elem->pos, elem->end));
-
-        elem = elem->next;
     }
 
     qDebug() << "highlighter: parse" << m_commentRegions.size() << "HTML comment regions";
 }
 
-void HGMarkdownHighlighter::initImageRegionsFromResult()
+void HGMarkdownHighlighter::initHtmlBlockRegionsFromResult(const HLParseResult &p_result)
 {
-    if (!result) {
-        // From Qt5.7, the capacity is preserved.
-        m_imageRegions.clear();
-        emit imageLinksUpdated(m_imageRegions);
-        return;
-    }
+    m_htmlBlockRegions = p_result.m_elements[pmh_HTMLBLOCK];
+}
 
-    int idx = 0;
-    int oriSize = m_imageRegions.size();
-    pmh_element *elem = result[pmh_IMAGE];
-    while (elem != NULL) {
-        if (elem->end <= elem->pos) {
-            elem = elem->next;
-            continue;
-        }
+void HGMarkdownHighlighter::initImageRegionsFromResult(const HLParseResult &p_result)
+{
+    m_imageRegions = p_result.m_elements[pmh_IMAGE];
 
-        if (idx < oriSize) {
-            // Try to reuse the original element.
-            VElementRegion &reg = m_imageRegions[idx];
-            if ((int)elem->pos != reg.m_startPos || (int)elem->end != reg.m_endPos) {
-                reg.m_startPos = (int)elem->pos;
-                reg.m_endPos = (int)elem->end;
-            }
-        } else {
-            m_imageRegions.push_back(VElementRegion(elem->pos, elem->end));
-        }
+    qDebug() << "highlighter: parse" << m_imageRegions.size() << "image regions";
+}
 
-        ++idx;
-        elem = elem->next;
-    }
+void HGMarkdownHighlighter::initHeaderRegionsFromResult(const HLParseResult &p_result)
+{
+    m_headerRegions.clear();
 
-    if (idx < oriSize) {
-        m_imageRegions.resize(idx);
+    pmh_element_type hx[6] = {pmh_H1, pmh_H2, pmh_H3, pmh_H4, pmh_H5, pmh_H6};
+    for (int i = 0; i < 6; ++i) {
+        m_headerRegions.append(p_result.m_elements[hx[i]]);
     }
 
-    qDebug() << "highlighter: parse" << m_imageRegions.size() << "image regions";
+    std::sort(m_headerRegions.begin(), m_headerRegions.end());
 
-    emit imageLinksUpdated(m_imageRegions);
+    qDebug() << "highlighter: parse" << m_headerRegions.size() << "header regions";
 }
 
-void HGMarkdownHighlighter::initHeaderRegionsFromResult()
+VRegionsDelta HGMarkdownHighlighter::diffRegions(const QVector<VElementRegion> &p_oldRegions,
+                                                 const QVector<VElementRegion> &p_newRegions,
+                                                 const DirtyRange &p_dirty) const
 {
-    if (!result) {
-        // From Qt5.7, the capacity is preserved.
-        m_headerRegions.clear();
-        emit headersUpdated(m_headerRegions);
-        return;
+    VRegionsDelta delta;
+    if (m_forceRegionsUpdate) {
+        delta.m_oldEnd = p_oldRegions.size();
+        delta.m_newEnd = p_newRegions.size();
+        delta.m_oldShiftPos = document->characterCount();
+        delta.m_shiftPos = document->characterCount();
+        return delta;
     }
 
-    int idx = 0;
-    int oriSize = m_headerRegions.size();
-    pmh_element_type hx[6] = {pmh_H1, pmh_H2, pmh_H3, pmh_H4, pmh_H5, pmh_H6};
-    for (int i = 0; i < 6; ++i) {
-        pmh_element *elem = result[hx[i]];
-        while (elem != NULL) {
-            if (elem->end <= elem->pos) {
-                elem = elem->next;
-                continue;
-            }
-
-            if (idx < oriSize) {
-                // Try to reuse the original element.
-                VElementRegion &reg = m_headerRegions[idx];
-                if ((int)elem->pos != reg.m_startPos || (int)elem->end != reg.m_endPos) {
-                    reg.m_startPos = (int)elem->pos;
-                    reg.m_endPos = (int)elem->end;
-                }
-            } else {
-                m_headerRegions.push_back(VElementRegion(elem->pos, elem->end));
-            }
-
-            ++idx;
-            elem = elem->next;
+    // Regions before the dirty range should be identical while regions after
+    // it should be shifted.
+    bool shifted = false;
+    auto same = [&p_dirty, &shifted](const VElementRegion &p_old, const VElementRegion &p_new) {
+        if (p_old.m_endPos <= p_dirty.m_start) {
+            return p_old == p_new;
+        } else if (p_old.m_startPos >= p_dirty.m_oldEnd
+                   && p_old.m_startPos + p_dirty.m_delta == p_new.m_startPos
+                   && p_old.m_endPos + p_dirty.m_delta == p_new.m_endPos) {
+            shifted = true;
+            return true;
         }
-    }
 
-    if (idx < oriSize) {
-        m_headerRegions.resize(idx);
+        return false;
+    };
+
+    int oldEnd = p_oldRegions.size();
+    int newEnd = p_newRegions.size();
+    int first = 0;
+    while (first < oldEnd && first < newEnd
+           && same(p_oldRegions[first], p_newRegions[first])) {
+        ++first;
     }
 
-    std::sort(m_headerRegions.begin(), m_headerRegions.end());
+    while (oldEnd > first && newEnd > first
+           && same(p_oldRegions[oldEnd - 1], p_newRegions[newEnd - 1])) {
+        --oldEnd;
+        --newEnd;
+    }
 
-    qDebug() << "highlighter: parse" << m_headerRegions.size() << "header regions";
+    delta.m_first = first;
+    delta.m_oldEnd = oldEnd;
+    delta.m_newEnd = newEnd;
+    delta.m_changeStart = p_dirty.m_start;
+    delta.m_oldShiftPos = p_dirty.m_oldEnd;
+    delta.m_shiftPos = p_dirty.m_oldEnd + p_dirty.m_delta;
+    if (shifted) {
+        delta.m_delta = p_dirty.m_delta;
+        delta.m_blockDelta = p_dirty.m_blockDelta;
+    }
 
-    emit headersUpdated(m_headerRegions);
+    return delta;
 }
 
-void HGMarkdownHighlighter::initBlockHighlihgtOne(unsigned long pos, unsigned long end, int styleIndex)
+void HGMarkdownHighlighter::signalRegionsUpdated(const QVector<VElementRegion> &p_oldImageRegions,
+                                                 const QVector<VElementRegion> &p_oldHeaderRegions,
+                                                 const DirtyRange &p_dirty)
 {
-    int startBlockNum = document->findBlock(pos).blockNumber();
-    int endBlockNum = document->findBlock(end).blockNumber();
-    for (int i = startBlockNum; i <= endBlockNum; ++i)
-    {
-        QTextBlock block = document->findBlockByNumber(i);
-        int blockStartPos = block.position();
-        HLUnit unit;
-        if (i == startBlockNum) {
-            unit.start = pos - blockStartPos;
-            unit.length = (startBlockNum == endBlockNum) ?
-                          (end - pos) : (block.length() - unit.start);
-        } else if (i == endBlockNum) {
-            unit.start = 0;
-            unit.length = end - blockStartPos;
-        } else {
-            unit.start = 0;
-            unit.length = block.length();
-        }
-        unit.styleIndex = styleIndex;
+    // The preview of an image block lies in the next block, so the image in the
+    // block before the dirty range is affected, too.
+    DirtyRange imageDirty = p_dirty;
+    QTextBlock block = document->findBlock(p_dirty.m_start);
+    if (block.isValid() && block.previous().isValid()) {
+        imageDirty.m_start = block.previous().position();
+    }
 
-        blockHighlights[i].append(unit);
+    VRegionsDelta imageDelta = diffRegions(p_oldImageRegions, m_imageRegions, imageDirty);
+    if (m_forceRegionsUpdate || !imageDelta.isEmpty()) {
+        emit imageLinksUpdated(m_imageRegions, imageDelta);
     }
+
+    VRegionsDelta headerDelta = diffRegions(p_oldHeaderRegions, m_headerRegions, p_dirty);
+    if (m_forceRegionsUpdate || !headerDelta.isEmpty()) {
+        emit headersUpdated(m_headerRegions, headerDelta);
+    }
+
+    m_forceRegionsUpdate = false;
 }
 
 void HGMarkdownHighlighter::highlightCodeBlock(const QString &text)
@@ -446,149 +486,794 @@ void HGMarkdownHighlighter::highlightLinkWithSpacesInURL(const QString &p_text)
     }
 }
 
-void HGMarkdownHighlighter::parse()
+void HGMarkdownHighlighter::prepareFullParse(HLParseRequest &p_request)
 {
-    if (!parsing.testAndSetRelaxed(0, 1)) {
-        return;
-    }
+    p_request.m_incremental = false;
+    p_request.m_offset = 0;
+
+    // Do not use toPlainText(), which will convert QChar::LineSeparator to
+    // new line and make the blocks mismatch.
+    QString &text = p_request.m_text;
+    text.reserve(document->characterCount());
+    for (QTextBlock block = document->firstBlock(); block.isValid(); block = block.next()) {
+        if (block != document->firstBlock()) {
+            text.append('\n');
+        }
 
-    if (highlightingStyles.isEmpty()) {
-        goto exit;
+        text.append(block.text());
     }
+}
 
-    {
-    int nrBlocks = document->blockCount();
-    parseInternal();
+void HGMarkdownHighlighter::applyFullParse(const HLParseResult &p_result, const DirtyRange &p_dirty)
+{
+    Q_ASSERT(p_result.m_blockHighlights.blockCount() == document->blockCount());
+    blockHighlights = p_result.m_blockHighlights;
 
-    initBlockHighlightFromResult(nrBlocks);
+    dumpMemoryUsage();
 
-    initHtmlCommentRegionsFromResult();
+    initHtmlCommentRegionsFromResult(p_result);
 
-    initImageRegionsFromResult();
+    initHtmlBlockRegionsFromResult(p_result);
 
-    initHeaderRegionsFromResult();
+    // QVector is implicitly shared.
+    QVector<VElementRegion> oldImageRegions = m_imageRegions;
+    QVector<VElementRegion> oldHeaderRegions = m_headerRegions;
 
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
-    }
-    }
+    initImageRegionsFromResult(p_result);
 
-exit:
-    parsing.store(0);
+    initHeaderRegionsFromResult(p_result);
+
+    signalRegionsUpdated(oldImageRegions, oldHeaderRegions, p_dirty);
 }
 
-void HGMarkdownHighlighter::parseInternal()
+void HGMarkdownHighlighter::handleContentChange(int position, int charsRemoved, int charsAdded)
 {
-    QString text = document->toPlainText();
-    QByteArray ba = text.toUtf8();
-    const char *data = (const char *)ba.data();
-    int len = ba.size();
+    if (charsRemoved == 0 && charsAdded == 0) {
+        return;
+    }
 
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
+    // Record the blocks touched by this change. The number of untouched blocks
+    // at the beginning and at the end stays valid across following changes.
+    int nrBlocks = document->blockCount();
+    QTextBlock firstBlock = document->findBlock(position);
+    QTextBlock lastBlock = document->findBlock(position + charsAdded);
+    int first = firstBlock.isValid() ? firstBlock.blockNumber() : 0;
+    int last = lastBlock.isValid() ? lastBlock.blockNumber() : nrBlocks - 1;
+
+    m_unchangedPrefixBlocks = qMin(m_unchangedPrefixBlocks, first);
+    m_unchangedSuffixBlocks = qMin(m_unchangedSuffixBlocks, nrBlocks - 1 - last);
+
+    // Highlights are indexed by the block numbers of last parse, which do
+    // not match the blocks after the change any more. Pause the backlog until
+    // the new parsing result is applied.
+    m_rehighlightTimer->stop();
+    if (m_rehighlightCursor > first) {
+        m_rehighlightCursor = first;
     }
 
-    if (len == 0) {
-        return;
-    } else if (len >= capacity) {
-        resizeBuffer(qMax(2 * capacity, len * 2));
-    } else if (len < (capacity >> 2)) {
-        resizeBuffer(qMax(capacity >> 1, len * 2));
+    // Visible blocks after the change may have been shifted.
+    if (m_rehighlightVisibleLast >= first) {
+        m_rehighlightVisibleLast = first - 1;
     }
 
-    memcpy(content, data, len);
-    content[len] = '\0';
+    // Results of pending parse requests are obsolete now.
+    ++m_revision;
+    m_parseWorker->setLatestRevision(m_revision);
 
-    pmh_markdown_to_elements(content, pmh_EXT_NONE, &result);
+    timer->stop();
+    timer->start();
 }
 
-void HGMarkdownHighlighter::handleContentChange(int /* position */, int charsRemoved, int charsAdded)
+void HGMarkdownHighlighter::timerTimeout()
 {
-    if (charsRemoved == 0 && charsAdded == 0) {
+    HLParseRequest req;
+    if (!prepareIncrementalParse(req)) {
+        prepareFullParse(req);
+    } else if (req.m_lastBlock < req.m_firstBlock) {
+        // Nothing changed since last parse.
+        resumeRehighlightBacklog();
+        highlightChanged();
         return;
     }
 
-    timer->stop();
-    timer->start();
+    req.m_revision = ++m_revision;
+    m_parseWorker->setLatestRevision(m_revision);
+
+    qDebug() << "HGMarkdownHighlighter request" << (req.m_incremental ? "an incremental" : "a full")
+             << "parse of revision" << req.m_revision;
+    emit parseRequested(req);
 }
 
-void HGMarkdownHighlighter::timerTimeout()
+void HGMarkdownHighlighter::handleParseResult(const QSharedPointer<HLParseResult> &p_result)
 {
-    qDebug() << "HGMarkdownHighlighter start a new parse";
-    parse();
-    if (!updateCodeBlocks()) {
-        rehighlight();
+    const HLParseRequest &req = p_result->m_request;
+    if (req.m_revision != m_revision) {
+        // The document has been changed since the snapshot.
+        qDebug() << "HGMarkdownHighlighter discard obsolete parse result of revision"
+                 << req.m_revision << m_revision;
+        return;
+    }
+
+    QElapsedTimer t;
+    t.start();
+
+    // The document is identical to the snapshot now.
+    if (!req.m_incremental) {
+        // Cancel pending rehighlight of obsolete result.
+        m_rehighlightTimer->stop();
+        m_rehighlightCursor = -1;
+    } else if (m_rehighlightCursor > req.m_firstBlock) {
+        m_rehighlightCursor = req.m_firstBlock;
+    }
+
+    // Changes since last parse.
+    int oldNrBlocks = blockHighlights.blockCount();
+    int charDelta = document->characterCount() - m_lastCharacterCount;
+    int firstDirtyBlock = m_unchangedPrefixBlocks;
+    int unchangedSuffixBlocks = m_unchangedSuffixBlocks;
+
+    if (req.m_incremental) {
+        qDebug() << "HGMarkdownHighlighter incremental parse of blocks"
+                 << req.m_firstBlock << req.m_lastBlock;
+        applyIncrementalParse(*p_result);
+    } else {
+        // Blocks [firstDirtyBlock, nrBlocks - unchangedSuffixBlocks) are dirty.
+        int nrBlocks = document->blockCount();
+        int first = qMin(firstDirtyBlock, nrBlocks);
+        int suffixFirst = nrBlocks - qMin(unchangedSuffixBlocks, nrBlocks);
+        int charCount = document->characterCount();
+
+        DirtyRange dirty;
+        dirty.m_start = first < nrBlocks ? document->findBlockByNumber(first).position() : charCount;
+        int newEnd = suffixFirst < nrBlocks ? document->findBlockByNumber(suffixFirst).position()
+                                            : charCount;
+        dirty.m_oldEnd = qMax(newEnd - charDelta, dirty.m_start);
+        dirty.m_delta = charDelta;
+        dirty.m_blockDelta = nrBlocks - oldNrBlocks;
+        applyFullParse(*p_result, dirty);
+    }
+
+    m_lastCharacterCount = document->characterCount();
+    m_fullParseNeeded = false;
+    resetChangeTracking();
+
+    if (req.m_incremental) {
+        rehighlightBlocks(req.m_firstBlock, req.m_lastBlock);
+        resumeRehighlightBacklog();
+    } else if (!updateCodeBlocks(firstDirtyBlock, unchangedSuffixBlocks,
+                                 oldNrBlocks, charDelta)) {
+        rehighlightVisibleFirst();
     }
 
+    qDebug() << "HGMarkdownHighlighter apply parse result of revision" << req.m_revision
+             << "in" << t.elapsed() << "ms";
+
     highlightChanged();
 }
 
 void HGMarkdownHighlighter::updateHighlight()
 {
     timer->stop();
+    m_fullParseNeeded = true;
+    m_forceRegionsUpdate = true;
     timerTimeout();
 }
 
-bool HGMarkdownHighlighter::updateCodeBlocks()
+void HGMarkdownHighlighter::resetChangeTracking()
+{
+    m_unchangedPrefixBlocks = INT_MAX;
+    m_unchangedSuffixBlocks = INT_MAX;
+}
+
+bool HGMarkdownHighlighter::isTopLevelBlockStart(int p_blockNum) const
+{
+    if (p_blockNum <= 0) {
+        return true;
+    }
+
+    QTextBlock block = document->findBlockByNumber(p_blockNum);
+    QString text = block.text();
+    if (text.isEmpty() || text[0].isSpace()) {
+        // Blank line or indented line, which may belong to previous list item
+        // or code block.
+        return false;
+    }
+
+    return block.previous().text().trimmed().isEmpty();
+}
+
+// Whether [@p_start, @p_end) overlaps with any region in @p_regions.
+static bool overlapRegions(const QVector<VElementRegion> &p_regions, int p_start, int p_end)
+{
+    for (auto const &reg : p_regions) {
+        if (reg.m_startPos < p_end && reg.m_endPos >= p_start) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Shift regions after @p_pos by @p_delta.
+static void shiftRegions(QVector<VElementRegion> &p_regions, int p_pos, int p_delta)
+{
+    if (p_delta == 0) {
+        return;
+    }
+
+    for (auto &reg : p_regions) {
+        if (reg.m_startPos >= p_pos) {
+            reg.m_startPos += p_delta;
+            reg.m_endPos += p_delta;
+        }
+    }
+}
+
+// Whether @p_text contains reference-style links or images, such as
+// [text][ref], [ref] and ![alt][ref]. The parser emits them only if their
+// reference definitions, which may be anywhere in the document, are parsed
+// together.
+// Task list markers [ ] and [x] are not counted.
+static bool containsReferenceLinks(const QString &p_text)
+{
+    int openPos = -1;
+    for (int i = 0; i < p_text.size(); ++i) {
+        const QChar &ch = p_text[i];
+        if (ch == '\\') {
+            // Escaped character.
+            ++i;
+        } else if (ch == '[') {
+            openPos = i;
+        } else if (ch == ']' && openPos > -1) {
+            int len = i - openPos - 1;
+            bool taskMarker = len == 1
+                              && (p_text[i - 1] == ' '
+                                  || p_text[i - 1].toLower() == 'x');
+            if (!taskMarker && (i + 1 >= p_text.size() || p_text[i + 1] != '(')) {
+                return true;
+            }
+
+            openPos = -1;
+        }
+    }
+
+    return false;
+}
+
+// Whether @p_text contains constructs which may span multiple top-level blocks
+// or affect other parts of the document.
+static bool containsBlockSpanningConstructs(const QString &p_text)
+{
+    static const QString fence("```");
+    static const QString commentStart("<!--");
+    static const QString commentEnd("-->");
+    static const QString refDef("]:");
+
+    if (p_text.contains(fence)
+        || p_text.contains(commentStart)
+        || p_text.contains(commentEnd)
+        || p_text.contains(refDef)
+        || containsReferenceLinks(p_text)) {
+        return true;
+    }
+
+    // HTML blocks.
+    bool lineStart = true;
+    for (int i = 0; i < p_text.size(); ++i) {
+        const QChar &ch = p_text[i];
+        if (ch == '\n') {
+            lineStart = true;
+        } else if (lineStart) {
+            if (ch == '<') {
+                return true;
+            } else if (!ch.isSpace()) {
+                lineStart = false;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool HGMarkdownHighlighter::prepareIncrementalParse(HLParseRequest &p_request)
 {
-    if (!g_config->getEnableCodeBlockHighlight()) {
-        m_codeBlockHighlights.clear();
+    if (m_fullParseNeeded
+        || highlightingStyles.isEmpty()
+        || blockHighlights.isEmpty()) {
         return false;
     }
 
-    m_codeBlockHighlights.resize(document->blockCount());
-    for (int i = 0; i < m_codeBlockHighlights.size(); ++i) {
-        m_codeBlockHighlights[i].clear();
+    p_request.m_incremental = true;
+
+    int nrBlocks = document->blockCount();
+    int oldNrBlocks = blockHighlights.blockCount();
+    if (m_unchangedPrefixBlocks == INT_MAX) {
+        // Nothing changed.
+        p_request.m_firstBlock = 0;
+        p_request.m_lastBlock = -1;
+        return true;
+    }
+
+    // Dirty range in current document and in the document of last parse.
+    int first = m_unchangedPrefixBlocks;
+    int last = nrBlocks - 1 - m_unchangedSuffixBlocks;
+    int oldLast = oldNrBlocks - 1 - m_unchangedSuffixBlocks;
+    if (first >= nrBlocks || last < first || oldLast < first - 1) {
+        return false;
+    }
+
+    // Expand the range to the boundaries of top-level Markdown blocks.
+    // Blocks out of the dirty range are identical in both documents.
+    while (!isTopLevelBlockStart(first)) {
+        --first;
     }
 
-    QVector<VCodeBlock> codeBlocks;
+    while (last < nrBlocks - 1 && !isTopLevelBlockStart(last + 1)) {
+        ++last;
+        ++oldLast;
+    }
+
+    // Re-parse the whole document if the range is not small enough.
+    const int maxRatio = 2;
+    if ((last - first + 1) * maxRatio > nrBlocks) {
+        return false;
+    }
 
-    VCodeBlock item;
+    QTextBlock firstBlock = document->findBlockByNumber(first);
+    QTextBlock lastBlock = document->findBlockByNumber(last);
+    int startPos = firstBlock.position();
+    int endPos = lastBlock.position() + lastBlock.length();
+    int delta = document->characterCount() - m_lastCharacterCount;
+    int oldEndPos = endPos - delta;
+
+    // Constructs spanning multiple blocks are changed.
+    if (overlapRegions(m_commentRegions, startPos, oldEndPos)
+        || overlapRegions(m_htmlBlockRegions, startPos, oldEndPos)
+        || overlapRegions(m_codeBlockRegions, startPos, oldEndPos)) {
+        return false;
+    }
+
+    QString text;
+    text.reserve(endPos - startPos);
+    for (QTextBlock block = firstBlock; block.isValid(); block = block.next()) {
+        text.append(block.text());
+        text.append('\n');
+        if (block == lastBlock) {
+            break;
+        }
+    }
+
+    if (containsBlockSpanningConstructs(text)) {
+        return false;
+    }
+
+    p_request.m_text = text;
+    p_request.m_offset = startPos;
+    p_request.m_firstBlock = first;
+    p_request.m_lastBlock = last;
+    p_request.m_oldLastBlock = oldLast;
+    p_request.m_oldEndPos = oldEndPos;
+    p_request.m_delta = delta;
+    return true;
+}
+
+void HGMarkdownHighlighter::applyIncrementalParse(const HLParseResult &p_result)
+{
+    const HLParseRequest &req = p_result.m_request;
+    int first = req.m_firstBlock;
+    int oldNrBlocks = blockHighlights.blockCount();
+
+    // Splice the highlights of the dirty range.
+    int oldCount = req.m_oldLastBlock - first + 1;
+    int newCount = req.m_lastBlock - first + 1;
+    Q_ASSERT(p_result.m_blockHighlights.blockCount() == newCount);
+    blockHighlights.replaceBlocks(first, oldCount, p_result.m_blockHighlights);
+
+    if (m_codeBlockHighlights.blockCount() == oldNrBlocks) {
+        HLBlockUnits<HLUnitStyle> emptyBlocks;
+        emptyBlocks.reset(newCount);
+        m_codeBlockHighlights.replaceBlocks(first, oldCount, emptyBlocks);
+    }
+
+    // Shift the block numbers after the dirty range.
+    int blockDelta = newCount - oldCount;
+    if (blockDelta != 0 && !m_potentialPreviewBlocks.isEmpty()) {
+        QMap<int, bool> blocks;
+        for (auto it = m_potentialPreviewBlocks.begin(); it != m_potentialPreviewBlocks.end(); ++it) {
+            int num = it.key();
+            if (num > req.m_oldLastBlock) {
+                num += blockDelta;
+            }
+
+            blocks.insert(num, it.value());
+        }
+
+        m_potentialPreviewBlocks = blocks;
+    }
+
+    // Regions.
+    int startPos = req.m_offset;
+    int oldEndPos = req.m_oldEndPos;
+    int delta = req.m_delta;
+    shiftRegions(m_commentRegions, oldEndPos, delta);
+    shiftRegions(m_htmlBlockRegions, oldEndPos, delta);
+    shiftRegions(m_codeBlockRegions, oldEndPos, delta);
+
+    // Code blocks do not overlap the dirty range.
+    for (auto &info : m_codeBlocks) {
+        VCodeBlock &cb = info.m_block;
+        if (cb.m_startPos >= oldEndPos) {
+            cb.m_startPos += delta;
+            cb.m_startBlock += blockDelta;
+            cb.m_endBlock += blockDelta;
+        }
+    }
+
+    if (m_unclosedCodeBlockStart > req.m_oldLastBlock) {
+        m_unclosedCodeBlockStart += blockDelta;
+    }
+
+    QVector<VElementRegion> oldImageRegions = m_imageRegions;
+    QVector<VElementRegion> oldHeaderRegions = m_headerRegions;
+
+    pmh_element_type imageTypes[1] = {pmh_IMAGE};
+    spliceRegionsFromResult(m_imageRegions, p_result, imageTypes, 1,
+                            startPos, oldEndPos, delta);
+    // Keep the descending order of the parser.
+    std::sort(m_imageRegions.begin(), m_imageRegions.end(),
+              [](const VElementRegion &p_a, const VElementRegion &p_b) {
+                return p_a.m_startPos > p_b.m_startPos
+                       || (p_a.m_startPos == p_b.m_startPos && p_a.m_endPos > p_b.m_endPos);
+              });
+
+    pmh_element_type hx[6] = {pmh_H1, pmh_H2, pmh_H3, pmh_H4, pmh_H5, pmh_H6};
+    spliceRegionsFromResult(m_headerRegions, p_result, hx, 6,
+                            startPos, oldEndPos, delta);
+    std::sort(m_headerRegions.begin(), m_headerRegions.end());
+
+    DirtyRange dirty;
+    dirty.m_start = startPos;
+    dirty.m_oldEnd = oldEndPos;
+    dirty.m_delta = delta;
+    dirty.m_blockDelta = blockDelta;
+    signalRegionsUpdated(oldImageRegions, oldHeaderRegions, dirty);
+}
+
+void HGMarkdownHighlighter::spliceRegionsFromResult(QVector<VElementRegion> &p_regions,
+                                                    const HLParseResult &p_result,
+                                                    const pmh_element_type *p_types,
+                                                    int p_nrTypes,
+                                                    int p_start,
+                                                    int p_oldEnd,
+                                                    int p_delta)
+{
+    for (int i = p_regions.size() - 1; i >= 0; --i) {
+        VElementRegion &reg = p_regions[i];
+        if (reg.m_startPos >= p_oldEnd) {
+            reg.m_startPos += p_delta;
+            reg.m_endPos += p_delta;
+        } else if (reg.m_endPos > p_start) {
+            p_regions.remove(i);
+        }
+    }
+
+    for (int i = 0; i < p_nrTypes; ++i) {
+        p_regions.append(p_result.m_elements[p_types[i]]);
+    }
+}
+
+void HGMarkdownHighlighter::rehighlightBlocks(int p_firstBlock, int p_lastBlock)
+{
+    if (p_firstBlock < 0 || p_lastBlock < p_firstBlock) {
+        return;
+    }
+
+    QTextBlock block = document->findBlockByNumber(p_firstBlock);
+    while (block.isValid() && block.blockNumber() <= p_lastBlock) {
+        rehighlightBlock(block);
+        block = block.next();
+    }
+}
+
+// Whether @p_text may be a fence, to avoid regular expression matching on
+// most of the blocks.
+static inline bool mayBeFence(const QString &p_text)
+{
+    int i = 0;
+    while (i < p_text.size() && p_text[i].isSpace()) {
+        ++i;
+    }
+
+    return p_text.midRef(i, 3) == QLatin1String("```");
+}
+
+QString HGMarkdownHighlighter::codeBlockText(const QTextBlock &p_startBlock,
+                                             const QTextBlock &p_endBlock) const
+{
+    QString text;
+    text.reserve(p_endBlock.position() + p_endBlock.length() - 1 - p_startBlock.position());
+    for (QTextBlock block = p_startBlock; block.isValid(); block = block.next()) {
+        if (block != p_startBlock) {
+            text.append('\n');
+        }
+
+        text.append(block.text());
+        if (block == p_endBlock) {
+            break;
+        }
+    }
+
+    return text;
+}
+
+// Append the parts of block range [@p_start, @p_end] of last parse out of
+// the dirty blocks to @p_ranges, with block numbers of current document.
+// Blocks [@p_dirtyStart, @p_oldDirtyEnd) of last parse are replaced by blocks
+// [@p_dirtyStart, @p_oldDirtyEnd + @p_blockDelta) of current document.
+static void appendCleanBlockRange(QVector<QPair<int, int>> &p_ranges,
+                                  int p_start,
+                                  int p_end,
+                                  int p_dirtyStart,
+                                  int p_oldDirtyEnd,
+                                  int p_blockDelta)
+{
+    if (p_start < p_dirtyStart) {
+        p_ranges.append(qMakePair(p_start, qMin(p_end, p_dirtyStart - 1)));
+    }
+
+    if (p_end >= p_oldDirtyEnd) {
+        p_ranges.append(qMakePair(qMax(p_start, p_oldDirtyEnd) + p_blockDelta,
+                                  p_end + p_blockDelta));
+    }
+}
+
+// Merge adjacent ranges of sorted @p_ranges.
+static void mergeBlockRanges(QVector<QPair<int, int>> &p_ranges)
+{
+    int nr = 0;
+    for (int i = 0; i < p_ranges.size(); ++i) {
+        if (nr > 0 && p_ranges[i].first <= p_ranges[nr - 1].second + 1) {
+            p_ranges[nr - 1].second = qMax(p_ranges[nr - 1].second, p_ranges[i].second);
+        } else {
+            p_ranges[nr++] = p_ranges[i];
+        }
+    }
+
+    p_ranges.resize(nr);
+}
+
+bool HGMarkdownHighlighter::updateCodeBlocks(int p_firstDirtyBlock,
+                                             int p_unchangedSuffixBlocks,
+                                             int p_oldNrBlocks,
+                                             int p_charDelta)
+{
+    bool enabled = g_config->getEnableCodeBlockHighlight();
+    int nrBlocks = document->blockCount();
+    int blockDelta = nrBlocks - p_oldNrBlocks;
+
+    const QVector<CodeBlockInfo> oldBlocks = m_codeBlocks;
+    int oldUnclosed = m_unclosedCodeBlockStart;
+
+    // Range to scan: [@scanStart, @suffixStart), where blocks from @suffixStart
+    // are identical to the ones of last parse.
+    int scanStart = 0;
+    int suffixStart = nrBlocks;
+    if (m_codeBlocksValid) {
+        scanStart = qMin(p_firstDirtyBlock, nrBlocks);
+        int suffix = qMin(p_unchangedSuffixBlocks, qMin(nrBlocks, p_oldNrBlocks) - scanStart);
+        suffixStart = nrBlocks - qMax(suffix, 0);
+    }
+
+    QVector<CodeBlockInfo> codeBlocks;
+    codeBlocks.reserve(oldBlocks.size());
+
+    // Keep the code blocks before @scanStart.
+    int idx = 0;
+    if (m_codeBlocksValid) {
+        while (idx < oldBlocks.size() && oldBlocks[idx].m_block.m_endBlock < scanStart) {
+            codeBlocks.append(oldBlocks[idx]);
+            ++idx;
+        }
+
+        if (idx < oldBlocks.size() && oldBlocks[idx].m_block.m_startBlock < scanStart) {
+            scanStart = oldBlocks[idx].m_block.m_startBlock;
+        } else if (idx == oldBlocks.size() && oldUnclosed > -1 && oldUnclosed < scanStart) {
+            scanStart = oldUnclosed;
+        }
+    }
+
+    int nrScanned = 0;
+    int unclosed = -1;
+    CodeBlockInfo item;
+    QTextBlock itemStartBlock;
     bool inBlock = false;
     int startLeadingSpaces = -1;
 
     // Only handle complete codeblocks.
-    QTextBlock block = document->firstBlock();
-    while (block.isValid()) {
-        QString text = block.text();
+    QTextBlock block = document->findBlockByNumber(scanStart);
+    for (int num = scanStart; block.isValid(); ++num, block = block.next()) {
+        if (!inBlock && num >= suffixStart) {
+            // If it is not inside a code block of last parse either, the rest
+            // code blocks are the same as last parse with a shift.
+            int oldNum = num - blockDelta;
+            while (idx < oldBlocks.size() && oldBlocks[idx].m_block.m_endBlock < oldNum) {
+                ++idx;
+            }
+
+            if ((idx == oldBlocks.size() || oldBlocks[idx].m_block.m_startBlock >= oldNum)
+                && (oldUnclosed == -1 || oldUnclosed >= oldNum)) {
+                for (; idx < oldBlocks.size(); ++idx) {
+                    CodeBlockInfo info = oldBlocks[idx];
+                    info.m_block.m_startPos += p_charDelta;
+                    info.m_block.m_startBlock += blockDelta;
+                    info.m_block.m_endBlock += blockDelta;
+                    codeBlocks.append(info);
+                }
+
+                if (oldUnclosed > -1) {
+                    unclosed = oldUnclosed + blockDelta;
+                }
+
+                break;
+            }
+        }
+
+        ++nrScanned;
+        const QString text = block.text();
+        if (!mayBeFence(text)) {
+            continue;
+        }
+
         if (inBlock) {
-            item.m_text = item.m_text + "\n" + text;
-            int idx = codeBlockEndExp.indexIn(text);
-            if (idx >= 0 && codeBlockEndExp.capturedTexts()[1].size() == startLeadingSpaces) {
+            int pos = codeBlockEndExp.indexIn(text);
+            if (pos >= 0 && codeBlockEndExp.capturedTexts()[1].size() == startLeadingSpaces) {
                 // End block.
                 inBlock = false;
-                item.m_endBlock = block.blockNumber();
-
-                // See if it is a code block inside HTML comment.
-                if (!isBlockInsideCommentRegion(block)) {
-                    qDebug() << "add one code block in lang" << item.m_lang;
-                    codeBlocks.append(item);
-                }
+                item.m_block.m_endBlock = num;
+                item.m_block.m_text = codeBlockText(itemStartBlock, block);
+                codeBlocks.append(item);
             }
         } else {
-            int idx = codeBlockStartExp.indexIn(text);
-            if (idx >= 0) {
+            int pos = codeBlockStartExp.indexIn(text);
+            if (pos >= 0) {
                 // Start block.
                 inBlock = true;
-                item.m_startBlock = block.blockNumber();
-                item.m_startPos = block.position();
-                item.m_text = text;
+                itemStartBlock = block;
+                item.m_block.m_startBlock = num;
+                item.m_block.m_startPos = block.position();
+                item.m_block.m_lang.clear();
                 if (codeBlockStartExp.captureCount() == 2) {
-                    item.m_lang = codeBlockStartExp.capturedTexts()[2];
+                    item.m_block.m_lang = codeBlockStartExp.capturedTexts()[2];
                 }
 
                 startLeadingSpaces = codeBlockStartExp.capturedTexts()[1].size();
             }
         }
+    }
 
-        block = block.next();
+    if (inBlock) {
+        unclosed = item.m_block.m_startBlock;
+    }
+
+    // Highlights of code blocks which are the same as last parse could be kept
+    // unless there are pending highlights which will be abandoned.
+    QHash<QString, int> oldHighlighted;
+    if (enabled
+        && m_numOfCodeBlockHighlightsToRecv <= 0
+        && m_codeBlockHighlights.blockCount() == p_oldNrBlocks) {
+        for (int i = 0; i < oldBlocks.size(); ++i) {
+            if (oldBlocks[i].m_highlighted) {
+                oldHighlighted.insert(oldBlocks[i].m_block.m_text, i);
+            }
+        }
     }
 
-    m_numOfCodeBlockHighlightsToRecv = codeBlocks.size();
+    // Blocks [0, @nrAppended) have been appended to @highlights.
+    HLBlockUnits<HLUnitStyle> highlights;
+    int nrAppended = 0;
+
+    m_codeBlockRegions.clear();
+    QVector<VCodeBlock> changedBlocks;
+    int nrKept = 0;
+    for (auto &info : codeBlocks) {
+        VCodeBlock &cb = info.m_block;
+        QTextBlock endBlock = document->findBlockByNumber(cb.m_endBlock);
+        m_codeBlockRegions.append(VElementRegion(cb.m_startPos,
+                                                 endBlock.position() + endBlock.length()));
+
+        // See if it is a code block inside HTML comment.
+        info.m_highlighted = enabled && !isBlockInsideCommentRegion(endBlock);
+        if (!info.m_highlighted) {
+            continue;
+        }
+
+        auto it = oldHighlighted.find(cb.m_text);
+        if (it != oldHighlighted.end()) {
+            const VCodeBlock &oldCb = oldBlocks[it.value()].m_block;
+            for (; nrAppended < cb.m_startBlock; ++nrAppended) {
+                highlights.appendBlock();
+            }
+
+            for (int i = 0; i <= cb.m_endBlock - cb.m_startBlock; ++i, ++nrAppended) {
+                int oldNum = oldCb.m_startBlock + i;
+                highlights.appendBlock(m_codeBlockHighlights.units(oldNum),
+                                       m_codeBlockHighlights.unitCount(oldNum));
+            }
+
+            ++nrKept;
+        } else {
+            qDebug() << "add one code block in lang" << cb.m_lang;
+            changedBlocks.append(cb);
+        }
+    }
+
+    if (enabled) {
+        for (; nrAppended < nrBlocks; ++nrAppended) {
+            highlights.appendBlock();
+        }
+    }
+
+    if (unclosed > -1) {
+        // An unclosed code block spans till the end.
+        m_codeBlockRegions.append(VElementRegion(document->findBlockByNumber(unclosed).position(),
+                                                 document->characterCount()));
+    }
+
+    qDebug() << "highlighter: scan" << nrScanned << "blocks for" << codeBlocks.size()
+             << "code blocks," << nrKept << "kept," << changedBlocks.size() << "changed";
+
+    // Headers are checked against the code block state of their blocks, which
+    // the parser does not know. Signal the headers again if the blocks out of
+    // the dirty range get in or out of code blocks.
+    if (m_codeBlocksValid) {
+        int dirtyStart = qMin(p_firstDirtyBlock, nrBlocks);
+        int suffix = qMax(qMin(p_unchangedSuffixBlocks,
+                               qMin(nrBlocks, p_oldNrBlocks) - dirtyStart),
+                          0);
+        int oldDirtyEnd = p_oldNrBlocks - suffix;
+
+        QVector<QPair<int, int>> oldRanges, newRanges;
+        for (auto const &info : oldBlocks) {
+            appendCleanBlockRange(oldRanges, info.m_block.m_startBlock, info.m_block.m_endBlock,
+                                  dirtyStart, oldDirtyEnd, blockDelta);
+        }
+
+        if (oldUnclosed > -1) {
+            appendCleanBlockRange(oldRanges, oldUnclosed, p_oldNrBlocks - 1,
+                                  dirtyStart, oldDirtyEnd, blockDelta);
+        }
+
+        for (auto const &info : codeBlocks) {
+            appendCleanBlockRange(newRanges, info.m_block.m_startBlock, info.m_block.m_endBlock,
+                                  dirtyStart, oldDirtyEnd + blockDelta, 0);
+        }
+
+        if (unclosed > -1) {
+            appendCleanBlockRange(newRanges, unclosed, nrBlocks - 1,
+                                  dirtyStart, oldDirtyEnd + blockDelta, 0);
+        }
+
+        mergeBlockRanges(oldRanges);
+        mergeBlockRanges(newRanges);
+        if (oldRanges != newRanges) {
+            qDebug() << "highlighter: code block state of clean blocks changed";
+            VRegionsDelta delta;
+            delta.m_oldEnd = m_headerRegions.size();
+            delta.m_newEnd = m_headerRegions.size();
+            delta.m_oldShiftPos = document->characterCount();
+            delta.m_shiftPos = document->characterCount();
+            emit headersUpdated(m_headerRegions, delta);
+        }
+    }
+
+    m_codeBlocks = codeBlocks;
+    m_unclosedCodeBlockStart = unclosed;
+    m_codeBlocksValid = true;
+    m_codeBlockHighlights = highlights;
+
+    m_numOfCodeBlockHighlightsToRecv = changedBlocks.size();
     if (m_numOfCodeBlockHighlightsToRecv > 0) {
-        emit codeBlocksUpdated(codeBlocks);
+        emit codeBlocksUpdated(changedBlocks);
         return true;
     } else {
         return false;
@@ -606,6 +1291,23 @@ static bool HLUnitStyleComp(const HLUnitStyle &a, const HLUnitStyle &b)
     }
 }
 
+const QVector<int> &HGMarkdownHighlighter::getBlockStarts()
+{
+    if (m_blockStartsRevision == m_revision) {
+        return m_blockStarts;
+    }
+
+    m_blockStarts.clear();
+    m_blockStarts.reserve(document->blockCount() + 1);
+    for (QTextBlock block = document->firstBlock(); block.isValid(); block = block.next()) {
+        m_blockStarts.append(block.position());
+    }
+
+    m_blockStarts.append(document->characterCount());
+    m_blockStartsRevision = m_revision;
+    return m_blockStarts;
+}
+
 void HGMarkdownHighlighter::setCodeBlockHighlights(const QVector<HLUnitPos> &p_units)
 {
     if (p_units.isEmpty()) {
@@ -613,55 +1315,95 @@ void HGMarkdownHighlighter::setCodeBlockHighlights(const QVector<HLUnitPos> &p_u
     }
 
     {
-    QVector<QVector<HLUnitStyle>> highlights(m_codeBlockHighlights.size());
+    const QVector<int> &starts = getBlockStarts();
+    int nrBlocks = m_codeBlockHighlights.blockCount();
+
+    // Units of each block. Units of one code block are within a range of
+    // consecutive blocks.
+    QVector<QPair<int, HLUnitStyle>> highlights;
+    highlights.reserve(p_units.size());
+    int firstBlock = nrBlocks, lastBlock = -1;
 
     for (auto const &unit : p_units) {
         int pos = unit.m_position;
         int end = unit.m_position + unit.m_length;
-        int startBlockNum = document->findBlock(pos).blockNumber();
-        int endBlockNum = document->findBlock(end).blockNumber();
 
         // Text has been changed. Abandon the obsolete parsed result.
-        if (startBlockNum == -1 || endBlockNum >= highlights.size()) {
+        if (pos < 0 || end > starts.last()) {
             goto exit;
         }
 
+        // Units of unknown styles take no effect.
+        auto styleIt = m_codeBlockStyleIndexes.find(unit.m_style);
+        if (styleIt == m_codeBlockStyleIndexes.end()) {
+            continue;
+        }
+
+        int styleIdx = styleIt.value();
+
+        int startBlockNum = VMarkdownParseWorker::blockIndexOfPosition(starts, pos);
+        int endBlockNum = VMarkdownParseWorker::blockIndexOfPosition(starts, end);
+        if (endBlockNum >= nrBlocks) {
+            goto exit;
+        }
+
+        firstBlock = qMin(firstBlock, startBlockNum);
+        lastBlock = qMax(lastBlock, endBlockNum);
+
         for (int i = startBlockNum; i <= endBlockNum; ++i)
         {
-            QTextBlock block = document->findBlockByNumber(i);
-            int blockStartPos = block.position();
+            int blockStartPos = starts[i];
+            int blockLength = starts[i + 1] - blockStartPos;
             HLUnitStyle hl;
-            hl.style = unit.m_style;
+            hl.styleIndex = styleIdx;
             if (i == startBlockNum) {
                 hl.start = pos - blockStartPos;
                 hl.length = (startBlockNum == endBlockNum) ?
-                                (end - pos) : (block.length() - hl.start);
+                                (end - pos) : (blockLength - hl.start);
             } else if (i == endBlockNum) {
                 hl.start = 0;
                 hl.length = end - blockStartPos;
             } else {
                 hl.start = 0;
-                hl.length = block.length();
+                hl.length = blockLength;
             }
 
-            highlights[i].append(hl);
+            highlights.append(qMakePair(i, hl));
         }
     }
 
+    if (highlights.isEmpty()) {
+        goto exit;
+    }
+
     // Need to highlight in order.
-    for (int i = 0; i < highlights.size(); ++i) {
-        QVector<HLUnitStyle> &units = highlights[i];
-        if (!units.isEmpty()) {
-            std::sort(units.begin(), units.end(), HLUnitStyleComp);
-            m_codeBlockHighlights[i].append(units);
+    std::sort(highlights.begin(), highlights.end(),
+              [](const QPair<int, HLUnitStyle> &p_a, const QPair<int, HLUnitStyle> &p_b) {
+                  if (p_a.first != p_b.first) {
+                      return p_a.first < p_b.first;
+                  }
+
+                  return HLUnitStyleComp(p_a.second, p_b.second);
+              });
+
+    // Append the units after existing units of each block.
+    HLBlockUnits<HLUnitStyle> blocks;
+    int idx = 0;
+    for (int i = firstBlock; i <= lastBlock; ++i) {
+        blocks.appendBlock(m_codeBlockHighlights.units(i),
+                           m_codeBlockHighlights.unitCount(i));
+        for (; idx < highlights.size() && highlights[idx].first == i; ++idx) {
+            blocks.appendUnit(highlights[idx].second);
         }
     }
+
+    m_codeBlockHighlights.replaceBlocks(firstBlock, lastBlock - firstBlock + 1, blocks);
     }
 
 exit:
     --m_numOfCodeBlockHighlightsToRecv;
     if (m_numOfCodeBlockHighlightsToRecv <= 0) {
-        rehighlight();
+        rehighlightVisibleFirst();
     }
 }
 
@@ -674,13 +1416,17 @@ bool HGMarkdownHighlighter::isBlockInsideCommentRegion(const QTextBlock &p_block
     int start = p_block.position();
     int end = start + p_block.length();
 
-    for (auto const & reg : m_commentRegions) {
-        if (reg.contains(start) && reg.contains(end)) {
-            return true;
-        }
+    // The last region starting at or before @start.
+    auto it = std::upper_bound(m_commentRegions.begin(), m_commentRegions.end(), start,
+                               [](int p_pos, const VElementRegion &p_reg) {
+                                   return p_pos < p_reg.m_startPos;
+                               });
+    if (it == m_commentRegions.begin()) {
+        return false;
     }
 
-    return false;
+    --it;
+    return it->contains(start) && it->contains(end);
 }
 
 void HGMarkdownHighlighter::highlightChanged()
@@ -688,3 +1434,74 @@ void HGMarkdownHighlighter::highlightChanged()
     m_completeTimer->stop();
     m_completeTimer->start();
 }
+
+void HGMarkdownHighlighter::tryToSignalHighlightCompleted()
+{
+    if (m_rehighlightCursor == -1) {
+        emit highlightCompleted();
+    }
+}
+
+void HGMarkdownHighlighter::rehighlightVisibleFirst()
+{
+    m_rehighlightTimer->stop();
+
+    int first = 0, last = -1;
+    if (m_visibleBlockRangeProvider) {
+        m_visibleBlockRangeProvider(first, last);
+    }
+
+    if (last < first) {
+        // No idea about the visible blocks.
+        m_rehighlightCursor = -1;
+        rehighlight();
+        return;
+    }
+
+    rehighlightBlocks(first, last);
+
+    m_rehighlightVisibleFirst = first;
+    m_rehighlightVisibleLast = last;
+    m_rehighlightCursor = 0;
+    m_rehighlightTimer->start();
+}
+
+void HGMarkdownHighlighter::resumeRehighlightBacklog()
+{
+    if (m_rehighlightCursor != -1) {
+        m_rehighlightTimer->start();
+    }
+}
+
+void HGMarkdownHighlighter::rehighlightNextChunk()
+{
+    if (m_rehighlightCursor == -1) {
+        return;
+    }
+
+    // Time slice of one chunk in ms.
+    static const int chunkTime = 20;
+
+    QElapsedTimer t;
+    t.start();
+
+    QTextBlock block = document->findBlockByNumber(m_rehighlightCursor);
+    while (block.isValid()) {
+        if (m_rehighlightCursor < m_rehighlightVisibleFirst
+            || m_rehighlightCursor > m_rehighlightVisibleLast) {
+            rehighlightBlock(block);
+        }
+
+        block = block.next();
+        ++m_rehighlightCursor;
+
+        if (block.isValid() && t.elapsed() >= chunkTime) {
+            m_rehighlightTimer->start();
+            return;
+        }
+    }
+
+    qDebug() << "HGMarkdownHighlighter rehighlight backlog drained";
+    m_rehighlightCursor = -1;
+    highlightChanged();
+}
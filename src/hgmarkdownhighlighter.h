@@ -3,10 +3,14 @@
 
 #include <QTextCharFormat>
 #include <QSyntaxHighlighter>
-#include <QAtomicInt>
 #include <QMap>
 #include <QString>
 #include <QHash>
+#include <QVector>
+#include <QSharedPointer>
+#include <QMetaType>
+#include <algorithm>
+#include <functional>
 
 extern "C" {
 #include <pmh_parser.h>
@@ -14,8 +18,11 @@ extern "C" {
 
 QT_BEGIN_NAMESPACE
 class QTextDocument;
+class QThread;
 QT_END_NAMESPACE
 
+class VMarkdownParseWorker;
+
 struct HighlightingStyle
 {
     pmh_element_type type;
@@ -29,16 +36,165 @@ struct HLUnit
 {
     // Highlight offset @start and @length with style HighlightingStyles[styleIndex]
     // within a QTextBlock
-    unsigned long start;
-    unsigned long length;
+    unsigned int start;
+    unsigned int length;
     unsigned int styleIndex;
 };
 
 struct HLUnitStyle
 {
-    unsigned long start;
-    unsigned long length;
-    QString style;
+    unsigned int start;
+    unsigned int length;
+
+    // Index of the code block format in the highlighter.
+    unsigned int styleIndex;
+};
+
+// Highlight units of consecutive blocks stored in one flat array.
+// Units of the ith block are [m_offsets[i], m_offsets[i + 1]) of m_units.
+// Clearing keeps the capacity so the storage could be reused across parses.
+template<typename T>
+class HLBlockUnits
+{
+public:
+    HLBlockUnits()
+    {
+        m_offsets.append(0);
+    }
+
+    int blockCount() const
+    {
+        return m_offsets.size() - 1;
+    }
+
+    bool isEmpty() const
+    {
+        return blockCount() == 0;
+    }
+
+    int unitCount() const
+    {
+        return m_units.size();
+    }
+
+    // Number of units of block @p_block.
+    int unitCount(int p_block) const
+    {
+        return m_offsets[p_block + 1] - m_offsets[p_block];
+    }
+
+    // Units of block @p_block.
+    const T *units(int p_block) const
+    {
+        return m_units.constData() + m_offsets[p_block];
+    }
+
+    T *units(int p_block)
+    {
+        return m_units.data() + m_offsets[p_block];
+    }
+
+    void clear()
+    {
+        m_units.clear();
+        m_offsets.resize(1);
+    }
+
+    // Reset to @p_nrBlocks blocks without any unit.
+    void reset(int p_nrBlocks)
+    {
+        m_units.clear();
+        m_offsets.fill(0, p_nrBlocks + 1);
+    }
+
+    // Reserve @p_nrUnits units.
+    void reserve(int p_nrUnits)
+    {
+        m_units.reserve(p_nrUnits);
+    }
+
+    // Append a new block with @p_count units of @p_units.
+    void appendBlock(const T *p_units = NULL, int p_count = 0)
+    {
+        for (int i = 0; i < p_count; ++i) {
+            m_units.append(p_units[i]);
+        }
+
+        m_offsets.append(m_units.size());
+    }
+
+    // Append @p_unit to the last block.
+    void appendUnit(const T &p_unit)
+    {
+        Q_ASSERT(!isEmpty());
+        m_units.append(p_unit);
+        ++m_offsets.last();
+    }
+
+    // Set the units of each block by their count. Units are not initialized.
+    void setUnitCounts(const QVector<int> &p_counts)
+    {
+        m_offsets.resize(p_counts.size() + 1);
+        m_offsets[0] = 0;
+        for (int i = 0; i < p_counts.size(); ++i) {
+            m_offsets[i + 1] = m_offsets[i] + p_counts[i];
+        }
+
+        m_units.resize(m_offsets.last());
+    }
+
+    // Replace @p_count blocks from @p_first with all the blocks of @p_blocks.
+    void replaceBlocks(int p_first, int p_count, const HLBlockUnits<T> &p_blocks)
+    {
+        int unitStart = m_offsets[p_first];
+        int unitEnd = m_offsets[p_first + p_count];
+        int unitDelta = p_blocks.unitCount() - (unitEnd - unitStart);
+        replaceRange(m_units, unitStart, unitEnd - unitStart,
+                     p_blocks.m_units.constData(), p_blocks.m_units.size());
+
+        replaceRange(m_offsets, p_first + 1, p_count,
+                     p_blocks.m_offsets.constData() + 1, p_blocks.blockCount());
+        for (int i = p_first + 1; i <= p_first + p_blocks.blockCount(); ++i) {
+            m_offsets[i] += unitStart;
+        }
+
+        for (int i = p_first + p_blocks.blockCount() + 1; i < m_offsets.size(); ++i) {
+            m_offsets[i] += unitDelta;
+        }
+    }
+
+    // Bytes allocated.
+    qint64 memoryUsage() const
+    {
+        return (qint64)m_units.capacity() * sizeof(T)
+               + (qint64)m_offsets.capacity() * sizeof(int);
+    }
+
+private:
+    // Replace @p_oldLen elements from @p_pos of @p_vec with @p_newLen
+    // elements of @p_src.
+    template<typename E>
+    static void replaceRange(QVector<E> &p_vec, int p_pos, int p_oldLen,
+                             const E *p_src, int p_newLen)
+    {
+        int oldSize = p_vec.size();
+        int delta = p_newLen - p_oldLen;
+        if (delta > 0) {
+            p_vec.resize(oldSize + delta);
+            std::move_backward(p_vec.begin() + p_pos + p_oldLen,
+                               p_vec.begin() + oldSize,
+                               p_vec.end());
+        } else if (delta < 0) {
+            std::move(p_vec.begin() + p_pos + p_oldLen, p_vec.end(),
+                      p_vec.begin() + p_pos + p_newLen);
+            p_vec.resize(oldSize + delta);
+        }
+
+        std::copy(p_src, p_src + p_newLen, p_vec.begin() + p_pos);
+    }
+
+    QVector<T> m_units;
+    QVector<int> m_offsets;
 };
 
 // Fenced code block only.
@@ -106,6 +262,132 @@ struct VElementRegion
     }
 };
 
+// Difference between two versions of regions sorted in the same order.
+// Regions [m_first, m_oldEnd) of the old version are replaced by regions
+// [m_first, m_newEnd) of the new version. Other regions are kept, while those
+// starting from @m_shiftPos of the new version are shifted by @m_delta
+// characters and @m_blockDelta blocks.
+// Text of [m_changeStart, m_oldShiftPos) of the old version has been changed
+// into text of [m_changeStart, m_shiftPos) of the new version.
+struct VRegionsDelta
+{
+    VRegionsDelta()
+        : m_first(0), m_oldEnd(0), m_newEnd(0), m_changeStart(0),
+          m_oldShiftPos(0), m_shiftPos(0), m_delta(0), m_blockDelta(0)
+    {
+    }
+
+    // Whether some regions are added, removed or changed.
+    bool hasChange() const
+    {
+        return m_first < m_oldEnd || m_first < m_newEnd;
+    }
+
+    // Whether regions are only shifted without any change.
+    bool isShiftOnly() const
+    {
+        return !hasChange() && (m_delta != 0 || m_blockDelta != 0);
+    }
+
+    bool isEmpty() const
+    {
+        return !hasChange() && m_delta == 0 && m_blockDelta == 0;
+    }
+
+    int m_first;
+    int m_oldEnd;
+    int m_newEnd;
+
+    int m_changeStart;
+    int m_oldShiftPos;
+    int m_shiftPos;
+    int m_delta;
+    int m_blockDelta;
+};
+
+// PEG Markdown Highlight strips UTF-8 continuation bytes (and the BOM) before
+// parsing, so positions of elements are offsets in Unicode code points, which
+// differ from offsets in QString (UTF-16) after any character outside the BMP.
+// Translate the offsets with the positions of the surrogate pairs.
+class HLOffsetTable
+{
+public:
+    explicit HLOffsetTable(const QString &p_text);
+
+    // Translate offset @p_offset of the parser into offset in QString.
+    int toStringOffset(unsigned long p_offset) const;
+
+private:
+    // Offset in QString of code point 0 of the parser.
+    int m_base;
+
+    // Code point offsets of all the surrogate pairs, in ascending order.
+    QVector<int> m_pairs;
+};
+
+inline int HLOffsetTable::toStringOffset(unsigned long p_offset) const
+{
+    int offset = (int)p_offset + m_base;
+    if (m_pairs.isEmpty()) {
+        return offset;
+    }
+
+    auto it = std::lower_bound(m_pairs.begin(), m_pairs.end(), (int)p_offset);
+    return offset + (int)(it - m_pairs.begin());
+}
+
+// A request to parse a snapshot of the document in background.
+struct HLParseRequest
+{
+    HLParseRequest()
+        : m_revision(0), m_offset(0), m_incremental(false), m_firstBlock(0),
+          m_lastBlock(-1), m_oldLastBlock(-1), m_oldEndPos(0), m_delta(0)
+    {
+    }
+
+    // Revision of the highlighter when the snapshot is taken.
+    int m_revision;
+
+    // Text to parse.
+    QString m_text;
+
+    // The position in document of @m_text.
+    int m_offset;
+
+    // Whether it is a parse of only part of the document.
+    bool m_incremental;
+
+    // For incremental parse, blocks [@m_firstBlock, @m_lastBlock] of current
+    // document replace blocks [@m_firstBlock, @m_oldLastBlock] of last parse.
+    int m_firstBlock;
+    int m_lastBlock;
+    int m_oldLastBlock;
+
+    // For incremental parse, the end position of the range in the document
+    // of last parse.
+    int m_oldEndPos;
+
+    // For incremental parse, the change of character count since last parse.
+    int m_delta;
+};
+
+// Result of a parse request.
+struct HLParseResult
+{
+    HLParseRequest m_request;
+
+    // Element regions of each language element type.
+    // Positions have been translated into positions in document.
+    QVector<QVector<VElementRegion> > m_elements;
+
+    // Highlight units of each parsed block, starting from block
+    // m_request.m_firstBlock.
+    HLBlockUnits<HLUnit> m_blockHighlights;
+};
+
+Q_DECLARE_METATYPE(HLParseRequest)
+Q_DECLARE_METATYPE(QSharedPointer<HLParseResult>)
+
 class HGMarkdownHighlighter : public QSyntaxHighlighter
 {
     Q_OBJECT
@@ -124,17 +406,31 @@ public:
 
     const QVector<VElementRegion> &getHeaderRegions() const;
 
+    // Provider of the block number range of the visible blocks, which will
+    // be rehighlighted before other blocks.
+    typedef std::function<void(int &p_first, int &p_last)> VisibleBlockRangeProvider;
+    void setVisibleBlockRangeProvider(const VisibleBlockRangeProvider &p_provider);
+
 signals:
     void highlightCompleted();
 
+    // Emitted with the added or changed code blocks which need to be
+    // highlighted. Other code blocks keep their highlights.
     // QVector is implicitly shared.
     void codeBlocksUpdated(const QVector<VCodeBlock> &p_codeBlocks);
 
-    // Emitted when image regions have been fetched from a new parsing result.
-    void imageLinksUpdated(const QVector<VElementRegion> &p_imageRegions);
+    // Emitted when image regions of a new parsing result differ from last one.
+    // @p_delta: the difference to the regions of last signal.
+    void imageLinksUpdated(const QVector<VElementRegion> &p_imageRegions,
+                           const VRegionsDelta &p_delta);
 
-    // Emitted when header regions have been fetched from a new parsing result.
-    void headersUpdated(const QVector<VElementRegion> &p_headerRegions);
+    // Emitted when header regions of a new parsing result differ from last one.
+    // @p_delta: the difference to the regions of last signal.
+    void headersUpdated(const QVector<VElementRegion> &p_headerRegions,
+                        const VRegionsDelta &p_delta);
+
+    // Request the worker to parse a snapshot of the document.
+    void parseRequested(const HLParseRequest &p_request);
 
 protected:
     void highlightBlock(const QString &text) Q_DECL_OVERRIDE;
@@ -146,6 +442,15 @@ private slots:
     void handleContentChange(int position, int charsRemoved, int charsAdded);
     void timerTimeout();
 
+    // Apply the result from the parse worker if it is not stale.
+    void handleParseResult(const QSharedPointer<HLParseResult> &p_result);
+
+    // Rehighlight the next chunk of blocks in the backlog.
+    void rehighlightNextChunk();
+
+    // Try to signal highlightCompleted() if all blocks have been rehighlighted.
+    void tryToSignalHighlightCompleted();
+
 private:
     QRegExp codeBlockStartExp;
     QRegExp codeBlockEndExp;
@@ -156,14 +461,28 @@ private:
 
     QTextDocument *document;
     QVector<HighlightingStyle> highlightingStyles;
-    QHash<QString, QTextCharFormat> m_codeBlockStyles;
-    QVector<QVector<HLUnit> > blockHighlights;
+
+    // Formats of code block styles followed by the formats merged from
+    // nested styles. Index is the style index of HLUnitStyle.
+    QVector<QTextCharFormat> m_codeBlockFormats;
+
+    // Style name to the index in m_codeBlockFormats.
+    QHash<QString, int> m_codeBlockStyleIndexes;
+
+    // (outer format index, inner format index) to the index of the merged
+    // format in m_codeBlockFormats.
+    QHash<quint64, int> m_mergedCodeBlockFormats;
+
+    // Format index of each character of current block in highlightBlock().
+    // Reused to avoid allocation.
+    QVector<int> m_blockFormatIndexes;
+    HLBlockUnits<HLUnit> blockHighlights;
 
     // Use another member to store the codeblocks highlights, because the highlight
     // sequence is blockHighlights, regular-expression-based highlihgts, and then
     // codeBlockHighlights.
     // Support fenced code block only.
-    QVector<QVector<HLUnitStyle> > m_codeBlockHighlights;
+    HLBlockUnits<HLUnitStyle> m_codeBlockHighlights;
 
     int m_numOfCodeBlockHighlightsToRecv;
 
@@ -173,6 +492,8 @@ private:
     QMap<int, bool> m_potentialPreviewBlocks;
 
     // All HTML comment regions.
+    // Sorted by start position and merged to be non-overlapping, so that
+    // we could search it with binary search.
     QVector<VElementRegion> m_commentRegions;
 
     // All image link regions.
@@ -183,20 +504,88 @@ private:
     // Sorted by start position.
     QVector<VElementRegion> m_headerRegions;
 
+    // All HTML block regions, which may span multiple top-level blocks.
+    QVector<VElementRegion> m_htmlBlockRegions;
+
+    // All fenced code block regions, including the fences.
+    QVector<VElementRegion> m_codeBlockRegions;
+
+    struct CodeBlockInfo
+    {
+        VCodeBlock m_block;
+
+        // Whether it is highlighted via codeBlocksUpdated(), that is, it is
+        // not inside HTML comment.
+        bool m_highlighted;
+    };
+
+    // All complete fenced code blocks of the document at last parse.
+    // Sorted by the start block.
+    QVector<CodeBlockInfo> m_codeBlocks;
+
+    // Start block number of the unclosed code block at the end. -1 if none.
+    int m_unclosedCodeBlockStart;
+
+    // Whether m_codeBlocks is valid to be updated incrementally.
+    bool m_codeBlocksValid;
+
+    // Range of the document changed by the parse being applied.
+    // [m_start, m_oldEnd) of old text is replaced and text after it is shifted
+    // by m_delta characters and m_blockDelta blocks.
+    struct DirtyRange
+    {
+        int m_start;
+        int m_oldEnd;
+        int m_delta;
+        int m_blockDelta;
+    };
+
+    // Number of blocks at the beginning and at the end of the document which
+    // have not been changed since last parse.
+    int m_unchangedPrefixBlocks;
+    int m_unchangedSuffixBlocks;
+
+    // Character count of the document at last parse.
+    int m_lastCharacterCount;
+
+    // Force a full parse next time.
+    bool m_fullParseNeeded;
+
+    // Signal image and header regions next time even if they do not change,
+    // since consumers expect a signal for a requested parse.
+    bool m_forceRegionsUpdate;
+
     // Timer to signal highlightCompleted().
     QTimer *m_completeTimer;
 
-    QAtomicInt parsing;
+    VisibleBlockRangeProvider m_visibleBlockRangeProvider;
+
+    // Blocks from @m_rehighlightCursor to the end of document are waiting
+    // to be rehighlighted in chunks by @m_rehighlightTimer, except the visible
+    // blocks [@m_rehighlightVisibleFirst, @m_rehighlightVisibleLast] which
+    // have been rehighlighted. -1 if there is no pending rehighlight.
+    int m_rehighlightCursor;
+    int m_rehighlightVisibleFirst;
+    int m_rehighlightVisibleLast;
+    QTimer *m_rehighlightTimer;
+
     QTimer *timer;
     int waitInterval;
 
-    char *content;
-    int capacity;
-    pmh_element **result;
+    // Revision of the highlighter, which is increased when the document
+    // is changed or a new parse is requested. Parsing results of old
+    // revision are obsolete.
+    int m_revision;
+
+    // Cache of getBlockStarts(), valid if @m_blockStartsRevision equals to
+    // @m_revision.
+    QVector<int> m_blockStarts;
+    int m_blockStartsRevision;
 
-    static const int initCapacity;
+    // Worker to parse the document in @m_parseThread.
+    VMarkdownParseWorker *m_parseWorker;
+    QThread *m_parseThread;
 
-    void resizeBuffer(int newCap);
     void highlightCodeBlock(const QString &text);
 
     // Highlight links using regular expression.
@@ -204,24 +593,98 @@ private:
     // intended to complement this.
     void highlightLinkWithSpacesInURL(const QString &p_text);
 
-    void parse();
-    void parseInternal();
-    void initBlockHighlightFromResult(int nrBlocks);
-    void initBlockHighlihgtOne(unsigned long pos, unsigned long end,
-                               int styleIndex);
-
-    // Return true if there are fenced code blocks and it will call rehighlight() later.
+    // Prepare a request to parse the whole document.
+    void prepareFullParse(HLParseRequest &p_request);
+
+    // Apply a parsing result of the whole document.
+    // @p_dirty: the range changed since last parse.
+    void applyFullParse(const HLParseResult &p_result, const DirtyRange &p_dirty);
+
+    // Prepare a request to re-parse only the top-level Markdown blocks affected
+    // by the changes since last parse.
+    // Returns false if a full parse is needed.
+    bool prepareIncrementalParse(HLParseRequest &p_request);
+
+    // Splice the result of an incremental parse into current highlights.
+    void applyIncrementalParse(const HLParseResult &p_result);
+
+    // Whether block @p_blockNum starts a new top-level Markdown block.
+    bool isTopLevelBlockStart(int p_blockNum) const;
+
+    // Splice regions of @p_type from parsing result into @p_regions.
+    // Regions within [@p_start, @p_oldEnd) are replaced and regions after
+    // @p_oldEnd are shifted by @p_delta.
+    void spliceRegionsFromResult(QVector<VElementRegion> &p_regions,
+                                 const HLParseResult &p_result,
+                                 const pmh_element_type *p_types,
+                                 int p_nrTypes,
+                                 int p_start,
+                                 int p_oldEnd,
+                                 int p_delta);
+
+    // Rehighlight blocks in [@p_firstBlock, @p_lastBlock].
+    void rehighlightBlocks(int p_firstBlock, int p_lastBlock);
+
+    // Rehighlight the whole document. Visible blocks are rehighlighted
+    // immediately while others are rehighlighted in chunks later.
+    void rehighlightVisibleFirst();
+
+    // Continue to rehighlight the backlog with current highlights.
+    void resumeRehighlightBacklog();
+
+    // Fetch all the HTML block regions from parsing result.
+    void initHtmlBlockRegionsFromResult(const HLParseResult &p_result);
+
+    // Reset the tracking of changes since last parse.
+    void resetChangeTracking();
+
+    // Return the start positions of all the blocks, with the character count
+    // of the document appended.
+    const QVector<int> &getBlockStarts();
+
+    // Update fenced code blocks after a full parse.
+    // Code blocks within the first @p_firstDirtyBlock blocks and the last
+    // @p_unchangedSuffixBlocks blocks are reused from last parse. Only the
+    // range in between is scanned.
+    // @p_oldNrBlocks and @p_charDelta: block count of the document at last
+    // parse and the change of character count since then.
+    // Return true if there are code blocks to highlight and it will call
+    // rehighlight() later.
     // Return false if there is none.
-    bool updateCodeBlocks();
+    bool updateCodeBlocks(int p_firstDirtyBlock,
+                          int p_unchangedSuffixBlocks,
+                          int p_oldNrBlocks,
+                          int p_charDelta);
+
+    // Output the memory taken by the highlight units for debugging.
+    void dumpMemoryUsage() const;
+
+    // Get the index of the format merged from format @p_inner onto format
+    // @p_outer in m_codeBlockFormats.
+    int mergedCodeBlockFormat(int p_outer, int p_inner);
+
+    // Build the text of code block [@p_startBlock, @p_endBlock].
+    QString codeBlockText(const QTextBlock &p_startBlock, const QTextBlock &p_endBlock) const;
 
     // Fetch all the HTML comment regions from parsing result.
-    void initHtmlCommentRegionsFromResult();
+    void initHtmlCommentRegionsFromResult(const HLParseResult &p_result);
 
     // Fetch all the image link regions from parsing result.
-    void initImageRegionsFromResult();
+    void initImageRegionsFromResult(const HLParseResult &p_result);
 
     // Fetch all the header regions from parsing result.
-    void initHeaderRegionsFromResult();
+    void initHeaderRegionsFromResult(const HLParseResult &p_result);
+
+    // Compute the difference of @p_newRegions to @p_oldRegions of last parse.
+    // Regions overlapping the dirty range are considered changed.
+    VRegionsDelta diffRegions(const QVector<VElementRegion> &p_oldRegions,
+                              const QVector<VElementRegion> &p_newRegions,
+                              const DirtyRange &p_dirty) const;
+
+    // Signal image and header regions if changed.
+    void signalRegionsUpdated(const QVector<VElementRegion> &p_oldImageRegions,
+                              const QVector<VElementRegion> &p_oldHeaderRegions,
+                              const DirtyRange &p_dirty);
 
     // Whether @p_block is totally inside a HTML comment.
     bool isBlockInsideCommentRegion(const QTextBlock &p_block) const;
@@ -246,4 +709,9 @@ inline const QVector<VElementRegion> &HGMarkdownHighlighter::getHeaderRegions()
     return m_headerRegions;
 }
 
+inline void HGMarkdownHighlighter::setVisibleBlockRangeProvider(const VisibleBlockRangeProvider &p_provider)
+{
+    m_visibleBlockRangeProvider = p_provider;
+}
+
 #endif
@@ -11,9 +11,22 @@
 #include "utils/vutils.h"
 #include "vsingleinstanceguard.h"
 #include "vconfigmanager.h"
+#include "vcodeblockhighlightcache.h"
+#include "vimagecache.h"
+#include "vthumbnailcache.h"
+#include "vdownloader.h"
+#include "vconfigwritequeue.h"
 
 VConfigManager *g_config;
 
+VCodeBlockHighlightCache *g_codeBlockHighlightCache;
+
+VImageCache *g_imageCache;
+
+VThumbnailCache *g_thumbnailCache;
+
+VConfigWriteQueue *g_configWriteQueue;
+
 #if defined(QT_NO_DEBUG)
 QFile g_logFile;
 #endif
@@ -147,6 +160,25 @@ int main(int argc, char *argv[])
     vconfig.initialize();
     g_config = &vconfig;
 
+    // Flush pending writes of directory configs on quit.
+    VConfigWriteQueue configWriteQueue;
+    g_configWriteQueue = &configWriteQueue;
+
+    VCodeBlockHighlightCache hlCache(vconfig.getCodeBlockHighlightCacheFilePath(),
+                                     vconfig.getCodeBlockHighlightCacheSize());
+    g_codeBlockHighlightCache = &hlCache;
+
+    VThumbnailCache thumbnailCache(vconfig.getThumbnailCacheFolder(),
+                                   vconfig.getThumbnailCacheSize());
+    g_thumbnailCache = &thumbnailCache;
+
+    VImageCache imageCache(vconfig.getPreviewImageCacheSize());
+    g_imageCache = &imageCache;
+
+    VDownloader::configure(vconfig.getDownloadCacheFolder(),
+                           vconfig.getDownloadCacheSize(),
+                           vconfig.getMaxConcurrentDownloads());
+
     QString locale = VUtils::getLocale();
     // Set default locale.
     if (locale == "zh_CN") {
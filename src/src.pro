@@ -74,7 +74,16 @@ SOURCES += main.cpp\
     dialog/vorphanfileinfodialog.cpp \
     vtextblockdata.cpp \
     utils/vpreviewutils.cpp \
-    dialog/vconfirmdeletiondialog.cpp
+    dialog/vconfirmdeletiondialog.cpp \
+    vmarkdownparseworker.cpp \
+    utils/vcodetokenizer.cpp \
+    vcodeblockhighlightcache.cpp \
+    vimagedecoder.cpp \
+    vimagecache.cpp \
+    vthumbnailcache.cpp \
+    vnotebookindex.cpp \
+    vdirectorypreloader.cpp \
+    vconfigwritequeue.cpp
 
 HEADERS  += vmainwindow.h \
     vdirectorytree.h \
@@ -136,7 +145,17 @@ HEADERS  += vmainwindow.h \
     dialog/vorphanfileinfodialog.h \
     vtextblockdata.h \
     utils/vpreviewutils.h \
-    dialog/vconfirmdeletiondialog.h
+    dialog/vconfirmdeletiondialog.h \
+    vmarkdownparseworker.h \
+    utils/vcodetokenizer.h \
+    vcodeblockhighlightcache.h \
+    vimagedecoder.h \
+    vimagecache.h \
+    vthumbnailcache.h \
+    vnotebookindex.h \
+    vdirectorypreloader.h \
+    vconfigwritequeue.h \
+    vnameindex.h
 
 RESOURCES += \
     vnote.qrc \
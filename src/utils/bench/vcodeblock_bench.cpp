@@ -0,0 +1,239 @@
+// Micro-benchmark of the native code block highlight engine VCodeTokenizer.
+//
+// It is not part of the build. Build and run it from this folder with:
+//
+//   qmake vcodeblock_bench.pro && make
+//   ./vcodeblock_bench [number of blocks] [runs] [corpus file]
+//
+// A corpus of fenced code blocks in the languages supported by VCodeTokenizer
+// is generated and written to the corpus file (corpus.md by default). Each
+// block is highlighted @runs times and the average time per block of each
+// language is printed.
+//
+// vcodeblock_bench.js is the highlight.js counterpart. It renders each block
+// of the same corpus file like highlightText() of markdown-it.js, which is
+// what VDocument::highlightTextAsync() runs in the web view:
+//
+//   node vcodeblock_bench.js [corpus file] [runs]
+//
+// Neither includes the web channel round trip nor the parsing of the returned
+// HTML. The "web code block highlight round" log of VCodeBlockHighlightHelper
+// gives the time of a whole round in VNote.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+#include <stdio.h>
+#include "vcodetokenizer.h"
+
+struct CodeSample
+{
+    const char *m_lang;
+
+    // %1 is replaced by the index of the block.
+    const char *m_code;
+};
+
+static const CodeSample c_samples[] = {
+    { "cpp",
+      "#include <vector>\n"
+      "// Sum the values of item %1.\n"
+      "static int sum%1(const std::vector<int> &p_values)\n"
+      "{\n"
+      "    int total = 0;\n"
+      "    for (size_t i = 0; i < p_values.size(); ++i) {\n"
+      "        total += p_values[i] * 0x%1;\n"
+      "    }\n"
+      "    /* Done. */\n"
+      "    return total > 0 ? total : -1;\n"
+      "}\n" },
+    { "python",
+      "class Item%1(object):\n"
+      "    \"\"\"Item number %1.\n"
+      "    Spans multiple lines.\"\"\"\n"
+      "    def value(self, factor=1.5):\n"
+      "        # Compute the value.\n"
+      "        return sum(x * factor for x in range(%1) if x is not None)\n" },
+    { "js",
+      "// Fetch item %1.\n"
+      "function fetchItem%1(id) {\n"
+      "    var url = 'http://example.com/items/' + id;\n"
+      "    return fetch(url).then(function (res) {\n"
+      "        return res.ok ? res.json() : null;\n"
+      "    });\n"
+      "}\n" },
+    { "go",
+      "package main\n"
+      "\n"
+      "// Item%1 is an item.\n"
+      "func Item%1(n int) (string, error) {\n"
+      "    if n < %1 {\n"
+      "        return \"\", nil\n"
+      "    }\n"
+      "    return fmt.Sprintf(\"item %d\", n), nil\n"
+      "}\n" },
+    { "sh",
+      "#!/bin/bash\n"
+      "# Build item %1.\n"
+      "for f in ${SRC_DIR}/*.c; do\n"
+      "    if [ -f \"$f\" ]; then\n"
+      "        gcc -O2 -c \"$f\" -o \"${f%.c}.o\" || exit %1\n"
+      "    fi\n"
+      "done\n" },
+    { "json",
+      "{\n"
+      "    \"id\": %1,\n"
+      "    \"name\": \"item %1\",\n"
+      "    \"enabled\": true,\n"
+      "    \"tags\": [\"a\", \"b\", null],\n"
+      "    \"ratio\": 0.75\n"
+      "}\n" },
+    { "sql",
+      "-- Items of group %1.\n"
+      "SELECT id, name, COUNT(*) AS total\n"
+      "FROM items\n"
+      "WHERE group_id = %1 AND name LIKE 'item%'\n"
+      "GROUP BY id, name\n"
+      "ORDER BY total DESC;\n" },
+    { "java",
+      "/** Item %1. */\n"
+      "public class Item%1 implements Comparable<Item%1> {\n"
+      "    private final String name = \"item %1\";\n"
+      "\n"
+      "    @Override\n"
+      "    public int compareTo(Item%1 other) {\n"
+      "        return name.compareTo(other.name);\n"
+      "    }\n"
+      "}\n" },
+    { "rust",
+      "// Item %1.\n"
+      "fn item_%1(values: &Vec<i32>) -> Option<i32> {\n"
+      "    let mut total: i32 = 0;\n"
+      "    for v in values.iter() {\n"
+      "        total += *v;\n"
+      "    }\n"
+      "    if total > %1 { Some(total) } else { None }\n"
+      "}\n" },
+    { "cs",
+      "// Item %1.\n"
+      "public class Item%1\n"
+      "{\n"
+      "    public string Name { get; set; } = \"item %1\";\n"
+      "\n"
+      "    public override string ToString()\n"
+      "    {\n"
+      "        return $\"{Name}: {Name.Length}\";\n"
+      "    }\n"
+      "}\n" },
+};
+
+struct CodeBlock
+{
+    QString m_lang;
+
+    // Including the fence lines, like VCodeBlock::m_text.
+    QString m_text;
+};
+
+// Generate @p_nrBlocks blocks of 1 to 4 copies of the samples.
+static QVector<CodeBlock> generateCorpus(int p_nrBlocks)
+{
+    int nrSamples = sizeof(c_samples) / sizeof(c_samples[0]);
+    QVector<CodeBlock> blocks;
+    for (int i = 0; i < p_nrBlocks; ++i) {
+        const CodeSample &sample = c_samples[i % nrSamples];
+        CodeBlock block;
+        block.m_lang = sample.m_lang;
+        block.m_text = QString("```%1\n").arg(block.m_lang);
+        int copies = (i / nrSamples) % 4 + 1;
+        for (int j = 0; j < copies; ++j) {
+            block.m_text += QString(sample.m_code).arg(i * 4 + j);
+        }
+
+        block.m_text += "```";
+        blocks.append(block);
+    }
+
+    return blocks;
+}
+
+static bool writeCorpus(const QVector<CodeBlock> &p_blocks, const QString &p_path)
+{
+    QFile file(p_path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    for (int i = 0; i < p_blocks.size(); ++i) {
+        out << p_blocks[i].m_text << "\n\n";
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    int nrBlocks = args.size() > 1 ? args[1].toInt() : 200;
+    int runs = args.size() > 2 ? args[2].toInt() : 20;
+    QString corpusPath = args.size() > 3 ? args[3] : QString("corpus.md");
+
+    QVector<CodeBlock> blocks = generateCorpus(nrBlocks);
+    if (!writeCorpus(blocks, corpusPath)) {
+        fprintf(stderr, "fail to write corpus %s\n", qPrintable(corpusPath));
+        return 1;
+    }
+
+    // Build the language registry before timing.
+    VCodeTokenizer::isLanguageSupported("cpp");
+
+    // Total time in ns and number of blocks of each language.
+    QMap<QString, qint64> times;
+    QMap<QString, int> counts;
+    qint64 maxTime = 0;
+    int nrUnits = 0;
+    QElapsedTimer t;
+    for (int i = 0; i < blocks.size(); ++i) {
+        const CodeBlock &block = blocks[i];
+        qint64 blockTime = 0;
+        for (int j = 0; j < runs; ++j) {
+            QVector<HLUnitPos> units;
+            t.start();
+            bool ret = VCodeTokenizer::highlightCodeBlock(block.m_lang, block.m_text, units);
+            blockTime += t.nsecsElapsed();
+            if (!ret) {
+                fprintf(stderr, "language %s is not supported\n", qPrintable(block.m_lang));
+                return 1;
+            }
+
+            if (j == 0) {
+                nrUnits += units.size();
+            }
+        }
+
+        blockTime /= runs;
+        times[block.m_lang] += blockTime;
+        counts[block.m_lang] += 1;
+        maxTime = qMax(maxTime, blockTime);
+    }
+
+    printf("corpus %s: %d blocks, %d units\n", qPrintable(corpusPath), blocks.size(), nrUnits);
+
+    qint64 total = 0;
+    for (auto it = times.begin(); it != times.end(); ++it) {
+        total += it.value();
+        printf("%-8s %4d blocks, %8.1f us per block\n", qPrintable(it.key()),
+               counts[it.key()], it.value() / 1000.0 / counts[it.key()]);
+    }
+
+    printf("native:  %.1f us per block, max %.1f us, %.2f ms in total\n",
+           total / 1000.0 / blocks.size(), maxTime / 1000.0, total / 1000000.0);
+    return 0;
+}
@@ -0,0 +1,106 @@
+// highlight.js counterpart of vcodeblock_bench.cpp.
+//
+// Render each fenced code block of the corpus written by vcodeblock_bench
+// with markdown-it and highlight.js like highlightText() of markdown-it.js,
+// and print the average time per block of each language:
+//
+//   node vcodeblock_bench.js [corpus file] [runs]
+
+var fs = require('fs');
+var path = require('path');
+var vm = require('vm');
+
+var utilsDir = path.join(__dirname, '..');
+
+// highlight.pack.js registers its languages to the global hljs of a browser.
+var loadHighlightJs = function(file) {
+    var sandbox = {};
+    sandbox.window = sandbox;
+    vm.runInNewContext(fs.readFileSync(file, 'utf8'), sandbox, { filename: file });
+    return sandbox.hljs;
+};
+
+var hljs = loadHighlightJs(path.join(utilsDir, 'highlightjs', 'highlight.pack.js'));
+var markdownit = require(path.join(utilsDir, 'markdown-it', 'markdown-it.min.js'));
+
+var corpusPath = process.argv[2] || 'corpus.md';
+var runs = parseInt(process.argv[3] || '20', 10);
+
+// Options of markdown-it.js with the default configuration.
+var mdit = markdownit({
+    html: true,
+    breaks: false,
+    linkify: true,
+    typographer: true,
+    langPrefix: 'lang-',
+    highlight: function(str, lang) {
+        if (lang && hljs.getLanguage(lang)) {
+            return hljs.highlight(lang, str).value;
+        } else {
+            return hljs.highlightAuto(str).value;
+        }
+    }
+});
+
+// Split the corpus into fenced code blocks, including the fence lines.
+var readBlocks = function(text) {
+    var blocks = [];
+    var re = /^```(\S*)\n[\s\S]*?^```$/gm;
+    var match;
+    while ((match = re.exec(text)) !== null) {
+        blocks.push({ lang: match[1], text: match[0] });
+    }
+
+    return blocks;
+};
+
+var nowUs = function() {
+    var t = process.hrtime();
+    return t[0] * 1e6 + t[1] / 1e3;
+};
+
+var blocks = readBlocks(fs.readFileSync(corpusPath, 'utf8'));
+if (blocks.length === 0) {
+    console.error('no code block in ' + corpusPath);
+    process.exit(1);
+}
+
+// Warm up the JIT like a web view having rendered the note.
+for (var i = 0; i < blocks.length; ++i) {
+    mdit.render(blocks[i].text);
+}
+
+var times = {};
+var counts = {};
+var total = 0;
+var maxTime = 0;
+for (var i = 0; i < blocks.length; ++i) {
+    var block = blocks[i];
+    var start = nowUs();
+    for (var j = 0; j < runs; ++j) {
+        mdit.render(block.text);
+    }
+
+    var blockTime = (nowUs() - start) / runs;
+    times[block.lang] = (times[block.lang] || 0) + blockTime;
+    counts[block.lang] = (counts[block.lang] || 0) + 1;
+    total += blockTime;
+    maxTime = Math.max(maxTime, blockTime);
+}
+
+console.log('corpus ' + corpusPath + ': ' + blocks.length + ' blocks');
+var pad = function(str, width) {
+    while (str.length < width) {
+        str = ' ' + str;
+    }
+
+    return str;
+};
+
+Object.keys(times).sort().forEach(function(lang) {
+    console.log((lang + '        ').substr(0, 8) + ' ' + pad('' + counts[lang], 4) + ' blocks, '
+                + pad((times[lang] / counts[lang]).toFixed(1), 8) + ' us per block');
+});
+
+console.log('highlight.js: ' + (total / blocks.length).toFixed(1) + ' us per block, max '
+            + maxTime.toFixed(1) + ' us, ' + (total / 1000).toFixed(2) + ' ms in total');
@@ -0,0 +1,17 @@
+# Micro-benchmark of VCodeTokenizer. It is not part of VNote.pro.
+# See vcodeblock_bench.cpp for how to run it.
+
+QT       += core gui
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+TARGET = vcodeblock_bench
+TEMPLATE = app
+
+INCLUDEPATH += .. ../.. ../../../peg-highlight
+
+SOURCES += vcodeblock_bench.cpp \
+    ../vcodetokenizer.cpp
+
+HEADERS += ../vcodetokenizer.h
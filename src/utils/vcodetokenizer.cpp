@@ -0,0 +1,495 @@
+#include "vcodetokenizer.h"
+
+static const QString c_keywordStyle = "hljs-keyword";
+static const QString c_typeStyle = "hljs-type";
+static const QString c_literalStyle = "hljs-literal";
+static const QString c_builtInStyle = "hljs-built_in";
+static const QString c_titleStyle = "hljs-title";
+static const QString c_commentStyle = "hljs-comment";
+static const QString c_stringStyle = "hljs-string";
+static const QString c_numberStyle = "hljs-number";
+static const QString c_metaStyle = "hljs-meta";
+static const QString c_variableStyle = "hljs-variable";
+
+// Split a space separated word list into a set.
+static QSet<QString> wordSet(const char *p_words)
+{
+    return QString(p_words).split(' ', QString::SkipEmptyParts).toSet();
+}
+
+static QSharedPointer<VCodeLanguage> newCLikeLanguage()
+{
+    QSharedPointer<VCodeLanguage> lang(new VCodeLanguage());
+    lang->m_lineComments << "//";
+    lang->m_blockComments.append(qMakePair(QString("/*"), QString("*/")));
+    lang->m_stringDelimiters = "\"'";
+    return lang;
+}
+
+void VCodeTokenizer::registerBuiltInLanguages(QHash<QString, QSharedPointer<VCodeLanguage>> &p_registry)
+{
+    QVector<QSharedPointer<VCodeLanguage>> langs;
+
+    // C and C++.
+    {
+    QSharedPointer<VCodeLanguage> lang = newCLikeLanguage();
+    lang->m_names << "c" << "cpp" << "c++" << "cc" << "h" << "hpp" << "cxx";
+    lang->m_keywords = wordSet("if else for while do switch case default break continue return "
+                               "goto sizeof typedef struct union enum class namespace template "
+                               "typename public private protected virtual override final "
+                               "static extern const constexpr volatile mutable inline explicit "
+                               "friend operator new delete this throw try catch using "
+                               "static_cast dynamic_cast const_cast reinterpret_cast "
+                               "noexcept decltype auto register alignas alignof");
+    lang->m_types = wordSet("int long short char float double void bool signed unsigned "
+                            "wchar_t size_t int8_t int16_t int32_t int64_t uint8_t uint16_t "
+                            "uint32_t uint64_t char16_t char32_t");
+    lang->m_literals = wordSet("true false nullptr NULL");
+    lang->m_builtIns = wordSet("std string vector map set unique_ptr shared_ptr printf "
+                               "malloc free memcpy memset strlen cout cin endl");
+    lang->m_titleKeywords = wordSet("class struct namespace enum union");
+    lang->m_metaPrefix = '#';
+    langs.append(lang);
+    }
+
+    // C#.
+    {
+    QSharedPointer<VCodeLanguage> lang = newCLikeLanguage();
+    lang->m_names << "cs" << "csharp" << "c#";
+    lang->m_keywords = wordSet("abstract as base break case catch checked class const continue "
+                               "default delegate do else enum event explicit extern finally "
+                               "fixed for foreach goto if implicit in interface internal is "
+                               "lock namespace new operator out override params private "
+                               "protected public readonly ref return sealed sizeof stackalloc "
+                               "static struct switch this throw try typeof unchecked unsafe "
+                               "using virtual volatile while async await var get set");
+    lang->m_types = wordSet("bool byte char decimal double float int long object sbyte short "
+                            "string uint ulong ushort void dynamic");
+    lang->m_literals = wordSet("true false null");
+    lang->m_titleKeywords = wordSet("class struct interface enum namespace");
+    lang->m_metaPrefix = '#';
+    langs.append(lang);
+    }
+
+    // Java.
+    {
+    QSharedPointer<VCodeLanguage> lang = newCLikeLanguage();
+    lang->m_names << "java";
+    lang->m_keywords = wordSet("abstract assert break case catch class const continue default "
+                               "do else enum extends final finally for goto if implements "
+                               "import instanceof interface native new package private "
+                               "protected public return static strictfp super switch "
+                               "synchronized this throw throws transient try volatile while");
+    lang->m_types = wordSet("boolean byte char double float int long short void");
+    lang->m_literals = wordSet("true false null");
+    lang->m_builtIns = wordSet("String Object System Integer Long Double Boolean List Map");
+    lang->m_titleKeywords = wordSet("class interface enum");
+    langs.append(lang);
+    }
+
+    // JavaScript and TypeScript.
+    {
+    QSharedPointer<VCodeLanguage> lang = newCLikeLanguage();
+    lang->m_names << "js" << "javascript" << "jsx" << "ts" << "typescript" << "tsx";
+    lang->m_keywords = wordSet("break case catch class const continue debugger default delete "
+                               "do else export extends finally for function if import in "
+                               "instanceof let new return super switch this throw try typeof "
+                               "var void while with yield async await of static get set from "
+                               "interface type implements enum declare namespace");
+    lang->m_types = wordSet("string number boolean any never unknown object symbol");
+    lang->m_literals = wordSet("true false null undefined NaN Infinity");
+    lang->m_builtIns = wordSet("console window document Math JSON Object Array String Number "
+                               "Promise Date RegExp Error Map Set require module exports");
+    lang->m_titleKeywords = wordSet("function class interface");
+    lang->m_stringDelimiters = "\"'`";
+    langs.append(lang);
+    }
+
+    // Python.
+    {
+    QSharedPointer<VCodeLanguage> lang(new VCodeLanguage());
+    lang->m_names << "py" << "python" << "python3" << "gyp";
+    lang->m_keywords = wordSet("and as assert async await break class continue def del elif "
+                               "else except exec finally for from global if import in is "
+                               "lambda nonlocal not or pass print raise return try while "
+                               "with yield");
+    lang->m_literals = wordSet("True False None Ellipsis NotImplemented");
+    lang->m_builtIns = wordSet("abs all any bin bool bytes callable chr dict dir divmod "
+                               "enumerate filter float format getattr hasattr hash hex id "
+                               "input int isinstance issubclass iter len list map max min "
+                               "next object open ord pow range repr reversed round set "
+                               "setattr slice sorted str sum super tuple type zip self");
+    lang->m_titleKeywords = wordSet("def class");
+    lang->m_lineComments << "#";
+    lang->m_multiLineStrings << "\"\"\"" << "'''";
+    lang->m_stringDelimiters = "\"'";
+    langs.append(lang);
+    }
+
+    // Shell.
+    {
+    QSharedPointer<VCodeLanguage> lang(new VCodeLanguage());
+    lang->m_names << "sh" << "bash" << "shell" << "zsh";
+    lang->m_keywords = wordSet("if then else elif fi for while in do done case esac function "
+                               "until select return local export readonly declare unset "
+                               "shift break continue");
+    lang->m_literals = wordSet("true false");
+    lang->m_builtIns = wordSet("echo cd pwd source exit set eval exec test read printf alias "
+                               "cat ls grep sed awk mkdir rm cp mv chmod sudo");
+    lang->m_titleKeywords = wordSet("function");
+    lang->m_lineComments << "#";
+    lang->m_stringDelimiters = "\"'";
+    lang->m_dollarVariables = true;
+    langs.append(lang);
+    }
+
+    // Go.
+    {
+    QSharedPointer<VCodeLanguage> lang = newCLikeLanguage();
+    lang->m_names << "go" << "golang";
+    lang->m_keywords = wordSet("break case chan const continue default defer else fallthrough "
+                               "for func go goto if import interface map package range return "
+                               "select struct switch type var");
+    lang->m_types = wordSet("bool byte complex64 complex128 error float32 float64 int int8 "
+                            "int16 int32 int64 rune string uint uint8 uint16 uint32 uint64 "
+                            "uintptr");
+    lang->m_literals = wordSet("true false nil iota");
+    lang->m_builtIns = wordSet("append cap close complex copy delete imag len make new panic "
+                               "print println real recover");
+    lang->m_titleKeywords = wordSet("func type");
+    lang->m_stringDelimiters = "\"'`";
+    langs.append(lang);
+    }
+
+    // Rust.
+    {
+    QSharedPointer<VCodeLanguage> lang = newCLikeLanguage();
+    lang->m_names << "rs" << "rust";
+    lang->m_keywords = wordSet("as break const continue crate else enum extern fn for if impl "
+                               "in let loop match mod move mut pub ref return self Self "
+                               "static struct super trait type unsafe use where while async "
+                               "await dyn");
+    lang->m_types = wordSet("i8 i16 i32 i64 i128 isize u8 u16 u32 u64 u128 usize f32 f64 "
+                            "bool char str String Vec Option Result Box");
+    lang->m_literals = wordSet("true false None Some Ok Err");
+    lang->m_builtIns = wordSet("println print format vec panic assert assert_eq");
+    lang->m_titleKeywords = wordSet("fn struct enum trait mod impl");
+    lang->m_stringDelimiters = "\"";
+    langs.append(lang);
+    }
+
+    // JSON.
+    {
+    QSharedPointer<VCodeLanguage> lang(new VCodeLanguage());
+    lang->m_names << "json";
+    lang->m_literals = wordSet("true false null");
+    lang->m_stringDelimiters = "\"";
+    langs.append(lang);
+    }
+
+    // SQL.
+    {
+    QSharedPointer<VCodeLanguage> lang(new VCodeLanguage());
+    lang->m_names << "sql";
+    lang->m_keywords = wordSet("select from where and or not insert into values update set "
+                               "delete create table drop alter add index view join inner "
+                               "left right outer full on as group by order having limit "
+                               "offset union all distinct in is like between exists case "
+                               "when then else end primary key foreign references default "
+                               "unique constraint begin commit rollback asc desc");
+    lang->m_types = wordSet("int integer bigint smallint decimal numeric float real double "
+                            "char varchar text date time timestamp boolean blob");
+    lang->m_literals = wordSet("null true false");
+    lang->m_builtIns = wordSet("count sum avg min max coalesce now upper lower");
+    lang->m_lineComments << "--";
+    lang->m_blockComments.append(qMakePair(QString("/*"), QString("*/")));
+    lang->m_stringDelimiters = "'\"";
+    lang->m_caseInsensitive = true;
+    langs.append(lang);
+    }
+
+    for (auto const &lang : langs) {
+        for (auto const &name : lang->m_names) {
+            p_registry.insert(name, lang);
+        }
+    }
+}
+
+QHash<QString, QSharedPointer<VCodeLanguage>> &VCodeTokenizer::registry()
+{
+    static QHash<QString, QSharedPointer<VCodeLanguage>> langs;
+    if (langs.isEmpty()) {
+        registerBuiltInLanguages(langs);
+    }
+
+    return langs;
+}
+
+void VCodeTokenizer::registerLanguage(const QSharedPointer<VCodeLanguage> &p_lang)
+{
+    QHash<QString, QSharedPointer<VCodeLanguage>> &langs = registry();
+    for (auto const &name : p_lang->m_names) {
+        langs.insert(name.toLower(), p_lang);
+    }
+}
+
+const VCodeLanguage *VCodeTokenizer::findLanguage(const QString &p_lang)
+{
+    if (p_lang.isEmpty()) {
+        return NULL;
+    }
+
+    const QHash<QString, QSharedPointer<VCodeLanguage>> &langs = registry();
+    auto it = langs.find(p_lang.toLower());
+    if (it == langs.end()) {
+        return NULL;
+    }
+
+    return it.value().data();
+}
+
+bool VCodeTokenizer::isLanguageSupported(const QString &p_lang)
+{
+    return findLanguage(p_lang) != NULL;
+}
+
+bool VCodeTokenizer::highlightCodeBlock(const QString &p_lang,
+                                        const QString &p_text,
+                                        QVector<HLUnitPos> &p_units)
+{
+    const VCodeLanguage *lang = findLanguage(p_lang);
+    if (!lang) {
+        return false;
+    }
+
+    // Skip the fence lines.
+    int start = p_text.indexOf('\n');
+    if (start == -1) {
+        return true;
+    }
+    ++start;
+
+    int end = p_text.size();
+    int lastLine = p_text.lastIndexOf('\n');
+    if (lastLine >= start
+        && p_text.midRef(lastLine + 1).trimmed().startsWith("```")) {
+        end = lastLine;
+    }
+
+    tokenize(*lang, p_text, start, end, p_units);
+    return true;
+}
+
+// Whether @p_token occurs at @p_pos of @p_text within @p_end.
+static inline bool matchAt(const QString &p_text, int p_pos, int p_end,
+                           const QString &p_token)
+{
+    return p_pos + p_token.size() <= p_end
+           && p_text.midRef(p_pos, p_token.size()) == p_token;
+}
+
+static inline bool isIdentifierChar(QChar p_ch)
+{
+    return p_ch.isLetterOrNumber() || p_ch == '_';
+}
+
+// Return the end of the line containing @p_pos, not including '\n'.
+static inline int lineEnd(const QString &p_text, int p_pos, int p_end)
+{
+    int idx = p_text.indexOf('\n', p_pos);
+    return (idx == -1 || idx > p_end) ? p_end : idx;
+}
+
+void VCodeTokenizer::tokenize(const VCodeLanguage &p_lang,
+                              const QString &p_text,
+                              int p_start,
+                              int p_end,
+                              QVector<HLUnitPos> &p_units)
+{
+    // Whether there are only spaces between the line start and @i.
+    bool atLineStart = true;
+    // Whether the next identifier is a title.
+    bool expectTitle = false;
+    int i = p_start;
+
+    while (i < p_end) {
+        QChar ch = p_text[i];
+        if (ch == '\n') {
+            atLineStart = true;
+            ++i;
+            continue;
+        } else if (ch.isSpace()) {
+            ++i;
+            continue;
+        }
+
+        bool lineStart = atLineStart;
+        atLineStart = false;
+
+        // Preprocessor line, with '\' continuation.
+        if (lineStart && !p_lang.m_metaPrefix.isNull() && ch == p_lang.m_metaPrefix) {
+            int j = lineEnd(p_text, i, p_end);
+            while (j < p_end && j > i && p_text[j - 1] == '\\') {
+                j = lineEnd(p_text, j + 1, p_end);
+            }
+
+            p_units.append(HLUnitPos(i, j - i, c_metaStyle));
+            i = j;
+            continue;
+        }
+
+        // Comments.
+        int tokenEnd = -1;
+        for (auto const &pair : p_lang.m_blockComments) {
+            if (matchAt(p_text, i, p_end, pair.first)) {
+                int idx = p_text.indexOf(pair.second, i + pair.first.size());
+                tokenEnd = (idx == -1 || idx + pair.second.size() > p_end)
+                           ? p_end : idx + pair.second.size();
+                break;
+            }
+        }
+
+        if (tokenEnd == -1) {
+            for (auto const &marker : p_lang.m_lineComments) {
+                if (matchAt(p_text, i, p_end, marker)) {
+                    tokenEnd = lineEnd(p_text, i, p_end);
+                    break;
+                }
+            }
+        }
+
+        if (tokenEnd != -1) {
+            p_units.append(HLUnitPos(i, tokenEnd - i, c_commentStyle));
+            i = tokenEnd;
+            continue;
+        }
+
+        // Strings.
+        for (auto const &delim : p_lang.m_multiLineStrings) {
+            if (matchAt(p_text, i, p_end, delim)) {
+                int idx = p_text.indexOf(delim, i + delim.size());
+                tokenEnd = (idx == -1 || idx + delim.size() > p_end)
+                           ? p_end : idx + delim.size();
+                break;
+            }
+        }
+
+        if (tokenEnd == -1 && p_lang.m_stringDelimiters.contains(ch)) {
+            // Only backquoted strings could span multiple lines.
+            int j = i + 1;
+            while (j < p_end) {
+                QChar c = p_text[j];
+                if (c == '\\') {
+                    j += 2;
+                } else if (c == ch) {
+                    ++j;
+                    break;
+                } else if (c == '\n' && ch != '`') {
+                    break;
+                } else {
+                    ++j;
+                }
+            }
+
+            tokenEnd = qMin(j, p_end);
+        }
+
+        if (tokenEnd != -1) {
+            p_units.append(HLUnitPos(i, tokenEnd - i, c_stringStyle));
+            i = tokenEnd;
+            expectTitle = false;
+            continue;
+        }
+
+        // Shell variables.
+        if (p_lang.m_dollarVariables && ch == '$' && i + 1 < p_end) {
+            int j = i + 1;
+            if (p_text[j] == '{') {
+                int idx = p_text.indexOf('}', j);
+                j = (idx == -1 || idx >= p_end) ? lineEnd(p_text, j, p_end) : idx + 1;
+            } else {
+                while (j < p_end && isIdentifierChar(p_text[j])) {
+                    ++j;
+                }
+
+                // Special parameters like $? $# $@.
+                if (j == i + 1 && QString("?#@*!$-0").contains(p_text[j])) {
+                    ++j;
+                }
+            }
+
+            if (j > i + 1) {
+                p_units.append(HLUnitPos(i, j - i, c_variableStyle));
+                i = j;
+                continue;
+            }
+        }
+
+        // Numbers.
+        if (ch.isDigit()
+            || (ch == '.' && i + 1 < p_end && p_text[i + 1].isDigit())) {
+            int j = i + 1;
+            if (ch == '0' && j < p_end && (p_text[j] == 'x' || p_text[j] == 'X')) {
+                ++j;
+            }
+
+            while (j < p_end) {
+                QChar c = p_text[j];
+                if (isIdentifierChar(c) || c == '.') {
+                    ++j;
+                } else if ((c == '+' || c == '-')
+                           && (p_text[j - 1] == 'e' || p_text[j - 1] == 'E')) {
+                    ++j;
+                } else {
+                    break;
+                }
+            }
+
+            p_units.append(HLUnitPos(i, j - i, c_numberStyle));
+            i = j;
+            expectTitle = false;
+            continue;
+        }
+
+        // Identifiers and keywords.
+        if (ch.isLetter() || ch == '_') {
+            int j = i + 1;
+            while (j < p_end && isIdentifierChar(p_text[j])) {
+                ++j;
+            }
+
+            QString word = p_text.mid(i, j - i);
+            if (p_lang.m_caseInsensitive) {
+                word = word.toLower();
+            }
+
+            const QString *style = NULL;
+            bool title = false;
+            if (expectTitle) {
+                style = &c_titleStyle;
+                expectTitle = false;
+            } else if (p_lang.m_keywords.contains(word)) {
+                style = &c_keywordStyle;
+                title = p_lang.m_titleKeywords.contains(word);
+            } else if (p_lang.m_types.contains(word)) {
+                style = &c_typeStyle;
+            } else if (p_lang.m_literals.contains(word)) {
+                style = &c_literalStyle;
+            } else if (p_lang.m_builtIns.contains(word)) {
+                style = &c_builtInStyle;
+            }
+
+            if (style) {
+                p_units.append(HLUnitPos(i, j - i, *style));
+            }
+
+            expectTitle = title;
+            i = j;
+            continue;
+        }
+
+        // Punctuation.
+        expectTitle = false;
+        ++i;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef VCODETOKENIZER_H
+#define VCODETOKENIZER_H
+
+#include <QString>
+#include <QStringList>
+#include <QSet>
+#include <QHash>
+#include <QVector>
+#include <QPair>
+#include <QSharedPointer>
+#include "hgmarkdownhighlighter.h"
+
+// Table describing how to tokenize one language.
+// Token styles use the highlight.js class names so that the code block styles
+// in the mdhl theme apply to both engines.
+struct VCodeLanguage
+{
+    VCodeLanguage()
+        : m_metaPrefix(), m_dollarVariables(false), m_caseInsensitive(false)
+    {
+    }
+
+    // Name and aliases used in the fence, in lower case.
+    QStringList m_names;
+
+    QSet<QString> m_keywords;
+    QSet<QString> m_types;
+    QSet<QString> m_literals;
+    QSet<QString> m_builtIns;
+
+    // The identifier following one of these keywords is a title.
+    QSet<QString> m_titleKeywords;
+
+    QStringList m_lineComments;
+    QVector<QPair<QString, QString>> m_blockComments;
+
+    // Delimiters of strings which could span multiple lines, like """.
+    QStringList m_multiLineStrings;
+
+    // Characters starting a single line string.
+    QString m_stringDelimiters;
+
+    // A line starting with this character is a preprocessor line.
+    QChar m_metaPrefix;
+
+    // $var and ${var} are variables.
+    bool m_dollarVariables;
+
+    // Keywords are matched case-insensitively and stored in lower case.
+    bool m_caseInsensitive;
+};
+
+// In-process code block highlighter driven by VCodeLanguage tables.
+class VCodeTokenizer
+{
+public:
+    // Register @p_lang under all its names. Replace existing languages
+    // with the same names.
+    static void registerLanguage(const QSharedPointer<VCodeLanguage> &p_lang);
+
+    static bool isLanguageSupported(const QString &p_lang);
+
+    // Highlight the fenced code block @p_text in language @p_lang.
+    // The fence lines are skipped. Positions of @p_units are relative to
+    // @p_text.
+    // Returns false if @p_lang is not supported.
+    static bool highlightCodeBlock(const QString &p_lang,
+                                   const QString &p_text,
+                                   QVector<HLUnitPos> &p_units);
+
+    // Tokenize [@p_start, @p_end) of @p_text.
+    static void tokenize(const VCodeLanguage &p_lang,
+                         const QString &p_text,
+                         int p_start,
+                         int p_end,
+                         QVector<HLUnitPos> &p_units);
+
+private:
+    VCodeTokenizer() {}
+
+    static QHash<QString, QSharedPointer<VCodeLanguage>> &registry();
+
+    static void registerBuiltInLanguages(QHash<QString, QSharedPointer<VCodeLanguage>> &p_registry);
+
+    static const VCodeLanguage *findLanguage(const QString &p_lang);
+};
+
+#endif // VCODETOKENIZER_H
@@ -826,20 +826,16 @@ QVector<VElementRegion> VUtils::fetchImageRegionsUsingParser(const QString &p_co
     QVector<VElementRegion> regs;
 
     QByteArray ba = p_content.toUtf8();
-    const char *data = (const char *)ba.data();
-    int len = ba.size();
 
     pmh_element **result = NULL;
-    char *content = new char[len + 1];
-    memcpy(content, data, len);
-    content[len] = '\0';
-
-    pmh_markdown_to_elements(content, pmh_EXT_NONE, &result);
+    pmh_markdown_to_elements(ba.data(), pmh_EXT_NONE, &result);
 
     if (!result) {
         return regs;
     }
 
+    // Offsets of the parser are in code points.
+    HLOffsetTable table(p_content);
     pmh_element *elem = result[pmh_IMAGE];
     while (elem != NULL) {
         if (elem->end <= elem->pos) {
@@ -847,7 +843,8 @@ QVector<VElementRegion> VUtils::fetchImageRegionsUsingParser(const QString &p_co
             continue;
         }
 
-        regs.push_back(VElementRegion(elem->pos, elem->end));
+        regs.push_back(VElementRegion(table.toStringOffset(elem->pos),
+                                      table.toStringOffset(elem->end)));
 
         elem = elem->next;
     }
@@ -0,0 +1,215 @@
+#include "vcodeblockhighlightcache.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QCryptographicHash>
+
+// Magic and version of the cache file.
+static const quint32 c_cacheFileMagic = 0x56434248;
+static const quint32 c_cacheFileVersion = 2;
+
+// Version of the highlight units. Increase it when the units produced by the
+// engines change, such as the tables of VCodeTokenizer.
+static const int c_unitsVersion = 1;
+
+VCodeBlockHighlightCache::VCodeBlockHighlightCache(const QString &p_filePath, int p_maxUnits)
+    : m_filePath(p_filePath), m_cache(p_maxUnits), m_dirty(false)
+{
+    load();
+}
+
+VCodeBlockHighlightCache::~VCodeBlockHighlightCache()
+{
+    qDebug() << "code block highlight cache: entries" << m_cache.size()
+             << "hits" << m_stats.m_hits << "misses" << m_stats.m_misses
+             << "evictions" << m_stats.m_evictions;
+
+    if (m_dirty) {
+        save();
+    }
+}
+
+QByteArray VCodeBlockHighlightCache::key(CodeBlockHighlightEngine p_engine,
+                                         const QString &p_lang,
+                                         const QString &p_unindentedText)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(p_unindentedText.constData()),
+                 p_unindentedText.size() * sizeof(QChar));
+
+    QByteArray res = QByteArray::number(c_unitsVersion);
+    res.append(':');
+    res.append(QByteArray::number((int)p_engine));
+    res.append(':');
+    res.append(p_lang.toLower().toUtf8());
+    res.append(':');
+    res.append(hash.result());
+    return res;
+}
+
+int VCodeBlockHighlightCache::internStyle(const QString &p_style)
+{
+    auto it = m_styleIds.find(p_style);
+    if (it != m_styleIds.end()) {
+        return it.value();
+    }
+
+    int id = m_styles.size();
+    m_styles.append(p_style);
+    m_styleIds.insert(p_style, id);
+    return id;
+}
+
+bool VCodeBlockHighlightCache::get(const QByteArray &p_key, QVector<HLUnitPos> &p_units)
+{
+    const CachedUnits *units = m_cache.object(p_key);
+    if (!units) {
+        ++m_stats.m_misses;
+        return false;
+    }
+
+    ++m_stats.m_hits;
+    p_units.reserve(p_units.size() + units->size());
+    for (auto const &unit : *units) {
+        p_units.append(HLUnitPos(unit.m_position, unit.m_length, m_styles[unit.m_styleId]));
+    }
+
+    return true;
+}
+
+void VCodeBlockHighlightCache::insert(const QByteArray &p_key, CachedUnits *p_units)
+{
+    int oldSize = m_cache.size();
+    bool existed = m_cache.contains(p_key);
+
+    // QCache will delete @p_units if it could not hold it.
+    m_cache.insert(p_key, p_units, p_units->size() + 1);
+
+    int evicted = oldSize + (existed ? 0 : 1) - m_cache.size();
+    if (evicted > 0) {
+        m_stats.m_evictions += evicted;
+    }
+}
+
+void VCodeBlockHighlightCache::put(const QByteArray &p_key, const QVector<HLUnitPos> &p_units)
+{
+    CachedUnits *units = new CachedUnits();
+    units->reserve(p_units.size());
+    for (auto const &unit : p_units) {
+        CachedUnit cu;
+        cu.m_position = unit.m_position;
+        cu.m_length = unit.m_length;
+        cu.m_styleId = internStyle(unit.m_style);
+        units->append(cu);
+    }
+
+    insert(p_key, units);
+    m_dirty = true;
+}
+
+bool VCodeBlockHighlightCache::load()
+{
+    QFile file(m_filePath);
+    if (!file.exists()) {
+        return false;
+    }
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "fail to open code block highlight cache" << m_filePath;
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != c_cacheFileMagic || version != c_cacheFileVersion) {
+        qWarning() << "ignore code block highlight cache of unknown format" << m_filePath;
+        return false;
+    }
+
+    // Map the style IDs in file to the interned ones.
+    QStringList styles;
+    in >> styles;
+    QVector<int> styleMap(styles.size());
+    for (int i = 0; i < styles.size(); ++i) {
+        styleMap[i] = internStyle(styles[i]);
+    }
+
+    quint32 nrEntries;
+    in >> nrEntries;
+    for (quint32 i = 0; i < nrEntries && in.status() == QDataStream::Ok; ++i) {
+        QByteArray key;
+        quint32 nrUnits;
+        in >> key >> nrUnits;
+
+        CachedUnits *units = new CachedUnits();
+        units->reserve(nrUnits);
+        for (quint32 j = 0; j < nrUnits; ++j) {
+            CachedUnit unit;
+            quint16 styleId;
+            in >> unit.m_position >> unit.m_length >> styleId;
+            if (styleId >= styleMap.size()) {
+                in.setStatus(QDataStream::ReadCorruptData);
+                break;
+            }
+
+            unit.m_styleId = styleMap[styleId];
+            units->append(unit);
+        }
+
+        if (in.status() != QDataStream::Ok) {
+            delete units;
+            break;
+        }
+
+        insert(key, units);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "code block highlight cache is corrupted" << m_filePath;
+        m_cache.clear();
+        return false;
+    }
+
+    // Statistics are per session.
+    m_stats.m_evictions = 0;
+
+    qDebug() << "load" << m_cache.size() << "code block highlight results from" << m_filePath;
+    return true;
+}
+
+bool VCodeBlockHighlightCache::save() const
+{
+    QSaveFile file(m_filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "fail to open code block highlight cache to write" << m_filePath;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    out << c_cacheFileMagic << c_cacheFileVersion;
+    out << QStringList(m_styles.toList());
+
+    QList<QByteArray> keys = m_cache.keys();
+    out << (quint32)keys.size();
+    for (auto const &key : keys) {
+        const CachedUnits *units = m_cache[key];
+        out << key << (quint32)units->size();
+        for (auto const &unit : *units) {
+            out << unit.m_position << unit.m_length << unit.m_styleId;
+        }
+    }
+
+    if (!file.commit()) {
+        qWarning() << "fail to write code block highlight cache" << m_filePath;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef VCODEBLOCKHIGHLIGHTCACHE_H
+#define VCODEBLOCKHIGHLIGHTCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QCache>
+#include "hgmarkdownhighlighter.h"
+#include "vconstants.h"
+
+// Process-wide LRU cache of code block highlight results shared by all the
+// editors and persisted to a file in the config folder.
+// Keyed by the version of the units, the engine, the language and the hash of
+// the unindented text of the code block.
+// The cached positions are relative to the unindented text.
+class VCodeBlockHighlightCache
+{
+public:
+    struct Statistics
+    {
+        Statistics() : m_hits(0), m_misses(0), m_evictions(0)
+        {
+        }
+
+        int m_hits;
+        int m_misses;
+        int m_evictions;
+    };
+
+    // @p_filePath: the file to persist the cache;
+    // @p_maxUnits: the maximum number of highlight units to keep;
+    VCodeBlockHighlightCache(const QString &p_filePath, int p_maxUnits);
+
+    // Save the cache to disk.
+    ~VCodeBlockHighlightCache();
+
+    // @p_engine: the engine which highlights the code block.
+    static QByteArray key(CodeBlockHighlightEngine p_engine,
+                          const QString &p_lang,
+                          const QString &p_unindentedText);
+
+    // Returns false if @p_key is not cached.
+    bool get(const QByteArray &p_key, QVector<HLUnitPos> &p_units);
+
+    void put(const QByteArray &p_key, const QVector<HLUnitPos> &p_units);
+
+    int size() const;
+
+    const Statistics &getStatistics() const;
+
+    bool load();
+
+    bool save() const;
+
+private:
+    // Compact highlight unit with interned style.
+    struct CachedUnit
+    {
+        qint32 m_position;
+        qint32 m_length;
+        quint16 m_styleId;
+    };
+
+    typedef QVector<CachedUnit> CachedUnits;
+
+    int internStyle(const QString &p_style);
+
+    void insert(const QByteArray &p_key, CachedUnits *p_units);
+
+    QString m_filePath;
+
+    QCache<QByteArray, CachedUnits> m_cache;
+
+    // Interned style names. Index is the style ID.
+    QVector<QString> m_styles;
+    QHash<QString, int> m_styleIds;
+
+    Statistics m_stats;
+
+    // Whether there are changes not saved yet.
+    bool m_dirty;
+};
+
+inline int VCodeBlockHighlightCache::size() const
+{
+    return m_cache.size();
+}
+
+inline const VCodeBlockHighlightCache::Statistics &VCodeBlockHighlightCache::getStatistics() const
+{
+    return m_stats;
+}
+
+#endif // VCODEBLOCKHIGHLIGHTCACHE_H
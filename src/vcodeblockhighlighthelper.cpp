@@ -1,15 +1,22 @@
 #include "vcodeblockhighlighthelper.h"
 
 #include <QDebug>
+#include <algorithm>
 #include <QStringList>
 #include "vdocument.h"
 #include "utils/vutils.h"
+#include "utils/vcodetokenizer.h"
+#include "vcodeblockhighlightcache.h"
+
+extern VConfigManager *g_config;
+
+extern VCodeBlockHighlightCache *g_codeBlockHighlightCache;
 
 VCodeBlockHighlightHelper::VCodeBlockHighlightHelper(HGMarkdownHighlighter *p_highlighter,
                                                      VDocument *p_vdoc,
                                                      MarkdownConverterType p_type)
     : QObject(p_highlighter), m_highlighter(p_highlighter), m_vdocument(p_vdoc),
-      m_type(p_type), m_timeStamp(0)
+      m_type(p_type), m_timeStamp(0), m_numOfWebResultsToRecv(0)
 {
     connect(m_highlighter, &HGMarkdownHighlighter::codeBlocksUpdated,
             this, &VCodeBlockHighlightHelper::handleCodeBlocksUpdated);
@@ -21,6 +28,16 @@ VCodeBlockHighlightHelper::VCodeBlockHighlightHelper(HGMarkdownHighlighter *p_hi
             m_highlighter, &HGMarkdownHighlighter::updateHighlight);
 }
 
+int VCodeBlockHighlightHelper::codeBlockIndent(const QString &p_text)
+{
+    int indent = 0;
+    while (indent < p_text.size() && p_text[indent] != '\n' && p_text[indent].isSpace()) {
+        ++indent;
+    }
+
+    return indent;
+}
+
 QString VCodeBlockHighlightHelper::unindentCodeBlock(const QString &p_text)
 {
     if (p_text.isEmpty()) {
@@ -31,11 +48,7 @@ QString VCodeBlockHighlightHelper::unindentCodeBlock(const QString &p_text)
     V_ASSERT(lines[0].trimmed().startsWith("```"));
     V_ASSERT(lines.size() > 1);
 
-    QRegExp regExp("(^\\s*)");
-    regExp.indexIn(lines[0]);
-    V_ASSERT(regExp.captureCount() == 1);
-    int nrSpaces = regExp.capturedTexts()[1].size();
-
+    int nrSpaces = codeBlockIndent(lines[0]);
     if (nrSpaces == 0) {
         return p_text;
     }
@@ -54,23 +67,128 @@ QString VCodeBlockHighlightHelper::unindentCodeBlock(const QString &p_text)
     return res;
 }
 
+// Convert the positions of @p_units between the raw text @p_text of a code
+// block and its unindented text, which strips at most @p_indent spaces from
+// each line.
+static void mapUnitsOfIndentedText(const QString &p_text, int p_indent,
+                                   QVector<HLUnitPos> &p_units, bool p_toUnindented)
+{
+    if (p_indent == 0 || p_units.isEmpty()) {
+        return;
+    }
+
+    // Start position of each line in the raw and the unindented text and
+    // the number of stripped spaces.
+    QVector<int> rawStarts, unStarts, stripped;
+    int pos = 0, nrStripped = 0;
+    while (true) {
+        int idx = 0;
+        while (idx < p_indent
+               && pos + idx < p_text.size()
+               && p_text[pos + idx] != '\n'
+               && p_text[pos + idx].isSpace()) {
+            ++idx;
+        }
+
+        rawStarts.append(pos);
+        unStarts.append(pos - nrStripped);
+        stripped.append(idx);
+        nrStripped += idx;
+
+        pos = p_text.indexOf('\n', pos);
+        if (pos == -1) {
+            break;
+        }
+
+        ++pos;
+    }
+
+    const QVector<int> &fromStarts = p_toUnindented ? rawStarts : unStarts;
+    auto mapPos = [&](int p_pos) {
+        int line = std::upper_bound(fromStarts.begin(), fromStarts.end(), p_pos)
+                   - fromStarts.begin() - 1;
+        line = qMax(line, 0);
+        int offset = p_pos - fromStarts[line];
+        if (p_toUnindented) {
+            return unStarts[line] + qMax(offset - stripped[line], 0);
+        } else {
+            return rawStarts[line] + stripped[line] + offset;
+        }
+    };
+
+    for (auto &unit : p_units) {
+        int start = mapPos(unit.m_position);
+        int end = mapPos(unit.m_position + unit.m_length);
+        unit.m_position = start;
+        unit.m_length = end - start;
+    }
+}
+
 void VCodeBlockHighlightHelper::handleCodeBlocksUpdated(const QVector<VCodeBlock> &p_codeBlocks)
 {
     int curStamp = m_timeStamp.fetchAndAddRelaxed(1) + 1;
     m_codeBlocks = p_codeBlocks;
+    m_cacheKeys.resize(m_codeBlocks.size());
+    m_numOfWebResultsToRecv = 0;
+    bool useNative = g_config->getCodeBlockHighlightEngine() == CodeBlockHighlightEngine::Native;
+
+    int numOfNative = 0;
+    QElapsedTimer t;
+    qint64 nativeTime = 0;
+    m_webRoundTimer.start();
+
     for (int i = 0; i < m_codeBlocks.size(); ++i) {
         const VCodeBlock &block = m_codeBlocks[i];
-        auto it = m_cache.find(block.m_text);
-        if (it != m_cache.end()) {
+        QString unindentedText = unindentCodeBlock(block.m_text);
+        // Languages not supported by the native engine go to highlight.js.
+        CodeBlockHighlightEngine engine = CodeBlockHighlightEngine::HighlightJs;
+        if (useNative && VCodeTokenizer::isLanguageSupported(block.m_lang)) {
+            engine = CodeBlockHighlightEngine::Native;
+        }
+
+        m_cacheKeys[i] = VCodeBlockHighlightCache::key(engine, block.m_lang, unindentedText);
+
+        QVector<HLUnitPos> units;
+        if (g_codeBlockHighlightCache->get(m_cacheKeys[i], units)) {
             // Hit cache.
             qDebug() << "code block highlight hit cache" << curStamp << i;
-            it.value().m_timeStamp = curStamp;
-            updateHighlightResults(block.m_startPos, it.value().m_units);
-        } else {
-            QString unindentedText = unindentCodeBlock(block.m_text);
-            m_vdocument->highlightTextAsync(unindentedText, i, curStamp);
+            mapUnitsOfIndentedText(block.m_text, codeBlockIndent(block.m_text),
+                                   units, false);
+            updateHighlightResults(block.m_startPos, units);
+            continue;
+        }
+
+        if (useNative) {
+            t.start();
+            bool ret = highlightNatively(i);
+            nativeTime += t.nsecsElapsed();
+            if (ret) {
+                ++numOfNative;
+                continue;
+            }
         }
+
+        ++m_numOfWebResultsToRecv;
+        m_vdocument->highlightTextAsync(unindentedText, i, curStamp);
+    }
+
+    if (numOfNative > 0) {
+        qDebug() << "native code block highlight" << numOfNative << "blocks in"
+                 << nativeTime / 1000 << "us";
+    }
+}
+
+bool VCodeBlockHighlightHelper::highlightNatively(int p_idx)
+{
+    const VCodeBlock &block = m_codeBlocks.at(p_idx);
+    QVector<HLUnitPos> hlUnits;
+    if (!VCodeTokenizer::highlightCodeBlock(block.m_lang, block.m_text, hlUnits)) {
+        return false;
     }
+
+    addToHighlightCache(p_idx, hlUnits);
+    updateHighlightResults(block.m_startPos, hlUnits);
+    return true;
 }
 
 void VCodeBlockHighlightHelper::handleTextHighlightResult(const QString &p_html,
@@ -85,30 +203,116 @@ void VCodeBlockHighlightHelper::handleTextHighlightResult(const QString &p_html,
     parseHighlightResult(p_timeStamp, p_id, p_html);
 }
 
-static void revertEscapedHtml(QString &p_html)
+static inline bool hasEntityAt(const QStringRef &p_str, int p_idx,
+                               const char *p_entity, int p_len)
 {
-    p_html.replace("&gt;", ">").replace("&lt;", "<").replace("&amp;", "&");
+    if (p_idx + p_len > p_str.size()) {
+        return false;
+    }
+
+    for (int i = 0; i < p_len; ++i) {
+        if (p_str.at(p_idx + i) != QLatin1Char(p_entity[i])) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-// Search @p_tokenStr in @p_text from p_index. Spaces after `\n` will not make
-// a difference in the match. The matched range will be returned as
-// [@p_start, @p_end]. Update @p_index to @p_end + 1.
-// Set @p_start and @p_end to -1 to indicate mismatch.
-static void matchTokenRelaxed(const QString &p_text, const QString &p_tokenStr,
-                              int &p_index, int &p_start, int &p_end)
+// Revert the HTML escape of the web side in one pass.
+static QString revertEscapedHtml(const QStringRef &p_html)
 {
-    QString regStr = QRegExp::escape(p_tokenStr);
-    // Do not replace the ending '\n'.
-    regStr.replace(QRegExp("\n(?!$)"), "\\s+");
-    QRegExp regExp(regStr);
-    p_start = p_text.indexOf(regExp, p_index);
-    if (p_start == -1) {
-        p_end = -1;
-        return;
+    QString res;
+    res.reserve(p_html.size());
+
+    int size = p_html.size();
+    int i = 0;
+    while (i < size) {
+        QChar ch = p_html.at(i);
+        if (ch == '&') {
+            if (hasEntityAt(p_html, i, "&gt;", 4)) {
+                res.append('>');
+                i += 4;
+                continue;
+            } else if (hasEntityAt(p_html, i, "&lt;", 4)) {
+                res.append('<');
+                i += 4;
+                continue;
+            } else if (hasEntityAt(p_html, i, "&amp;", 5)) {
+                res.append('&');
+                i += 5;
+                continue;
+            }
+        }
+
+        res.append(ch);
+        ++i;
+    }
+
+    return res;
+}
+
+// Skip at most @p_indent spaces from line start @p_pos of @p_text, which is
+// what unindentCodeBlock() strips from the text sent to the web side.
+static inline int skipIndent(const QString &p_text, int p_indent, int p_pos)
+{
+    int end = qMin(p_pos + p_indent, p_text.size());
+    while (p_pos < end && p_text[p_pos] != '\n' && p_text[p_pos].isSpace()) {
+        ++p_pos;
+    }
+
+    return p_pos;
+}
+
+// Align @p_token against @p_text at @p_pos. Indentation of lines within the
+// token is relaxed.
+// Returns the end of the match, or -1 if mismatch.
+static int alignTokenAt(const QString &p_text, int p_indent,
+                        const QString &p_token, int p_pos)
+{
+    int size = p_text.size();
+    for (int j = 0; j < p_token.size(); ++j) {
+        if (p_pos >= size || p_text[p_pos] != p_token[j]) {
+            return -1;
+        }
+
+        ++p_pos;
+        if (p_token[j] == '\n') {
+            p_pos = skipIndent(p_text, p_indent, p_pos);
+        }
     }
 
-    p_end = p_start + regExp.matchedLength() - 1;
-    p_index = p_end + 1;
+    return p_pos;
+}
+
+// Match @p_token in @p_text from @p_index. The text stream of the highlighted
+// HTML is expected to follow @p_text, so we try to align it at @p_index first
+// and search forward only if it mismatches.
+// Update @p_index to the end of the match.
+static bool matchToken(const QString &p_text, int p_indent,
+                       const QString &p_token, int &p_index)
+{
+    int end = alignTokenAt(p_text, p_indent, p_token, p_index);
+    if (end == -1) {
+        for (int i = p_index + 1; i < p_text.size(); ++i) {
+            i = p_text.indexOf(p_token[0], i);
+            if (i == -1) {
+                break;
+            }
+
+            end = alignTokenAt(p_text, p_indent, p_token, i);
+            if (end != -1) {
+                break;
+            }
+        }
+    }
+
+    if (end == -1) {
+        return false;
+    }
+
+    p_index = end;
+    return true;
 }
 
 // For now, we could only handle code blocks outside the list.
@@ -124,6 +328,8 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
 
     bool failed = true;
 
+    int indent = 0;
+
     QXmlStreamReader xml(p_html);
 
     // Must have a fenced line at the front.
@@ -132,7 +338,11 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
     if (textIndex == -1) {
         goto exit;
     }
-    ++textIndex;
+
+    // Indentation of the fence, which is stripped from each line.
+    indent = codeBlockIndent(text);
+
+    textIndex = skipIndent(text, indent, textIndex + 1);
 
     if (xml.readNextStartElement()) {
         if (xml.name() != "pre") {
@@ -150,12 +360,7 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
         while (xml.readNext()) {
             if (xml.isCharacters()) {
                 // Revert the HTML escape to match.
-                QString tokenStr = xml.text().toString();
-                revertEscapedHtml(tokenStr);
-
-                int start, end;
-                matchTokenRelaxed(text, tokenStr, textIndex, start, end);
-                if (start == -1) {
+                if (!matchToken(text, indent, revertEscapedHtml(xml.text()), textIndex)) {
                     failed = true;
                     goto exit;
                 }
@@ -164,7 +369,7 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
                     failed = true;
                     goto exit;
                 }
-                if (!parseSpanElement(xml, text, textIndex, hlUnits)) {
+                if (!parseSpanElement(xml, text, indent, textIndex, hlUnits)) {
                     failed = true;
                     goto exit;
                 }
@@ -194,12 +399,17 @@ exit:
         qWarning() << "fail to parse highlighted result"
                    << "stamp:" << p_timeStamp << "index:" << p_idx << p_html;
         hlUnits.clear();
+    } else {
+        // Add it to cache.
+        addToHighlightCache(p_idx, hlUnits);
     }
 
-    // Add it to cache.
-    addToHighlightCache(text, p_timeStamp, hlUnits);
-
     updateHighlightResults(startPos, hlUnits);
+
+    if (--m_numOfWebResultsToRecv == 0) {
+        qDebug() << "web code block highlight round" << p_timeStamp << "finished in"
+                 << m_webRoundTimer.elapsed() << "ms";
+    }
 }
 
 void VCodeBlockHighlightHelper::updateHighlightResults(int p_startPos,
@@ -215,6 +425,7 @@ void VCodeBlockHighlightHelper::updateHighlightResults(int p_startPos,
 
 bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
                                                  const QString &p_text,
+                                                 int p_indent,
                                                  int &p_index,
                                                  QVector<HLUnitPos> &p_units)
 {
@@ -224,12 +435,7 @@ bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
     while (p_xml.readNext()) {
         if (p_xml.isCharacters()) {
             // Revert the HTML escape to match.
-            QString tokenStr = p_xml.text().toString();
-            revertEscapedHtml(tokenStr);
-
-            int start, end;
-            matchTokenRelaxed(p_text, tokenStr, p_index, start, end);
-            if (start == -1) {
+            if (!matchToken(p_text, p_indent, revertEscapedHtml(p_xml.text()), p_index)) {
                 return false;
             }
         } else if (p_xml.isStartElement()) {
@@ -238,7 +444,7 @@ bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
             }
 
             // Sub-span.
-            if (!parseSpanElement(p_xml, p_text, p_index, p_units)) {
+            if (!parseSpanElement(p_xml, p_text, p_indent, p_index, p_units)) {
                 return false;
             }
         } else if (p_xml.isEndElement()) {
@@ -257,23 +463,10 @@ bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
     return false;
 }
 
-void VCodeBlockHighlightHelper::addToHighlightCache(const QString &p_text,
-                                                    int p_timeStamp,
-                                                    const QVector<HLUnitPos> &p_units)
+void VCodeBlockHighlightHelper::addToHighlightCache(int p_idx,
+                                                    QVector<HLUnitPos> p_units)
 {
-    const int c_maxEntries = 100;
-    const int c_maxTimeStampSpan = 3;
-    if (m_cache.size() >= c_maxEntries) {
-        // Remove the oldest one.
-        int ts = p_timeStamp - c_maxTimeStampSpan;
-        for (auto it = m_cache.begin(); it != m_cache.end();) {
-            if (it.value().m_timeStamp < ts) {
-                it = m_cache.erase(it);
-            } else {
-                ++it;
-            }
-        }
-    }
-
-    m_cache.insert(p_text, HLResult(p_timeStamp, p_units));
+    const VCodeBlock &block = m_codeBlocks.at(p_idx);
+    mapUnitsOfIndentedText(block.m_text, codeBlockIndent(block.m_text), p_units, true);
+    g_codeBlockHighlightCache->put(m_cacheKeys.at(p_idx), p_units);
 }
@@ -6,6 +6,8 @@
 #include <QAtomicInteger>
 #include <QXmlStreamReader>
 #include <QHash>
+#include <QByteArray>
+#include <QElapsedTimer>
 #include "vconfigmanager.h"
 
 class VDocument;
@@ -23,28 +25,15 @@ private slots:
     void handleTextHighlightResult(const QString &p_html, int p_id, int p_timeStamp);
 
 private:
-    struct HLResult
-    {
-        HLResult() : m_timeStamp(-1)
-        {
-        }
-
-        HLResult(int p_timeStamp, const QVector<HLUnitPos> &p_units)
-            : m_timeStamp(p_timeStamp), m_units(p_units)
-        {
-        }
-
-        int m_timeStamp;
-        QVector<HLUnitPos> m_units;
-    };
-
     void parseHighlightResult(int p_timeStamp, int p_idx, const QString &p_html);
 
     // @p_text: the raw text of the code block;
+    // @p_indent: the indentation of the fence, which is stripped from each line
+    //            of the text sent to the web side;
     // @p_index: the start index of the span element within @p_text;
     // @p_units: all the highlight units of this code block;
     bool parseSpanElement(QXmlStreamReader &p_xml,
-                          const QString &p_text, int &p_index,
+                          const QString &p_text, int p_indent, int &p_index,
                           QVector<HLUnitPos> &p_units);
 
     // @p_text: text of fenced code block.
@@ -54,11 +43,18 @@ private:
     // without any context.
     QString unindentCodeBlock(const QString &p_text);
 
+    // Get the indent level of the first line (fence) of @p_text.
+    static int codeBlockIndent(const QString &p_text);
+
     void updateHighlightResults(int p_startPos, QVector<HLUnitPos> p_units);
 
-    void addToHighlightCache(const QString &p_text,
-                             int p_timeStamp,
-                             const QVector<HLUnitPos> &p_units);
+    // Add the highlight result of the @p_idx code block to the global cache.
+    // @p_units is relative to the raw text of the code block.
+    void addToHighlightCache(int p_idx, QVector<HLUnitPos> p_units);
+
+    // Highlight the @p_idx code block in process. Returns false if the
+    // language is not supported by VCodeTokenizer.
+    bool highlightNatively(int p_idx);
 
     HGMarkdownHighlighter *m_highlighter;
     VDocument *m_vdocument;
@@ -66,9 +62,15 @@ private:
     QAtomicInteger<int> m_timeStamp;
     QVector<VCodeBlock> m_codeBlocks;
 
-    // Cache for highlight result, using the code block text as key.
-    // The HLResult has relative position only.
-    QHash<QString, HLResult> m_cache;
+    // Key in the global highlight cache of each code block in m_codeBlocks.
+    QVector<QByteArray> m_cacheKeys;
+
+    // Time the web highlight round of current time stamp, including the web
+    // channel round trip, for the "web code block highlight round" log.
+    QElapsedTimer m_webRoundTimer;
+
+    // Number of code blocks of current time stamp waiting for web results.
+    int m_numOfWebResultsToRecv;
 };
 
 #endif // VCODEBLOCKHIGHLIGHTHELPER_H
@@ -1,6 +1,7 @@
 #include "vconfigmanager.h"
 #include <QDir>
 #include <QFile>
+#include <QSaveFile>
 #include <QString>
 #include <QJsonArray>
 #include <QJsonObject>
@@ -18,6 +19,10 @@ const QString VConfigManager::c_obsoleteDirConfigFile = QString(".vnote.json");
 const QString VConfigManager::c_dirConfigFile = QString("_vnote.json");
 const QString VConfigManager::defaultConfigFilePath = QString(":/resources/vnote.ini");
 const QString VConfigManager::c_styleConfigFolder = QString("styles");
+const QString VConfigManager::c_codeBlockHighlightCacheFile = QString("code_block_highlight.cache");
+const QString VConfigManager::c_thumbnailCacheFolder = QString("thumbnails");
+const QString VConfigManager::c_downloadCacheFolder = QString("downloads");
+const QString VConfigManager::c_notebookIndexFolder = QString("notebook_index");
 const QString VConfigManager::c_defaultCssFile = QString(":/resources/styles/default.css");
 const QString VConfigManager::c_defaultMdhlFile = QString(":/resources/styles/default.mdhl");
 const QString VConfigManager::c_solarizedDarkMdhlFile = QString(":/resources/styles/solarized-dark.mdhl");
@@ -118,12 +123,30 @@ void VConfigManager::initialize()
     m_enableCodeBlockHighlight = getConfigFromSettings("global",
                                                        "enable_code_block_highlight").toBool();
 
+    m_codeBlockHighlightEngine = (CodeBlockHighlightEngine)getConfigFromSettings("global",
+                                                                                 "code_block_highlight_engine").toInt();
+
+    m_codeBlockHighlightCacheSize = getConfigFromSettings("global",
+                                                          "code_block_highlight_cache_size").toInt();
+
     m_enablePreviewImages = getConfigFromSettings("global",
                                                   "enable_preview_images").toBool();
 
     m_enablePreviewImageConstraint = getConfigFromSettings("global",
                                                            "enable_preview_image_constraint").toBool();
 
+    m_previewImageCacheSize = getConfigFromSettings("global",
+                                                    "preview_image_cache_size").toInt();
+
+    m_thumbnailCacheSize = getConfigFromSettings("global",
+                                                 "thumbnail_cache_size").toInt();
+
+    m_downloadCacheSize = getConfigFromSettings("global",
+                                                "download_cache_size").toInt();
+
+    m_maxConcurrentDownloads = getConfigFromSettings("global",
+                                                     "max_concurrent_downloads").toInt();
+
     m_enableImageConstraint = getConfigFromSettings("global",
                                                     "enable_image_constraint").toBool();
 
@@ -203,6 +226,9 @@ void VConfigManager::initialize()
 
     m_confirmImagesCleanUp = getConfigFromSettings("global",
                                                    "confirm_images_clean_up").toBool();
+
+    m_directoryPreloadDepth = getConfigFromSettings("global",
+                                                    "directory_preload_depth").toInt();
 }
 
 void VConfigManager::readPredefinedColorsFromSettings()
@@ -339,7 +365,9 @@ bool VConfigManager::writeDirectoryConfig(const QString &path, const QJsonObject
 {
     QString configFile = fetchDirConfigFilePath(path);
 
-    QFile config(configFile);
+    // Write to a temporary file and then rename it to avoid corrupting the
+    // config file.
+    QSaveFile config(configFile);
     if (!config.open(QIODevice::WriteOnly)) {
         qWarning() << "fail to open directory configuration file for write:"
                    << configFile;
@@ -347,10 +375,21 @@ bool VConfigManager::writeDirectoryConfig(const QString &path, const QJsonObject
     }
 
     QJsonDocument configDoc(configJson);
-    config.write(configDoc.toJson());
+    config.write(configDoc.toJson(QJsonDocument::Compact));
+    if (!config.commit()) {
+        qWarning() << "fail to write directory configuration file:"
+                   << configFile;
+        return false;
+    }
+
     return true;
 }
 
+QString VConfigManager::getDirConfigFilePath(const QString &p_path)
+{
+    return QDir::cleanPath(QDir(p_path).filePath(c_dirConfigFile));
+}
+
 bool VConfigManager::deleteDirectoryConfig(const QString &path)
 {
     QString configFile = fetchDirConfigFilePath(path);
@@ -587,6 +626,29 @@ QString VConfigManager::getStyleConfigFolder() const
     return getConfigFolder() + QDir::separator() + c_styleConfigFolder;
 }
 
+QString VConfigManager::getCodeBlockHighlightCacheFilePath() const
+{
+    return getConfigFolder() + QDir::separator() + c_codeBlockHighlightCacheFile;
+}
+
+QString VConfigManager::getThumbnailCacheFolder() const
+{
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return location + QDir::separator() + c_thumbnailCacheFolder;
+}
+
+QString VConfigManager::getDownloadCacheFolder() const
+{
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return location + QDir::separator() + c_downloadCacheFolder;
+}
+
+QString VConfigManager::getNotebookIndexFolder() const
+{
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return location + QDir::separator() + c_notebookIndexFolder;
+}
+
 QVector<QString> VConfigManager::getCssStyles() const
 {
     QVector<QString> res;
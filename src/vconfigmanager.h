@@ -56,6 +56,10 @@ public:
     static bool directoryConfigExist(const QString &path);
     static bool deleteDirectoryConfig(const QString &path);
 
+    // Get the path of the directory config file of @p_path without checking
+    // the obsolete one.
+    static QString getDirConfigFilePath(const QString &p_path);
+
     static QString getLogFilePath();
 
     // Get the path of the folder used to store default notebook.
@@ -191,12 +195,36 @@ public:
     bool getEnableCodeBlockHighlight() const;
     void setEnableCodeBlockHighlight(bool p_enabled);
 
+    CodeBlockHighlightEngine getCodeBlockHighlightEngine() const;
+
+    int getCodeBlockHighlightCacheSize() const;
+
+    // Get the file path of the code block highlight cache in the config folder.
+    QString getCodeBlockHighlightCacheFilePath() const;
+
     bool getEnablePreviewImages() const;
     void setEnablePreviewImages(bool p_enabled);
 
     bool getEnablePreviewImageConstraint() const;
     void setEnablePreviewImageConstraint(bool p_enabled);
 
+    int getPreviewImageCacheSize() const;
+
+    int getThumbnailCacheSize() const;
+
+    // Get the folder of the thumbnail cache in the user cache folder.
+    QString getThumbnailCacheFolder() const;
+
+    int getDownloadCacheSize() const;
+
+    int getMaxConcurrentDownloads() const;
+
+    // Get the folder of the download cache in the user cache folder.
+    QString getDownloadCacheFolder() const;
+
+    // Get the folder of the notebook metadata indexes in the user cache folder.
+    QString getNotebookIndexFolder() const;
+
     bool getEnableImageConstraint() const;
     void setEnableImageConstraint(bool p_enabled);
 
@@ -269,6 +297,8 @@ public:
     bool getConfirmImagesCleanUp() const;
     void setConfirmImagesCleanUp(bool p_enabled);
 
+    int getDirectoryPreloadDepth() const;
+
     // Return the configured key sequence of @p_operation.
     // Return empty if there is no corresponding config.
     QString getShortcutKeySequence(const QString &p_operation) const;
@@ -442,12 +472,30 @@ private:
     // Enable colde block syntax highlight.
     bool m_enableCodeBlockHighlight;
 
+    // Engine to highlight code blocks in edit mode.
+    CodeBlockHighlightEngine m_codeBlockHighlightEngine;
+
+    // Max number of highlight units in the code block highlight cache.
+    int m_codeBlockHighlightCacheSize;
+
     // Preview images in edit mode.
     bool m_enablePreviewImages;
 
     // Constrain the width of image preview in edit mode.
     bool m_enablePreviewImageConstraint;
 
+    // Max size in MB of the preview image cache.
+    int m_previewImageCacheSize;
+
+    // Max size in MB of the thumbnail cache on disk.
+    int m_thumbnailCacheSize;
+
+    // Max size in MB of the download cache on disk.
+    int m_downloadCacheSize;
+
+    // Max number of concurrent downloads.
+    int m_maxConcurrentDownloads;
+
     // Constrain the width of image in read mode.
     bool m_enableImageConstraint;
 
@@ -542,6 +590,9 @@ private:
     // Confirm before deleting unused images.
     bool m_confirmImagesCleanUp;
 
+    // Levels of sub-folders to open in background when expanding a folder.
+    int m_directoryPreloadDepth;
+
     // The name of the config file in each directory, obsolete.
     // Use c_dirConfigFile instead.
     static const QString c_obsoleteDirConfigFile;
@@ -557,6 +608,18 @@ private:
     QSettings *defaultSettings;
     // The folder name of style files.
     static const QString c_styleConfigFolder;
+
+    // The name of the code block highlight cache file.
+    static const QString c_codeBlockHighlightCacheFile;
+
+    // The folder name of the thumbnail cache in the cache folder.
+    static const QString c_thumbnailCacheFolder;
+
+    // The folder name of the download cache in the cache folder.
+    static const QString c_downloadCacheFolder;
+
+    // The folder name of the notebook metadata indexes in the cache folder.
+    static const QString c_notebookIndexFolder;
     static const QString c_defaultCssFile;
 
     // MDHL files for editor styles.
@@ -1025,6 +1088,16 @@ inline void VConfigManager::setEnableCodeBlockHighlight(bool p_enabled)
                         m_enableCodeBlockHighlight);
 }
 
+inline CodeBlockHighlightEngine VConfigManager::getCodeBlockHighlightEngine() const
+{
+    return m_codeBlockHighlightEngine;
+}
+
+inline int VConfigManager::getCodeBlockHighlightCacheSize() const
+{
+    return m_codeBlockHighlightCacheSize;
+}
+
 inline bool VConfigManager::getEnablePreviewImages() const
 {
     return m_enablePreviewImages;
@@ -1057,6 +1130,26 @@ inline void VConfigManager::setEnablePreviewImageConstraint(bool p_enabled)
                         m_enablePreviewImageConstraint);
 }
 
+inline int VConfigManager::getPreviewImageCacheSize() const
+{
+    return m_previewImageCacheSize;
+}
+
+inline int VConfigManager::getThumbnailCacheSize() const
+{
+    return m_thumbnailCacheSize;
+}
+
+inline int VConfigManager::getDownloadCacheSize() const
+{
+    return m_downloadCacheSize;
+}
+
+inline int VConfigManager::getMaxConcurrentDownloads() const
+{
+    return m_maxConcurrentDownloads;
+}
+
 inline bool VConfigManager::getEnableImageConstraint() const
 {
     return m_enableImageConstraint;
@@ -1409,4 +1502,9 @@ inline void VConfigManager::setConfirmImagesCleanUp(bool p_enabled)
                         "confirm_images_clean_up",
                         m_confirmImagesCleanUp);
 }
+
+inline int VConfigManager::getDirectoryPreloadDepth() const
+{
+    return m_directoryPreloadDepth;
+}
 #endif // VCONFIGMANAGER_H
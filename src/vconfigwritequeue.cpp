@@ -0,0 +1,139 @@
+#include "vconfigwritequeue.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QTimer>
+#include <QDateTime>
+#include "vconfigmanager.h"
+
+// Write pending configs after no write for this interval (ms).
+static const int c_flushInterval = 1000;
+
+// Do not defer a write for longer than this (ms) under continuous writes.
+static const qint64 c_maxFlushDelay = 5000;
+
+VConfigWriteQueue::VConfigWriteQueue(QObject *p_parent)
+    : QObject(p_parent), m_oldestPendingTime(0)
+{
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(c_flushInterval);
+    connect(m_flushTimer, &QTimer::timeout,
+            this, &VConfigWriteQueue::flush);
+}
+
+VConfigWriteQueue::~VConfigWriteQueue()
+{
+    flush();
+
+    qDebug() << "directory config writes: requests" << m_stats.m_requests
+             << "writes" << m_stats.m_writes << "coalesced" << m_stats.m_coalesced
+             << "failures" << m_stats.m_failures;
+}
+
+void VConfigWriteQueue::write(const QString &p_path, const QJsonObject &p_json)
+{
+    ++m_stats.m_requests;
+
+    QString path = QDir::cleanPath(p_path);
+    auto it = m_pendingConfigs.find(path);
+    if (it != m_pendingConfigs.end()) {
+        ++m_stats.m_coalesced;
+        it.value() = p_json;
+    } else {
+        m_pendingConfigs.insert(path, p_json);
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (m_oldestPendingTime == 0) {
+        m_oldestPendingTime = now;
+    }
+
+    if (now - m_oldestPendingTime >= c_maxFlushDelay) {
+        flush();
+    } else {
+        m_flushTimer->start();
+    }
+}
+
+bool VConfigWriteQueue::writeNow(const QString &p_path, const QJsonObject &p_json)
+{
+    ++m_stats.m_requests;
+
+    if (!VConfigManager::writeDirectoryConfig(p_path, p_json)) {
+        ++m_stats.m_failures;
+        return false;
+    }
+
+    ++m_stats.m_writes;
+    m_pendingConfigs.remove(QDir::cleanPath(p_path));
+    return true;
+}
+
+void VConfigWriteQueue::countCoalesced(int p_nrRequests)
+{
+    m_stats.m_requests += p_nrRequests;
+    m_stats.m_coalesced += p_nrRequests;
+}
+
+bool VConfigWriteQueue::pendingConfig(const QString &p_path, QJsonObject &p_json) const
+{
+    auto it = m_pendingConfigs.find(QDir::cleanPath(p_path));
+    if (it == m_pendingConfigs.end()) {
+        return false;
+    }
+
+    p_json = it.value();
+    return true;
+}
+
+void VConfigWriteQueue::discard(const QString &p_path)
+{
+    QString path = QDir::cleanPath(p_path);
+    QString prefix = path + "/";
+    for (auto it = m_pendingConfigs.begin(); it != m_pendingConfigs.end();) {
+        if (it.key() == path || it.key().startsWith(prefix)) {
+            it = m_pendingConfigs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool VConfigWriteQueue::flush()
+{
+    m_flushTimer->stop();
+    m_oldestPendingTime = 0;
+
+    if (m_pendingConfigs.isEmpty()) {
+        return true;
+    }
+
+    // Clear before writing in case of re-entrance.
+    QHash<QString, QJsonObject> configs;
+    configs.swap(m_pendingConfigs);
+
+    QStringList failedPaths;
+    for (auto it = configs.begin(); it != configs.end(); ++it) {
+        if (VConfigManager::writeDirectoryConfig(it.key(), it.value())) {
+            ++m_stats.m_writes;
+        } else {
+            ++m_stats.m_failures;
+            failedPaths.append(it.key());
+
+            // Keep it pending unless there is a newer one.
+            if (!m_pendingConfigs.contains(it.key())) {
+                m_pendingConfigs.insert(it.key(), it.value());
+            }
+        }
+    }
+
+    qDebug() << "flush" << configs.size() << "directory configs";
+    if (failedPaths.isEmpty()) {
+        return true;
+    }
+
+    qWarning() << "fail to write directory configs" << failedPaths;
+    emit writeFailed(failedPaths);
+    return false;
+}
@@ -0,0 +1,94 @@
+#ifndef VCONFIGWRITEQUEUE_H
+#define VCONFIGWRITEQUEUE_H
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QStringList>
+#include <QJsonObject>
+
+class QTimer;
+
+// Write-behind queue of directory configs.
+// Multiple writes of the same directory are coalesced into one, which is
+// written when there is no more write for a while, or at last when flush()
+// is called.
+// Structural changes, such as creating, renaming or moving a note or a
+// folder, should use writeNow() to check the result and roll back.
+class VConfigWriteQueue : public QObject
+{
+    Q_OBJECT
+public:
+    struct Statistics
+    {
+        Statistics() : m_requests(0), m_writes(0), m_coalesced(0), m_failures(0)
+        {
+        }
+
+        // Number of write requests.
+        int m_requests;
+
+        // Number of configs written to disk.
+        int m_writes;
+
+        // Number of requests replaced by a later one before written.
+        int m_coalesced;
+
+        int m_failures;
+    };
+
+    explicit VConfigWriteQueue(QObject *p_parent = 0);
+
+    // Flush all the pending writes.
+    ~VConfigWriteQueue();
+
+    // Queue a write of @p_json to the config file of directory @p_path.
+    void write(const QString &p_path, const QJsonObject &p_json);
+
+    // Write @p_json to the config file of directory @p_path now, replacing
+    // the pending write of it.
+    // Returns false if failed, and the pending write is kept.
+    bool writeNow(const QString &p_path, const QJsonObject &p_json);
+
+    // Count @p_nrRequests write requests merged by the caller into its
+    // writeNow() calls, such as those of a bulk move.
+    void countCoalesced(int p_nrRequests);
+
+    // Get the pending config of directory @p_path.
+    // Returns false if there is none.
+    bool pendingConfig(const QString &p_path, QJsonObject &p_json) const;
+
+    // Drop the pending writes of directory @p_path and all its sub-directories.
+    void discard(const QString &p_path);
+
+    const Statistics &getStatistics() const;
+
+signals:
+    // Emit when configs of directories @p_paths failed to be written.
+    // They are kept pending and will be written again at next flush.
+    void writeFailed(const QStringList &p_paths);
+
+public slots:
+    // Write all the pending configs now.
+    // Returns false if any of them failed.
+    bool flush();
+
+private:
+    // Pending configs keyed by the directory path.
+    QHash<QString, QJsonObject> m_pendingConfigs;
+
+    // Fire when there is no write for a while.
+    QTimer *m_flushTimer;
+
+    // Time in ms since epoch of the oldest pending write.
+    qint64 m_oldestPendingTime;
+
+    Statistics m_stats;
+};
+
+inline const VConfigWriteQueue::Statistics &VConfigWriteQueue::getStatistics() const
+{
+    return m_stats;
+}
+
+#endif // VCONFIGWRITEQUEUE_H
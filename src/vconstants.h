@@ -85,4 +85,13 @@ enum class LineNumberType
     CodeBlock
 };
 
+enum class CodeBlockHighlightEngine
+{
+    // highlight.js in the web page.
+    HighlightJs = 0,
+
+    // VCodeTokenizer, falling back to highlight.js for unsupported languages.
+    Native
+};
+
 #endif
@@ -6,9 +6,16 @@
 #include "vconfigmanager.h"
 #include "vfile.h"
 #include "utils/vutils.h"
+#include "vnotebookindex.h"
+#include "vconfigwritequeue.h"
 
 extern VConfigManager *g_config;
 
+extern VConfigWriteQueue *g_configWriteQueue;
+
+// Start from 1 so that paths of new directories are invalid.
+quint64 VDirectory::s_pathGeneration = 1;
+
 VDirectory::VDirectory(VNotebook *p_notebook,
                        const QString &p_name,
                        QObject *p_parent,
@@ -18,7 +25,8 @@ VDirectory::VDirectory(VNotebook *p_notebook,
       m_name(p_name),
       m_opened(false),
       m_expanded(false),
-      m_createdTimeUtc(p_createdTimeUtc)
+      m_createdTimeUtc(p_createdTimeUtc),
+      m_pathGeneration(0)
 {
 }
 
@@ -28,29 +36,39 @@ bool VDirectory::open()
         return true;
     }
 
-    V_ASSERT(m_subDirs.isEmpty() && m_files.isEmpty());
-
     QString path = fetchPath();
-    QJsonObject configJson = VConfigManager::readDirectoryConfig(path);
+    QJsonObject configJson = m_notebook->getIndex()->readDirectoryConfig(path);
     if (configJson.isEmpty()) {
         qWarning() << "invalid directory configuration in path" << path;
         return false;
     }
 
+    return open(configJson);
+}
+
+bool VDirectory::open(const QJsonObject &p_configJson)
+{
+    if (m_opened) {
+        return true;
+    }
+
+    V_ASSERT(m_subDirs.isEmpty() && m_files.isEmpty());
+
     // created_time
-    m_createdTimeUtc = QDateTime::fromString(configJson[DirConfig::c_createdTime].toString(),
+    m_createdTimeUtc = QDateTime::fromString(p_configJson[DirConfig::c_createdTime].toString(),
                                              Qt::ISODate);
 
     // [sub_directories] section
-    QJsonArray dirJson = configJson[DirConfig::c_subDirectories].toArray();
+    QJsonArray dirJson = p_configJson[DirConfig::c_subDirectories].toArray();
     for (int i = 0; i < dirJson.size(); ++i) {
         QJsonObject dirItem = dirJson[i].toObject();
         VDirectory *dir = new VDirectory(m_notebook, dirItem[DirConfig::c_name].toString(), this);
         m_subDirs.append(dir);
+        m_subDirIndex.insert(dir->getName(), dir);
     }
 
     // [files] section
-    QJsonArray fileJson = configJson[DirConfig::c_files].toArray();
+    QJsonArray fileJson = p_configJson[DirConfig::c_files].toArray();
     for (int i = 0; i < fileJson.size(); ++i) {
         QJsonObject fileItem = fileJson[i].toObject();
         VFile *file = VFile::fromJson(fileItem,
@@ -58,6 +76,7 @@ bool VDirectory::open()
                                       FileType::Normal,
                                       true);
         m_files.append(file);
+        m_fileIndex.insert(file->getName(), file);
     }
 
     m_opened = true;
@@ -76,6 +95,7 @@ void VDirectory::close()
         delete dir;
     }
     m_subDirs.clear();
+    m_subDirIndex.clear();
 
     for (int i = 0; i < m_files.size(); ++i) {
         VFile *file = m_files[i];
@@ -83,6 +103,7 @@ void VDirectory::close()
         delete file;
     }
     m_files.clear();
+    m_fileIndex.clear();
 
     m_opened = false;
 }
@@ -92,32 +113,23 @@ QString VDirectory::fetchBasePath() const
     return VUtils::basePathFromPath(fetchPath());
 }
 
-QString VDirectory::fetchPath(const VDirectory *p_dir) const
+void VDirectory::updatePaths() const
 {
-    if (!p_dir) {
-        return "";
-    }
-    VDirectory *parentDir = (VDirectory *)p_dir->parent();
-    if (parentDir) {
-        // Not the root directory
-        return QDir(fetchPath(parentDir)).filePath(p_dir->getName());
-    } else {
-        return m_notebook->getPath();
+    if (m_pathGeneration == s_pathGeneration) {
+        return;
     }
-}
 
-QString VDirectory::fetchRelativePath(const VDirectory *p_dir) const
-{
-    if (!p_dir) {
-        return "";
-    }
-    VDirectory *parentDir = (VDirectory *)p_dir->parent();
+    const VDirectory *parentDir = getParentDirectory();
     if (parentDir) {
         // Not the root directory
-        return QDir(fetchRelativePath(parentDir)).filePath(p_dir->getName());
+        m_path = QDir(parentDir->fetchPath()).filePath(m_name);
+        m_relativePath = QDir(parentDir->fetchRelativePath()).filePath(m_name);
     } else {
-        return "";
+        m_path = m_notebook->getPath();
+        m_relativePath = "";
     }
+
+    m_pathGeneration = s_pathGeneration;
 }
 
 QJsonObject VDirectory::toConfigJson() const
@@ -150,7 +162,7 @@ bool VDirectory::readConfig()
     return true;
 }
 
-bool VDirectory::writeToConfig() const
+QJsonObject VDirectory::toFullConfigJson() const
 {
     QJsonObject json = toConfigJson();
 
@@ -159,13 +171,26 @@ bool VDirectory::writeToConfig() const
         addNotebookConfig(json);
     }
 
+    return json;
+}
+
+bool VDirectory::writeToConfig() const
+{
+    QJsonObject json = toFullConfigJson();
     qDebug() << "folder" << m_name << "write to config" << json;
     return writeToConfig(json);
 }
 
+void VDirectory::queueWriteToConfig() const
+{
+    QJsonObject json = toFullConfigJson();
+    qDebug() << "folder" << m_name << "queue write to config" << json;
+    m_notebook->getIndex()->queueDirectoryConfig(fetchPath(), json);
+}
+
 bool VDirectory::writeToConfig(const QJsonObject &p_json) const
 {
-    return VConfigManager::writeDirectoryConfig(fetchPath(), p_json);
+    return m_notebook->getIndex()->writeDirectoryConfig(fetchPath(), p_json);
 }
 
 void VDirectory::addNotebookConfig(QJsonObject &p_json) const
@@ -209,9 +234,12 @@ VDirectory *VDirectory::createSubDirectory(const QString &p_name)
     }
 
     m_subDirs.append(ret);
+    m_subDirIndex.insert(p_name, ret);
     if (!writeToConfig()) {
+        g_configWriteQueue->discard(QDir(path).filePath(p_name));
         VConfigManager::deleteDirectoryConfig(QDir(path).filePath(p_name));
         dir.rmdir(p_name);
+        m_subDirIndex.remove(p_name, ret);
         delete ret;
         m_subDirs.removeLast();
 
@@ -227,14 +255,7 @@ VDirectory *VDirectory::findSubDirectory(const QString &p_name, bool p_caseSensi
         return NULL;
     }
 
-    QString name = p_caseSensitive ? p_name : p_name.toLower();
-    for (int i = 0; i < m_subDirs.size(); ++i) {
-        if (name == (p_caseSensitive ? m_subDirs[i]->getName() : m_subDirs[i]->getName().toLower())) {
-            return m_subDirs[i];
-        }
-    }
-
-    return NULL;
+    return m_subDirIndex.find(p_name, p_caseSensitive);
 }
 
 VFile *VDirectory::findFile(const QString &p_name, bool p_caseSensitive)
@@ -243,14 +264,7 @@ VFile *VDirectory::findFile(const QString &p_name, bool p_caseSensitive)
         return NULL;
     }
 
-    QString name = p_caseSensitive ? p_name : p_name.toLower();
-    for (int i = 0; i < m_files.size(); ++i) {
-        if (name == (p_caseSensitive ? m_files[i]->getName() : m_files[i]->getName().toLower())) {
-            return m_files[i];
-        }
-    }
-
-    return NULL;
+    return m_fileIndex.find(p_name, p_caseSensitive);
 }
 
 bool VDirectory::containsFile(const VFile *p_file) const
@@ -295,8 +309,10 @@ VFile *VDirectory::createFile(const QString &p_name)
                            dateTime,
                            dateTime);
     m_files.append(ret);
+    m_fileIndex.insert(p_name, ret);
     if (!writeToConfig()) {
         file.remove();
+        m_fileIndex.remove(p_name, ret);
         delete ret;
         m_files.removeLast();
         return NULL;
@@ -319,6 +335,8 @@ bool VDirectory::addFile(VFile *p_file, int p_index)
         m_files.insert(p_index, p_file);
     }
 
+    m_fileIndex.insert(p_file->getName(), p_file);
+
     if (!writeToConfig()) {
         if (p_index == -1) {
             m_files.removeLast();
@@ -326,10 +344,12 @@ bool VDirectory::addFile(VFile *p_file, int p_index)
             m_files.remove(p_index);
         }
 
+        m_fileIndex.remove(p_file->getName(), p_file);
         return false;
     }
 
     p_file->setParent(this);
+    invalidatePaths();
 
     qDebug() << "note" << p_file->getName() << "added to folder" << m_name;
 
@@ -361,57 +381,6 @@ VFile *VDirectory::addFile(const QString &p_name, int p_index)
     return file;
 }
 
-bool VDirectory::addSubDirectory(VDirectory *p_dir, int p_index)
-{
-    if (!open()) {
-        return false;
-    }
-
-    if (p_index == -1) {
-        m_subDirs.append(p_dir);
-    } else {
-        m_subDirs.insert(p_index, p_dir);
-    }
-
-    if (!writeToConfig()) {
-        if (p_index == -1) {
-            m_subDirs.removeLast();
-        } else {
-            m_subDirs.remove(p_index);
-        }
-
-        return false;
-    }
-
-    p_dir->setParent(this);
-
-    qDebug() << "folder" << p_dir->getName() << "added to folder" << m_name;
-
-    return true;
-}
-
-VDirectory *VDirectory::addSubDirectory(const QString &p_name, int p_index)
-{
-    if (!open()) {
-        return NULL;
-    }
-
-    VDirectory *dir = new VDirectory(m_notebook,
-                                     p_name,
-                                     this,
-                                     QDateTime::currentDateTimeUtc());
-    if (!dir) {
-        return NULL;
-    }
-
-    if (!addSubDirectory(dir, p_index)) {
-        delete dir;
-        return NULL;
-    }
-
-    return dir;
-}
-
 void VDirectory::deleteSubDirectory(VDirectory *p_subDir, bool p_skipRecycleBin)
 {
     Q_ASSERT(p_subDir->getNotebook() == m_notebook);
@@ -422,6 +391,13 @@ void VDirectory::deleteSubDirectory(VDirectory *p_subDir, bool p_skipRecycleBin)
 
     removeSubDirectory(p_subDir);
 
+    m_notebook->getIndex()->remove(dirPath);
+
+    // Configs in the recycle bin should be up to date. Those failed to be
+    // written are dropped with the directory.
+    g_configWriteQueue->flush();
+    g_configWriteQueue->discard(dirPath);
+
     // Delete the entire directory.
     if (!VUtils::deleteDirectory(m_notebook, dirPath, p_skipRecycleBin)) {
         qWarning() << "fail to remove directory" << dirPath << "recursively";
@@ -440,6 +416,7 @@ bool VDirectory::removeSubDirectory(VDirectory *p_dir)
     int index = m_subDirs.indexOf(p_dir);
     V_ASSERT(index != -1);
     m_subDirs.remove(index);
+    m_subDirIndex.remove(p_dir->getName(), p_dir);
 
     if (!writeToConfig()) {
         return false;
@@ -458,6 +435,7 @@ bool VDirectory::removeFile(VFile *p_file)
     int index = m_files.indexOf(p_file);
     V_ASSERT(index != -1);
     m_files.remove(index);
+    m_fileIndex.remove(p_file->getName(), p_file);
 
     if (!writeToConfig()) {
         return false;
@@ -491,6 +469,13 @@ bool VDirectory::rename(const QString &p_name)
 
     VDirectory *parentDir = getParentDirectory();
     V_ASSERT(parentDir);
+
+    // Pending writes are keyed by the path.
+    if (!g_configWriteQueue->flush()) {
+        qWarning() << "fail to rename folder" << m_name << "with configs not written";
+        return false;
+    }
+
     // Rename it in disk.
     QDir dir(parentDir->fetchPath());
     if (!dir.rename(m_name, p_name)) {
@@ -498,11 +483,17 @@ bool VDirectory::rename(const QString &p_name)
         return false;
     }
 
+    m_notebook->getIndex()->remove(dir.filePath(oldName));
+
     m_name = p_name;
+    invalidatePaths();
+    parentDir->subDirectoryRenamed(this, oldName);
 
     // Update parent's config file
     if (!parentDir->writeToConfig()) {
         m_name = oldName;
+        invalidatePaths();
+        parentDir->subDirectoryRenamed(this, p_name);
         dir.rename(p_name, m_name);
         return false;
     }
@@ -512,163 +503,429 @@ bool VDirectory::rename(const QString &p_name)
     return true;
 }
 
-VFile *VDirectory::copyFile(VDirectory *p_destDir, const QString &p_destName,
-                            VFile *p_srcFile, bool p_cut)
+void VDirectory::fileRenamed(VFile *p_file, const QString &p_oldName)
 {
-    QString srcPath = QDir::cleanPath(p_srcFile->fetchPath());
-    QString destPath = QDir::cleanPath(QDir(p_destDir->fetchPath()).filePath(p_destName));
-    if (VUtils::equalPath(srcPath, destPath)) {
-        return p_srcFile;
-    }
+    m_fileIndex.remove(p_oldName, p_file);
+    m_fileIndex.insert(p_file->getName(), p_file);
+}
+
+void VDirectory::subDirectoryRenamed(VDirectory *p_dir, const QString &p_oldName)
+{
+    m_subDirIndex.remove(p_oldName, p_dir);
+    m_subDirIndex.insert(p_dir->getName(), p_dir);
+}
+
+QVector<VFile *> VDirectory::copyFiles(VDirectory *p_destDir, const QStringList &p_destNames,
+                                       const QVector<VFile *> &p_srcFiles, bool p_cut)
+{
+    Q_ASSERT(p_destNames.size() == p_srcFiles.size());
+    QVector<VFile *> destFiles(p_srcFiles.size(), NULL);
+    if (!p_destDir->open()) {
+        return destFiles;
+    }
+
+    // Files copied in the disk.
+    struct CopiedFile
+    {
+        int m_index;
+        VDirectory *m_srcDir;
+        QString m_srcName;
+        QString m_srcPath;
+        QString m_destPath;
+        QVector<ImageLink> m_images;
+    };
+
+    QVector<CopiedFile> copied;
+    QString destDirPath = p_destDir->fetchPath();
+    for (int i = 0; i < p_srcFiles.size(); ++i) {
+        VFile *srcFile = p_srcFiles[i];
+        QString srcPath = QDir::cleanPath(srcFile->fetchPath());
+        QString destPath = QDir::cleanPath(QDir(destDirPath).filePath(p_destNames[i]));
+        if (VUtils::equalPath(srcPath, destPath)) {
+            destFiles[i] = srcFile;
+            continue;
+        }
+
+        // DocType is not allowed to change.
+        Q_ASSERT(srcFile->getDocType() == VUtils::docTypeFromName(destPath));
+
+        CopiedFile file;
+        file.m_index = i;
+        file.m_srcDir = srcFile->getDirectory();
+        file.m_srcName = srcFile->getName();
+        file.m_srcPath = srcPath;
+        file.m_destPath = destPath;
+        if (srcFile->getDocType() == DocType::Markdown) {
+            file.m_images = VUtils::fetchImagesFromMarkdownFile(srcFile,
+                                                                ImageLink::LocalRelativeInternal);
+        }
 
-    VDirectory *srcDir = p_srcFile->getDirectory();
-    DocType docType = p_srcFile->getDocType();
-    DocType newDocType = VUtils::docTypeFromName(destPath);
+        if (!VUtils::copyFile(srcPath, destPath, p_cut)) {
+            continue;
+        }
 
-    QVector<ImageLink> images;
-    if (docType == DocType::Markdown) {
-        images = VUtils::fetchImagesFromMarkdownFile(p_srcFile,
-                                                     ImageLink::LocalRelativeInternal);
+        copied.append(file);
     }
 
-    // Copy the file
-    if (!VUtils::copyFile(srcPath, destPath, p_cut)) {
-        return NULL;
+    if (copied.isEmpty()) {
+        return destFiles;
     }
 
-    // Handle VDirectory and VFile
-    int index = -1;
-    VFile *destFile = NULL;
+    // Affected directories with their files before the copy.
+    QVector<VDirectory *> dirs;
+    QVector<QVector<VFile *>> oldFiles;
+    dirs.append(p_destDir);
+    oldFiles.append(p_destDir->m_files);
     if (p_cut) {
-        // Remove the file from config
-        srcDir->removeFile(p_srcFile);
-
-        p_srcFile->setName(p_destName);
+        for (int i = 0; i < copied.size(); ++i) {
+            VDirectory *srcDir = copied[i].m_srcDir;
+            if (!dirs.contains(srcDir)) {
+                dirs.append(srcDir);
+                oldFiles.append(srcDir->m_files);
+            }
+        }
+    }
 
-        // Add the file to new dir's config
-        if (p_destDir->addFile(p_srcFile, index)) {
-            destFile = p_srcFile;
+    // Update m_files and the name indexes.
+    QDateTime dateTime = QDateTime::currentDateTimeUtc();
+    for (int i = 0; i < copied.size(); ++i) {
+        const CopiedFile &file = copied[i];
+        const QString &destName = p_destNames[file.m_index];
+        VFile *destFile = NULL;
+        if (p_cut) {
+            destFile = p_srcFiles[file.m_index];
+            VDirectory *srcDir = file.m_srcDir;
+            srcDir->m_files.remove(srcDir->m_files.indexOf(destFile));
+            srcDir->m_fileIndex.remove(file.m_srcName, destFile);
+
+            destFile->setName(destName);
+            destFile->setParent(p_destDir);
         } else {
-            destFile = NULL;
+            destFile = new VFile(p_destDir,
+                                 destName,
+                                 FileType::Normal,
+                                 true,
+                                 dateTime,
+                                 dateTime);
         }
-    } else {
-        destFile = p_destDir->addFile(p_destName, -1);
+
+        p_destDir->m_files.append(destFile);
+        p_destDir->m_fileIndex.insert(destName, destFile);
+        destFiles[file.m_index] = destFile;
     }
 
-    if (!destFile) {
-        return NULL;
+    invalidatePaths();
+
+    // Write the config of each directory once instead of once per file.
+    int nrRequests = p_cut ? copied.size() * 2 : copied.size();
+    g_configWriteQueue->countCoalesced(nrRequests - dirs.size());
+
+    int nrWritten = 0;
+    for (; nrWritten < dirs.size(); ++nrWritten) {
+        if (!dirs[nrWritten]->writeToConfig()) {
+            break;
+        }
     }
 
-    Q_ASSERT(docType == newDocType);
+    if (nrWritten < dirs.size()) {
+        qWarning() << "fail to write config of folder" << dirs[nrWritten]->getName()
+                   << ", roll back" << copied.size() << "notes";
+
+        for (int i = 0; i < copied.size(); ++i) {
+            const CopiedFile &file = copied[i];
+            if (p_cut) {
+                VFile *srcFile = p_srcFiles[file.m_index];
+                srcFile->setName(file.m_srcName);
+                srcFile->setParent(file.m_srcDir);
+                VUtils::copyFile(file.m_destPath, file.m_srcPath, true);
+            } else {
+                QFile::remove(file.m_destPath);
+            }
+        }
+
+        for (int i = 0; i < dirs.size(); ++i) {
+            dirs[i]->resetFiles(oldFiles[i]);
+        }
+
+        invalidatePaths();
+
+        for (int i = 0; i < copied.size(); ++i) {
+            int idx = copied[i].m_index;
+            if (!p_cut) {
+                delete destFiles[idx];
+            }
+
+            destFiles[idx] = NULL;
+        }
+
+        // Restore the configs already written.
+        for (int i = 0; i < nrWritten; ++i) {
+            dirs[i]->writeToConfig();
+        }
+
+        return destFiles;
+    }
 
     // We need to copy internal images when it is still markdown.
-    if (!images.isEmpty()) {
-        if (newDocType == DocType::Markdown) {
-            QString parentPath = destFile->fetchBasePath();
-            int nrPasted = 0;
-            for (int i = 0; i < images.size(); ++i) {
-                const ImageLink &link = images[i];
-                if (!QFileInfo::exists(link.m_path)) {
-                    continue;
-                }
+    for (int i = 0; i < copied.size(); ++i) {
+        const CopiedFile &file = copied[i];
+        if (!file.m_images.isEmpty()) {
+            copyFileImages(destFiles[file.m_index], file.m_srcPath, file.m_images, p_cut);
+        }
+    }
 
-                QString errStr;
-                bool ret = true;
+    qDebug() << (p_cut ? "cut" : "copy") << copied.size() << "notes to folder"
+             << p_destDir->getName() << "with" << dirs.size() << "config writes";
 
-                QString imageFolder = VUtils::directoryNameFromPath(VUtils::basePathFromPath(link.m_path));
-                QString destImagePath = QDir(parentPath).filePath(imageFolder);
-                ret = VUtils::makePath(destImagePath);
-                if (!ret) {
-                    errStr = tr("Fail to create image folder <span style=\"%1\">%2</span>.")
-                               .arg(g_config->c_dataTextStyle).arg(destImagePath);
+    return destFiles;
+}
+
+void VDirectory::copyFileImages(VFile *p_destFile, const QString &p_srcPath,
+                                const QVector<ImageLink> &p_images, bool p_cut)
+{
+    if (p_destFile->getDocType() == DocType::Markdown) {
+        QString parentPath = p_destFile->fetchBasePath();
+        int nrPasted = 0;
+        for (int i = 0; i < p_images.size(); ++i) {
+            const ImageLink &link = p_images[i];
+            if (!QFileInfo::exists(link.m_path)) {
+                continue;
+            }
+
+            QString errStr;
+            bool ret = true;
+
+            QString imageFolder = VUtils::directoryNameFromPath(VUtils::basePathFromPath(link.m_path));
+            QString destImagePath = QDir(parentPath).filePath(imageFolder);
+            ret = VUtils::makePath(destImagePath);
+            if (!ret) {
+                errStr = tr("Fail to create image folder <span style=\"%1\">%2</span>.")
+                           .arg(g_config->c_dataTextStyle).arg(destImagePath);
+            } else {
+                destImagePath = QDir(destImagePath).filePath(VUtils::fileNameFromPath(link.m_path));
+
+                // Copy or Cut the images accordingly.
+                if (VUtils::equalPath(destImagePath, link.m_path)) {
+                    ret = false;
                 } else {
-                    destImagePath = QDir(destImagePath).filePath(VUtils::fileNameFromPath(link.m_path));
-
-                    // Copy or Cut the images accordingly.
-                    if (VUtils::equalPath(destImagePath, link.m_path)) {
-                        ret = false;
-                    } else {
-                        ret = VUtils::copyFile(link.m_path, destImagePath, p_cut);
-                    }
-
-                    if (ret) {
-                        qDebug() << (p_cut ? "Cut" : "Copy") << "image"
-                                 << link.m_path << "->" << destImagePath;
-
-                        nrPasted++;
-                    } else {
-                        errStr = tr("Please check if there already exists a file <span style=\"%1\">%2</span> "
-                                    "and then manually copy it and modify the note accordingly.")
-                                   .arg(g_config->c_dataTextStyle).arg(destImagePath);
-                    }
+                    ret = VUtils::copyFile(link.m_path, destImagePath, p_cut);
                 }
 
-                if (!ret) {
-                    VUtils::showMessage(QMessageBox::Warning, tr("Warning"),
-                                        tr("Fail to copy image <span style=\"%1\">%2</span> while "
-                                           "%5 note <span style=\"%3\">%4</span>.")
-                                          .arg(g_config->c_dataTextStyle).arg(link.m_path)
-                                          .arg(g_config->c_dataTextStyle).arg(srcPath)
-                                          .arg(p_cut ? tr("moving") : tr("copying")),
-                                        errStr, QMessageBox::Ok, QMessageBox::Ok, NULL);
+                if (ret) {
+                    qDebug() << (p_cut ? "Cut" : "Copy") << "image"
+                             << link.m_path << "->" << destImagePath;
+
+                    nrPasted++;
+                } else {
+                    errStr = tr("Please check if there already exists a file <span style=\"%1\">%2</span> "
+                                "and then manually copy it and modify the note accordingly.")
+                               .arg(g_config->c_dataTextStyle).arg(destImagePath);
                 }
             }
 
-            qDebug() << "pasted" << nrPasted << "images";
-        } else {
-            // Delete the images.
-            int deleted = 0;
-            for (int i = 0; i < images.size(); ++i) {
-                QFile file(images[i].m_path);
-                if (file.remove()) {
-                    ++deleted;
-                }
+            if (!ret) {
+                VUtils::showMessage(QMessageBox::Warning, tr("Warning"),
+                                    tr("Fail to copy image <span style=\"%1\">%2</span> while "
+                                       "%5 note <span style=\"%3\">%4</span>.")
+                                      .arg(g_config->c_dataTextStyle).arg(link.m_path)
+                                      .arg(g_config->c_dataTextStyle).arg(p_srcPath)
+                                      .arg(p_cut ? tr("moving") : tr("copying")),
+                                    errStr, QMessageBox::Ok, QMessageBox::Ok, NULL);
             }
+        }
 
-            qDebug() << "delete" << deleted << "images since it is not Markdown any more for" << srcPath;
+        qDebug() << "pasted" << nrPasted << "images";
+    } else {
+        // Delete the images.
+        int deleted = 0;
+        for (int i = 0; i < p_images.size(); ++i) {
+            QFile file(p_images[i].m_path);
+            if (file.remove()) {
+                ++deleted;
+            }
         }
-    }
 
-    return destFile;
+        qDebug() << "delete" << deleted << "images since it is not Markdown any more for" << p_srcPath;
+    }
 }
 
-// Copy @p_srcDir to be a sub-directory of @p_destDir with name @p_destName.
-VDirectory *VDirectory::copyDirectory(VDirectory *p_destDir, const QString &p_destName,
-                                      VDirectory *p_srcDir, bool p_cut)
+QVector<VDirectory *> VDirectory::copyDirectories(VDirectory *p_destDir,
+                                                  const QStringList &p_destNames,
+                                                  const QVector<VDirectory *> &p_srcDirs,
+                                                  bool p_cut)
 {
-    QString srcPath = QDir::cleanPath(p_srcDir->fetchPath());
-    QString destPath = QDir::cleanPath(QDir(p_destDir->fetchPath()).filePath(p_destName));
-    if (VUtils::equalPath(srcPath, destPath)) {
-        return p_srcDir;
-    }
+    Q_ASSERT(p_destNames.size() == p_srcDirs.size());
+    QVector<VDirectory *> destDirs(p_srcDirs.size(), NULL);
+    if (!p_destDir->open()) {
+        return destDirs;
+    }
+
+    // Copy the directories with their configs up to date.
+    if (!g_configWriteQueue->flush()) {
+        qWarning() << "fail to copy folders with configs not written";
+        return destDirs;
+    }
+
+    // Directories copied in the disk.
+    struct CopiedDirectory
+    {
+        int m_index;
+        VDirectory *m_srcParentDir;
+        QString m_srcName;
+        QString m_srcPath;
+        QString m_destPath;
+    };
+
+    QVector<CopiedDirectory> copied;
+    QString destDirPath = p_destDir->fetchPath();
+    for (int i = 0; i < p_srcDirs.size(); ++i) {
+        VDirectory *srcDir = p_srcDirs[i];
+        QString srcPath = QDir::cleanPath(srcDir->fetchPath());
+        QString destPath = QDir::cleanPath(QDir(destDirPath).filePath(p_destNames[i]));
+        if (VUtils::equalPath(srcPath, destPath)) {
+            destDirs[i] = srcDir;
+            continue;
+        }
 
-    VDirectory *srcParentDir = p_srcDir->getParentDirectory();
+        CopiedDirectory dir;
+        dir.m_index = i;
+        dir.m_srcParentDir = srcDir->getParentDirectory();
+        dir.m_srcName = srcDir->getName();
+        dir.m_srcPath = srcPath;
+        dir.m_destPath = destPath;
 
-    // Copy the directory
-    if (!VUtils::copyDirectory(srcPath, destPath, p_cut)) {
-        return NULL;
+        if (!VUtils::copyDirectory(srcPath, destPath, p_cut)) {
+            continue;
+        }
+
+        copied.append(dir);
     }
 
-    // Handle VDirectory
-    int index = -1;
-    VDirectory *destDir = NULL;
-    if (p_cut) {
-        // Remove the directory from config
-        srcParentDir->removeSubDirectory(p_srcDir);
+    if (copied.isEmpty()) {
+        return destDirs;
+    }
 
-        p_srcDir->setName(p_destName);
+    // Affected directories with their sub-directories before the copy.
+    QVector<VDirectory *> dirs;
+    QVector<QVector<VDirectory *>> oldSubDirs;
+    dirs.append(p_destDir);
+    oldSubDirs.append(p_destDir->m_subDirs);
+    if (p_cut) {
+        for (int i = 0; i < copied.size(); ++i) {
+            VDirectory *srcParentDir = copied[i].m_srcParentDir;
+            if (!dirs.contains(srcParentDir)) {
+                dirs.append(srcParentDir);
+                oldSubDirs.append(srcParentDir->m_subDirs);
+            }
+        }
+    }
 
-        // Add the directory to new dir's config
-        if (p_destDir->addSubDirectory(p_srcDir, index)) {
-            destDir = p_srcDir;
+    // Update m_subDirs and the name indexes.
+    QDateTime dateTime = QDateTime::currentDateTimeUtc();
+    for (int i = 0; i < copied.size(); ++i) {
+        const CopiedDirectory &dir = copied[i];
+        const QString &destName = p_destNames[dir.m_index];
+        VDirectory *destDir = NULL;
+        if (p_cut) {
+            destDir = p_srcDirs[dir.m_index];
+            VDirectory *srcParentDir = dir.m_srcParentDir;
+            srcParentDir->m_subDirs.remove(srcParentDir->m_subDirs.indexOf(destDir));
+            srcParentDir->m_subDirIndex.remove(dir.m_srcName, destDir);
+
+            destDir->setName(destName);
+            destDir->setParent(p_destDir);
         } else {
-            destDir = NULL;
+            destDir = new VDirectory(p_destDir->m_notebook,
+                                     destName,
+                                     p_destDir,
+                                     dateTime);
         }
-    } else {
-        destDir = p_destDir->addSubDirectory(p_destName, -1);
+
+        p_destDir->m_subDirs.append(destDir);
+        p_destDir->m_subDirIndex.insert(destName, destDir);
+        destDirs[dir.m_index] = destDir;
+    }
+
+    invalidatePaths();
+
+    // Write the config of each directory once instead of once per folder.
+    int nrRequests = p_cut ? copied.size() * 2 : copied.size();
+    g_configWriteQueue->countCoalesced(nrRequests - dirs.size());
+
+    int nrWritten = 0;
+    for (; nrWritten < dirs.size(); ++nrWritten) {
+        if (!dirs[nrWritten]->writeToConfig()) {
+            break;
+        }
+    }
+
+    if (nrWritten < dirs.size()) {
+        qWarning() << "fail to write config of folder" << dirs[nrWritten]->getName()
+                   << ", roll back" << copied.size() << "folders";
+
+        for (int i = 0; i < copied.size(); ++i) {
+            const CopiedDirectory &dir = copied[i];
+            if (p_cut) {
+                VDirectory *srcDir = p_srcDirs[dir.m_index];
+                srcDir->setName(dir.m_srcName);
+                srcDir->setParent(dir.m_srcParentDir);
+                VUtils::copyDirectory(dir.m_destPath, dir.m_srcPath, true);
+            } else {
+                QDir(dir.m_destPath).removeRecursively();
+            }
+        }
+
+        for (int i = 0; i < dirs.size(); ++i) {
+            dirs[i]->resetSubDirectories(oldSubDirs[i]);
+        }
+
+        invalidatePaths();
+
+        for (int i = 0; i < copied.size(); ++i) {
+            int idx = copied[i].m_index;
+            if (!p_cut) {
+                delete destDirs[idx];
+            }
+
+            destDirs[idx] = NULL;
+        }
+
+        // Restore the configs already written.
+        for (int i = 0; i < nrWritten; ++i) {
+            dirs[i]->writeToConfig();
+        }
+
+        return destDirs;
+    }
+
+    if (p_cut) {
+        for (int i = 0; i < copied.size(); ++i) {
+            p_destDir->m_notebook->getIndex()->remove(copied[i].m_srcPath);
+        }
+    }
+
+    qDebug() << (p_cut ? "cut" : "copy") << copied.size() << "folders to folder"
+             << p_destDir->getName() << "with" << dirs.size() << "config writes";
+
+    return destDirs;
+}
+
+void VDirectory::resetFiles(const QVector<VFile *> &p_files)
+{
+    m_files = p_files;
+    m_fileIndex.clear();
+    for (int i = 0; i < m_files.size(); ++i) {
+        m_fileIndex.insert(m_files[i]->getName(), m_files[i]);
     }
+}
 
-    return destDir;
+void VDirectory::resetSubDirectories(const QVector<VDirectory *> &p_dirs)
+{
+    m_subDirs = p_dirs;
+    m_subDirIndex.clear();
+    for (int i = 0; i < m_subDirs.size(); ++i) {
+        m_subDirIndex.insert(m_subDirs[i]->getName(), m_subDirs[i]);
+    }
 }
 
 void VDirectory::setExpanded(bool p_expanded)
@@ -688,8 +945,6 @@ void VDirectory::reorderFiles(int p_first, int p_last, int p_destStart)
     V_ASSERT(p_destStart < p_first || p_destStart > p_last);
     V_ASSERT(p_destStart >= 0 && p_destStart <= m_files.size());
 
-    auto oriFiles = m_files;
-
     // Reorder m_files.
     if (p_destStart > p_last) {
         int to = p_destStart - 1;
@@ -704,10 +959,8 @@ void VDirectory::reorderFiles(int p_first, int p_last, int p_destStart)
         }
     }
 
-    if (!writeToConfig()) {
-        qWarning() << "fail to reorder files in config" << p_first << p_last << p_destStart;
-        m_files = oriFiles;
-    }
+    // Failures of the queued write are reported by the write queue.
+    queueWriteToConfig();
 }
 
 VFile *VDirectory::tryLoadFile(QStringList &p_filePath)
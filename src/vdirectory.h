@@ -3,13 +3,16 @@
 
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QVector>
 #include <QPointer>
 #include <QJsonObject>
 #include <QDateTime>
 #include "vnotebook.h"
+#include "vnameindex.h"
 
 class VFile;
+struct ImageLink;
 
 class VDirectory : public QObject
 {
@@ -21,6 +24,10 @@ public:
                QDateTime p_createdTimeUtc = QDateTime());
 
     bool open();
+
+    // Open with the config already read from the directory config file.
+    bool open(const QJsonObject &p_configJson);
+
     void close();
     VDirectory *createSubDirectory(const QString &p_name);
 
@@ -57,14 +64,20 @@ public:
     // Rename current directory to @p_name.
     bool rename(const QString &p_name);
 
-    // Copy @p_srcFile to @p_destDir, setting new name to @p_destName.
+    // Copy @p_srcFiles to @p_destDir, setting new names to @p_destNames.
+    // All the files are copied in the disk first, then the config of each
+    // affected directory is written once. If any of them fails, all the files
+    // are restored.
     // @p_cut: copy or cut.
-    // Returns the dest VFile.
-    static VFile *copyFile(VDirectory *p_destDir, const QString &p_destName,
-                           VFile *p_srcFile, bool p_cut);
+    // Returns the dest VFiles, NULL for those failed to be copied.
+    static QVector<VFile *> copyFiles(VDirectory *p_destDir, const QStringList &p_destNames,
+                                      const QVector<VFile *> &p_srcFiles, bool p_cut);
 
-    static VDirectory *copyDirectory(VDirectory *p_destDir, const QString &p_destName,
-                                     VDirectory *p_srcDir, bool p_cut);
+    // Copy @p_srcDirs to be sub-directories of @p_destDir like copyFiles().
+    static QVector<VDirectory *> copyDirectories(VDirectory *p_destDir,
+                                                 const QStringList &p_destNames,
+                                                 const QVector<VDirectory *> &p_srcDirs,
+                                                 bool p_cut);
 
     const QVector<VDirectory *> &getSubDirs() const;
     const QString &getName() const;
@@ -96,16 +109,29 @@ public:
     // notebook.
     bool writeToConfig() const;
 
+    // Queue a write of current instance to config file for changes not
+    // touching the disk, such as reordering.
+    void queueWriteToConfig() const;
+
     // Try to load file given relative path @p_filePath.
     VFile *tryLoadFile(QStringList &p_filePath);
 
     QDateTime getCreatedTimeUtc() const;
 
+    // Invalidate the cached paths of all the directories and files.
+    // Should be called when any directory or file is renamed or moved.
+    static void invalidatePaths();
+
+    // Cached paths are valid only if computed in current generation.
+    static quint64 pathGeneration();
+
 private:
-    // Get the path of @p_dir recursively
-    QString fetchPath(const VDirectory *p_dir) const;
-    // Get teh relative path of @p_dir recursively related to the notebook path
-    QString fetchRelativePath(const VDirectory *p_dir) const;
+    // Compute the paths of this directory if the cached ones are invalid.
+    void updatePaths() const;
+
+    // Config of current instance, including the notebook part of the root
+    // directory.
+    QJsonObject toFullConfigJson() const;
 
     // Write @p_json to config.
     bool writeToConfig(const QJsonObject &p_json) const;
@@ -117,12 +143,22 @@ private:
     // Add the file in the config and m_files. If @p_index is -1, add it at the end.
     bool addFile(VFile *p_file, int p_index);
 
-    // Add the directory in the config and m_subDirs. If @p_index is -1, add it at the end.
-    // Return the VDirectory if succeed.
-    VDirectory *addSubDirectory(const QString &p_name, int p_index);
+    // Set m_files to @p_files and rebuild the name index.
+    void resetFiles(const QVector<VFile *> &p_files);
+
+    // Set m_subDirs to @p_dirs and rebuild the name index.
+    void resetSubDirectories(const QVector<VDirectory *> &p_dirs);
+
+    // Copy or cut the internal images @p_images of note @p_srcPath for the
+    // copied note @p_destFile.
+    static void copyFileImages(VFile *p_destFile, const QString &p_srcPath,
+                               const QVector<ImageLink> &p_images, bool p_cut);
 
-    // Add the directory in the config and m_subDirs. If @p_index is -1, add it at the end.
-    bool addSubDirectory(VDirectory *p_dir, int p_index);
+    // Update the name index after @p_file in this directory is renamed from @p_oldName.
+    void fileRenamed(VFile *p_file, const QString &p_oldName);
+
+    // Update the name index after @p_dir in this directory is renamed from @p_oldName.
+    void subDirectoryRenamed(VDirectory *p_dir, const QString &p_oldName);
 
     // Notebook containing this folder.
     QPointer<VNotebook> m_notebook;
@@ -136,6 +172,10 @@ private:
     // Owner of the files
     QVector<VFile *> m_files;
 
+    // Name indexes of m_subDirs and m_files.
+    VNameIndex<VDirectory> m_subDirIndex;
+    VNameIndex<VFile> m_fileIndex;
+
     // Whether the directory has been opened.
     bool m_opened;
 
@@ -145,6 +185,16 @@ private:
     // UTC time when creating this directory.
     // Loaded after open().
     QDateTime m_createdTimeUtc;
+
+    // Cached absolute path and path relative to the notebook.
+    mutable QString m_path;
+    mutable QString m_relativePath;
+
+    // Path generation when computing the cached paths.
+    mutable quint64 m_pathGeneration;
+
+    // Only accessed in the GUI thread.
+    static quint64 s_pathGeneration;
 };
 
 inline const QVector<VDirectory *> &VDirectory::getSubDirs() const
@@ -160,6 +210,7 @@ inline const QString &VDirectory::getName() const
 inline void VDirectory::setName(const QString &p_name)
 {
     m_name = p_name;
+    invalidatePaths();
 }
 
 inline bool VDirectory::isOpened() const
@@ -199,12 +250,24 @@ inline const VNotebook *VDirectory::getNotebook() const
 
 inline QString VDirectory::fetchPath() const
 {
-    return fetchPath(this);
+    updatePaths();
+    return m_path;
 }
 
 inline QString VDirectory::fetchRelativePath() const
 {
-    return fetchRelativePath(this);
+    updatePaths();
+    return m_relativePath;
+}
+
+inline void VDirectory::invalidatePaths()
+{
+    ++s_pathGeneration;
+}
+
+inline quint64 VDirectory::pathGeneration()
+{
+    return s_pathGeneration;
 }
 
 inline bool VDirectory::isExpanded() const
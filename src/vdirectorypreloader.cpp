@@ -0,0 +1,174 @@
+#include "vdirectorypreloader.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QJsonDocument>
+#include "vdirectory.h"
+#include "vnotebook.h"
+#include "vnotebookindex.h"
+#include "vconfigmanager.h"
+#include "vconfigwritequeue.h"
+
+extern VConfigWriteQueue *g_configWriteQueue;
+
+// Max number of config files read at the same time.
+static const int c_maxLoaderThreads = 4;
+
+VDirectoryConfigLoader::VDirectoryConfigLoader(const QString &p_path)
+    : QObject(), QRunnable(), m_path(p_path)
+{
+    setAutoDelete(true);
+}
+
+void VDirectoryConfigLoader::run()
+{
+    // Do not rename the obsolete config file here. Leave it to VDirectory::open().
+    QString configFile = VConfigManager::getDirConfigFilePath(m_path);
+    QFileInfo info(configFile);
+    QFile file(configFile);
+    if (!info.exists() || !file.open(QIODevice::ReadOnly)) {
+        emit configLoaded(m_path, QJsonObject(), 0, 0);
+        return;
+    }
+
+    QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+    emit configLoaded(m_path, json, info.lastModified().toMSecsSinceEpoch(), info.size());
+}
+
+VDirectoryPreloader::VDirectoryPreloader(QObject *p_parent)
+    : QObject(p_parent), m_nrRunning(0)
+{
+    m_pool.setMaxThreadCount(c_maxLoaderThreads);
+}
+
+VDirectoryPreloader::~VDirectoryPreloader()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+void VDirectoryPreloader::cancel()
+{
+    m_queue.clear();
+    m_pendingLoads.clear();
+}
+
+void VDirectoryPreloader::preload(VDirectory *p_dir, int p_depth, int p_priority)
+{
+    if (!p_dir || p_depth <= 0) {
+        return;
+    }
+
+    if (p_dir->isOpened()) {
+        for (auto subDir : p_dir->getSubDirs()) {
+            preload(subDir, p_depth - 1, p_priority - 1);
+        }
+
+        return;
+    }
+
+    QString path = p_dir->fetchPath();
+    auto it = m_pendingLoads.find(path);
+    if (it != m_pendingLoads.end()) {
+        // Reuse the pending load, which may be requested by a closed directory.
+        PendingLoad &load = it.value();
+        load.m_dir = p_dir;
+        load.m_depth = qMax(load.m_depth, p_depth);
+        if (p_priority > load.m_priority) {
+            if (!load.m_started) {
+                m_queue.remove(-load.m_priority, path);
+                m_queue.insert(-p_priority, path);
+            }
+
+            load.m_priority = p_priority;
+        }
+
+        return;
+    }
+
+    PendingLoad load;
+    load.m_dir = p_dir;
+    load.m_depth = p_depth;
+    load.m_priority = p_priority;
+    m_pendingLoads.insert(path, load);
+    m_queue.insert(-p_priority, path);
+
+    startLoads();
+}
+
+void VDirectoryPreloader::startLoads()
+{
+    while (m_nrRunning < c_maxLoaderThreads && !m_queue.isEmpty()) {
+        QString path = m_queue.first();
+        m_queue.erase(m_queue.begin());
+
+        auto it = m_pendingLoads.find(path);
+        Q_ASSERT(it != m_pendingLoads.end());
+        it->m_started = true;
+
+        ++m_nrRunning;
+        VDirectoryConfigLoader *loader = new VDirectoryConfigLoader(path);
+        connect(loader, &VDirectoryConfigLoader::configLoaded,
+                this, &VDirectoryPreloader::handleConfigLoaded);
+        m_pool.start(loader);
+    }
+}
+
+void VDirectoryPreloader::handleConfigLoaded(const QString &p_path,
+                                             const QJsonObject &p_json,
+                                             qint64 p_modifiedTime,
+                                             qint64 p_size)
+{
+    --m_nrRunning;
+
+    openDirectory(p_path, p_json, p_modifiedTime, p_size);
+
+    startLoads();
+}
+
+void VDirectoryPreloader::openDirectory(const QString &p_path,
+                                        const QJsonObject &p_json,
+                                        qint64 p_modifiedTime,
+                                        qint64 p_size)
+{
+    auto it = m_pendingLoads.find(p_path);
+    if (it == m_pendingLoads.end() || !it->m_started) {
+        // Cancelled.
+        return;
+    }
+
+    PendingLoad load = it.value();
+    m_pendingLoads.erase(it);
+
+    VDirectory *dir = load.m_dir;
+    if (!dir) {
+        return;
+    }
+
+    if (!dir->isOpened()) {
+        // The directory may be renamed or moved during loading.
+        if (p_json.isEmpty() || dir->fetchPath() != p_path) {
+            return;
+        }
+
+        // The config file is out of date if there is a pending write.
+        QJsonObject json;
+        if (!g_configWriteQueue->pendingConfig(p_path, json)) {
+            json = p_json;
+            VNotebookIndex *index = dir->getNotebook()->getIndex();
+            index->addDirectoryConfig(p_path, json, p_modifiedTime, p_size);
+        }
+
+        if (!dir->open(json)) {
+            return;
+        }
+
+        qDebug() << "preload folder" << p_path;
+    }
+
+    for (auto subDir : dir->getSubDirs()) {
+        preload(subDir, load.m_depth - 1, load.m_priority - 1);
+    }
+}
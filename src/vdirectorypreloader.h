@@ -0,0 +1,108 @@
+#ifndef VDIRECTORYPRELOADER_H
+#define VDIRECTORYPRELOADER_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+#include <QHash>
+#include <QMultiMap>
+#include <QPointer>
+#include <QJsonObject>
+#include <QThreadPool>
+
+class VDirectory;
+
+// Read and parse a directory config file in a thread of QThreadPool.
+// It will be deleted by the thread pool after run(), and the result is
+// delivered to the receivers in their threads via configLoaded().
+class VDirectoryConfigLoader : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    // @p_path: the directory containing the config file.
+    explicit VDirectoryConfigLoader(const QString &p_path);
+
+    void run() Q_DECL_OVERRIDE;
+
+signals:
+    // @p_json is empty if failed to read.
+    // @p_modifiedTime and @p_size are of the config file before reading it.
+    void configLoaded(const QString &p_path,
+                      const QJsonObject &p_json,
+                      qint64 p_modifiedTime,
+                      qint64 p_size);
+
+private:
+    QString m_path;
+};
+
+// Open directories in background before the user expands them.
+// Directory configs are read and parsed in a thread pool, while the
+// directories are opened in the GUI thread.
+// Loads wait in a priority queue and are handed to the thread pool only
+// when there is an idle thread, so a load with raised priority could still
+// overtake the ones queued earlier.
+class VDirectoryPreloader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VDirectoryPreloader(QObject *p_parent = 0);
+
+    // Cancel pending loads and wait for the running ones.
+    ~VDirectoryPreloader();
+
+    // Open @p_dir and its sub-directories in background, @p_depth levels
+    // in total.
+    // Loads with higher @p_priority are started first. The priority of a
+    // load not started yet is raised if requested again.
+    void preload(VDirectory *p_dir, int p_depth, int p_priority);
+
+    // Cancel all the loads not started yet.
+    void cancel();
+
+private slots:
+    void handleConfigLoaded(const QString &p_path,
+                            const QJsonObject &p_json,
+                            qint64 p_modifiedTime,
+                            qint64 p_size);
+
+private:
+    struct PendingLoad
+    {
+        PendingLoad() : m_depth(0), m_priority(0), m_started(false)
+        {
+        }
+
+        QPointer<VDirectory> m_dir;
+        int m_depth;
+        int m_priority;
+
+        // Whether it has been handed to the thread pool.
+        bool m_started;
+    };
+
+    // Start queued loads while there are idle threads.
+    void startLoads();
+
+    // Open the directory of the load of @p_path with its config @p_json and
+    // queue the loads of its sub-directories.
+    void openDirectory(const QString &p_path,
+                       const QJsonObject &p_json,
+                       qint64 p_modifiedTime,
+                       qint64 p_size);
+
+    QThreadPool m_pool;
+
+    // Loads not finished yet, keyed by the path of the directory.
+    QHash<QString, PendingLoad> m_pendingLoads;
+
+    // Paths of the loads not started yet, keyed by the negative priority so
+    // that the load of the highest priority comes first.
+    QMultiMap<int, QString> m_queue;
+
+    // Number of loads handed to the thread pool whose result has not been
+    // handled yet, including the cancelled ones.
+    int m_nrRunning;
+};
+
+#endif // VDIRECTORYPRELOADER_H
@@ -8,6 +8,7 @@
 #include "utils/vutils.h"
 #include "veditarea.h"
 #include "vconfigmanager.h"
+#include "vdirectorypreloader.h"
 
 extern VConfigManager *g_config;
 extern VNote *g_vnote;
@@ -17,10 +18,16 @@ const QString VDirectoryTree::c_copyShortcutSequence = "Ctrl+C";
 const QString VDirectoryTree::c_cutShortcutSequence = "Ctrl+X";
 const QString VDirectoryTree::c_pasteShortcutSequence = "Ctrl+V";
 
+// Priorities of background loads. Folders the user is expanding come first.
+static const int c_expandPreloadPriority = 100;
+static const int c_notebookPreloadPriority = 0;
+
 VDirectoryTree::VDirectoryTree(VNote *vnote, QWidget *parent)
     : QTreeWidget(parent), VNavigationMode(),
       vnote(vnote), m_editArea(NULL)
 {
+    m_preloader = new VDirectoryPreloader(this);
+
     setColumnCount(1);
     setHeaderHidden(true);
     setContextMenuPolicy(Qt::CustomContextMenu);
@@ -134,6 +141,8 @@ void VDirectoryTree::setNotebook(VNotebook *p_notebook)
         disconnect((VNotebook *)m_notebook, &VNotebook::contentChanged,
                    this, &VDirectoryTree::updateDirectoryTree);
     }
+
+    m_preloader->cancel();
     m_notebook = p_notebook;
     if (m_notebook) {
         connect((VNotebook *)m_notebook, &VNotebook::contentChanged,
@@ -182,6 +191,19 @@ void VDirectoryTree::updateDirectoryTree()
     if (!restoreCurrentItem()) {
         setCurrentItem(topLevelItem(0));
     }
+
+    preloadSubDirectories(rootDir, c_notebookPreloadPriority);
+}
+
+void VDirectoryTree::preloadSubDirectories(VDirectory *p_dir, int p_priority)
+{
+    int depth = g_config->getDirectoryPreloadDepth();
+    if (depth <= 0) {
+        return;
+    }
+
+    // The direct sub-folders are opened when building the tree.
+    m_preloader->preload(p_dir, depth + 1, p_priority);
 }
 
 bool VDirectoryTree::restoreCurrentItem()
@@ -250,6 +272,8 @@ void VDirectoryTree::handleItemExpanded(QTreeWidgetItem *p_item)
     updateChildren(p_item);
     VDirectory *dir = getVDirectory(p_item);
     dir->setExpanded(true);
+
+    preloadSubDirectories(dir, c_expandPreloadPriority);
 }
 
 void VDirectoryTree::updateChildren(QTreeWidgetItem *p_item)
@@ -650,7 +674,8 @@ void VDirectoryTree::pasteDirectories(VDirectory *p_destDir)
     Q_ASSERT(!clip.isEmpty() && clip["operation"] == (int)ClipboardOpType::CopyDir);
     bool isCut = clip["is_cut"].toBool();
 
-    int nrPasted = 0;
+    QVector<VDirectory *> srcDirs;
+    QStringList dirNames;
     for (int i = 0; i < m_copiedDirs.size(); ++i) {
         QPointer<VDirectory> srcDir = m_copiedDirs[i];
         if (!srcDir || srcDir == p_destDir) {
@@ -664,11 +689,62 @@ void VDirectoryTree::pasteDirectories(VDirectory *p_destDir)
             // Rename it to xx_copy
             dirName = VUtils::generateCopiedDirName(srcParentDir->fetchPath(), dirName);
         }
-        if (copyDirectory(p_destDir, dirName, srcDir, isCut)) {
+
+        srcDirs.append(srcDir);
+        dirNames.append(dirName);
+    }
+
+    // Source parents to update after cutting.
+    QVector<VDirectory *> srcParentDirs;
+    if (isCut) {
+        for (int i = 0; i < srcDirs.size(); ++i) {
+            VDirectory *srcParentDir = srcDirs[i]->getParentDirectory();
+            if (srcParentDir != p_destDir && !srcParentDirs.contains(srcParentDir)) {
+                srcParentDirs.append(srcParentDir);
+            }
+        }
+    }
+
+    // Move or copy all the folders at once to write each folder config once.
+    QVector<VDirectory *> destDirs = VDirectory::copyDirectories(p_destDir, dirNames,
+                                                                 srcDirs, isCut);
+    int nrPasted = 0;
+    for (int i = 0; i < destDirs.size(); ++i) {
+        if (!destDirs[i]) {
+            VUtils::showMessage(QMessageBox::Warning, tr("Warning"),
+                                tr("Fail to copy folder <span style=\"%1\">%2</span>.")
+                                  .arg(g_config->c_dataTextStyle).arg(srcDirs[i]->getName()),
+                                tr("Please check if there already exists a folder with the same name."),
+                                QMessageBox::Ok, QMessageBox::Ok, this);
+        } else {
             nrPasted++;
         }
     }
-    qDebug() << "pasted" << nrPasted << "files successfully";
+
+    if (nrPasted > 0) {
+        // Update QTreeWidget
+        bool isWidget;
+        QTreeWidgetItem *destItem = findVDirectory(p_destDir, isWidget);
+        if (destItem || isWidget) {
+            updateItemChildren(destItem);
+        }
+
+        for (int i = 0; i < srcParentDirs.size(); ++i) {
+            QTreeWidgetItem *srcItem = findVDirectory(srcParentDirs[i], isWidget);
+            if (srcItem || isWidget) {
+                updateItemChildren(srcItem);
+            }
+        }
+
+        // Broadcast this update
+        for (int i = 0; i < destDirs.size(); ++i) {
+            if (destDirs[i]) {
+                emit directoryUpdated(destDirs[i]);
+            }
+        }
+    }
+
+    qDebug() << "pasted" << nrPasted << "folders successfully";
     clipboard->clear();
     m_copiedDirs.clear();
 }
@@ -745,49 +821,6 @@ void VDirectoryTree::keyPressEvent(QKeyEvent *event)
     QTreeWidget::keyPressEvent(event);
 }
 
-bool VDirectoryTree::copyDirectory(VDirectory *p_destDir, const QString &p_destName,
-                                   VDirectory *p_srcDir, bool p_cut)
-{
-    qDebug() << "copy" << p_srcDir->getName() << "to" << p_destDir->getName()
-             << "as" << p_destName;
-    QString srcName = p_srcDir->getName();
-    QString srcPath = QDir::cleanPath(p_srcDir->fetchPath());
-    QString destPath = QDir::cleanPath(QDir(p_destDir->fetchPath()).filePath(p_destName));
-    if (VUtils::equalPath(srcPath, destPath)) {
-        return true;
-    }
-
-    VDirectory *srcParentDir = p_srcDir->getParentDirectory();
-    VDirectory *destDir = VDirectory::copyDirectory(p_destDir, p_destName, p_srcDir, p_cut);
-
-    if (destDir) {
-        // Update QTreeWidget
-        bool isWidget;
-        QTreeWidgetItem *destItem = findVDirectory(p_destDir, isWidget);
-        if (destItem || isWidget) {
-            updateItemChildren(destItem);
-        }
-
-        if (p_cut) {
-            QTreeWidgetItem *srcItem = findVDirectory(srcParentDir, isWidget);
-            if (srcItem || isWidget) {
-                updateItemChildren(srcItem);
-            }
-        }
-
-        // Broadcast this update
-        emit directoryUpdated(destDir);
-    } else {
-        VUtils::showMessage(QMessageBox::Warning, tr("Warning"),
-                            tr("Fail to copy folder <span style=\"%1\">%2</span>.")
-                              .arg(g_config->c_dataTextStyle).arg(srcName),
-                            tr("Please check if there already exists a folder with the same name."),
-                            QMessageBox::Ok, QMessageBox::Ok, this);
-    }
-
-    return destDir;
-}
-
 QTreeWidgetItem *VDirectoryTree::findVDirectory(const VDirectory *p_dir, bool &p_widget)
 {
     p_widget = false;
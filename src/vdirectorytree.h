@@ -15,6 +15,7 @@
 class VNote;
 class VEditArea;
 class QLabel;
+class VDirectoryPreloader;
 
 class VDirectoryTree : public QTreeWidget, public VNavigationMode
 {
@@ -91,8 +92,6 @@ private:
     inline QPointer<VDirectory> getVDirectory(QTreeWidgetItem *p_item) const;
     void copyDirectoryInfoToClipboard(const QJsonArray &p_dirs, bool p_cut);
     void pasteDirectories(VDirectory *p_destDir);
-    bool copyDirectory(VDirectory *p_destDir, const QString &p_destName,
-                       VDirectory *p_srcDir, bool p_cut);
 
     // Build the subtree of @p_item's children if it has not been built yet.
     void updateChildren(QTreeWidgetItem *p_item);
@@ -107,6 +106,9 @@ private:
     QList<QTreeWidgetItem *> getVisibleChildItems(const QTreeWidgetItem *p_item) const;
     bool restoreCurrentItem();
 
+    // Open the sub-folders of @p_dir in background.
+    void preloadSubDirectories(VDirectory *p_dir, int p_priority);
+
     VNote *vnote;
     QPointer<VNotebook> m_notebook;
     QVector<QPointer<VDirectory> > m_copiedDirs;
@@ -115,6 +117,8 @@ private:
     // Each notebook's current item's VDirectory.
     QHash<VNotebook *, VDirectory *> m_notebookCurrentDirMap;
 
+    VDirectoryPreloader *m_preloader;
+
     // Actions
     QAction *newRootDirAct;
     QAction *newSiblingDirAct;
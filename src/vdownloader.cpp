@@ -1,24 +1,177 @@
 #include "vdownloader.h"
 
+#include <QDebug>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QPointer>
+#include <QCoreApplication>
+#include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+
+// Network access shared by all the downloaders.
+class VDownloadManager
+{
+public:
+    static VDownloadManager *instance()
+    {
+        static VDownloadManager manager;
+        return &manager;
+    }
+
+    void configure(const QString &p_cacheFolder, int p_cacheSize, int p_maxRequests)
+    {
+        m_cacheFolder = p_cacheFolder;
+        m_cacheSize = p_cacheSize;
+        m_maxRequests = qMax(p_maxRequests, 1);
+    }
+
+    void request(VDownloader *p_downloader, const QUrl &p_url, bool p_preferCache)
+    {
+        QString url = p_url.toString();
+        auto it = m_waiters.find(url);
+        if (it != m_waiters.end()) {
+            // Merge into the request in flight.
+            if (!it.value().contains(p_downloader)) {
+                it.value().append(p_downloader);
+            }
+
+            qDebug() << "VDownloader merge request" << url;
+            return;
+        }
+
+        m_waiters.insert(url, QList<QPointer<VDownloader>>() << p_downloader);
+        m_queue.enqueue(Request(p_url, p_preferCache));
+        startRequests();
+    }
+
+private:
+    struct Request
+    {
+        Request(const QUrl &p_url, bool p_preferCache)
+            : m_url(p_url), m_preferCache(p_preferCache)
+        {
+        }
+
+        QUrl m_url;
+        bool m_preferCache;
+    };
+
+    VDownloadManager()
+        : m_nam(NULL), m_cacheSize(0), m_maxRequests(4), m_nrRunning(0)
+    {
+    }
+
+    QNetworkAccessManager *networkAccessManager()
+    {
+        if (!m_nam) {
+            // Deleted with the application.
+            m_nam = new QNetworkAccessManager(QCoreApplication::instance());
+            if (!m_cacheFolder.isEmpty() && m_cacheSize > 0) {
+                QNetworkDiskCache *cache = new QNetworkDiskCache(m_nam);
+                cache->setCacheDirectory(m_cacheFolder);
+                cache->setMaximumCacheSize((qint64)m_cacheSize * 1024 * 1024);
+                m_nam->setCache(cache);
+            }
+        }
+
+        return m_nam;
+    }
+
+    void startRequests()
+    {
+        while (m_nrRunning < m_maxRequests && !m_queue.isEmpty()) {
+            Request req = m_queue.dequeue();
+            QString url = req.m_url.toString();
+
+            bool needed = false;
+            for (auto const &downloader : m_waiters.value(url)) {
+                if (downloader) {
+                    needed = true;
+                    break;
+                }
+            }
+
+            if (!needed) {
+                // All the downloaders waiting for it are gone.
+                m_waiters.remove(url);
+                continue;
+            }
+
+            QNetworkRequest request(req.m_url);
+            request.setAttribute(QNetworkRequest::CacheLoadControlAttribute,
+                                 req.m_preferCache ? QNetworkRequest::PreferCache
+                                                   : QNetworkRequest::PreferNetwork);
+            QNetworkAccessManager *nam = networkAccessManager();
+            QNetworkReply *reply = nam->get(request);
+            ++m_nrRunning;
+            QObject::connect(reply, &QNetworkReply::finished,
+                             nam, [this, reply, url]() {
+                                 handleReply(reply, url);
+                             });
+
+            qDebug() << "VDownloader get" << url << "running" << m_nrRunning;
+        }
+    }
+
+    void handleReply(QNetworkReply *p_reply, const QString &p_url)
+    {
+        --m_nrRunning;
+        p_reply->deleteLater();
+
+        QByteArray data;
+        if (p_reply->error() == QNetworkReply::NoError) {
+            data = p_reply->readAll();
+            qDebug() << "VDownloader receive" << p_url << data.size() << "bytes"
+                     << (p_reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool()
+                         ? "from cache" : "");
+        } else {
+            qWarning() << "VDownloader fail to download" << p_url << p_reply->errorString();
+        }
+
+        // Deliver to each downloader which is still alive.
+        QList<QPointer<VDownloader>> waiters = m_waiters.take(p_url);
+        for (auto const &downloader : waiters) {
+            if (downloader) {
+                emit downloader->downloadFinished(data, p_url);
+            }
+        }
+
+        startRequests();
+    }
+
+    QNetworkAccessManager *m_nam;
+
+    QString m_cacheFolder;
+
+    int m_cacheSize;
+
+    int m_maxRequests;
+
+    // Number of requests in flight.
+    int m_nrRunning;
+
+    // URL to the downloaders waiting for it, including queued ones.
+    QHash<QString, QList<QPointer<VDownloader>>> m_waiters;
+
+    // Requests waiting for a free slot.
+    QQueue<Request> m_queue;
+};
+
 VDownloader::VDownloader(QObject *parent)
     : QObject(parent)
 {
-    connect(&webCtrl, &QNetworkAccessManager::finished,
-            this, &VDownloader::handleDownloadFinished);
 }
 
-void VDownloader::handleDownloadFinished(QNetworkReply *reply)
+void VDownloader::download(const QUrl &p_url, bool p_preferCache)
 {
-    data = reply->readAll();
-    reply->deleteLater();
-    qDebug() << "VDownloader receive" << reply->url().toString();
-    emit downloadFinished(data, reply->url().toString());
+    Q_ASSERT(p_url.isValid());
+    VDownloadManager::instance()->request(this, p_url, p_preferCache);
 }
 
-void VDownloader::download(const QUrl &p_url)
+void VDownloader::configure(const QString &p_cacheFolder, int p_cacheSize, int p_maxRequests)
 {
-    Q_ASSERT(p_url.isValid());
-    QNetworkRequest request(p_url);
-    webCtrl.get(request);
-    qDebug() << "VDownloader get" << p_url.toString();
+    VDownloadManager::instance()->configure(p_cacheFolder, p_cacheSize, p_maxRequests);
 }
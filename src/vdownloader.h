@@ -4,26 +4,33 @@
 #include <QObject>
 #include <QUrl>
 #include <QByteArray>
-#include <QNetworkAccessManager>
-#include <QNetworkRequest>
-#include <QNetworkReply>
+#include <QString>
 
+// Download resources via a network access manager shared by all downloaders.
+// Requests of the same URL in flight are merged into one network request, and
+// at most a limited number of requests run at the same time. Responses are
+// cached on disk if configured.
 class VDownloader : public QObject
 {
     Q_OBJECT
 public:
     explicit VDownloader(QObject *parent = 0);
-    void download(const QUrl &p_url);
 
-signals:
-    void downloadFinished(const QByteArray &data, const QString &url);
+    // downloadFinished() will be emitted once when it is done, even if @p_url
+    // is requested multiple times before that.
+    // @p_preferCache: use the cached response even if it is expired.
+    void download(const QUrl &p_url, bool p_preferCache = false);
 
-private slots:
-    void handleDownloadFinished(QNetworkReply *reply);
+    // Configure the shared network access.
+    // Should be called before any download.
+    // @p_cacheFolder: folder of the disk cache. Empty to disable it;
+    // @p_cacheSize: max size in MB of the disk cache;
+    // @p_maxRequests: max number of concurrent requests;
+    static void configure(const QString &p_cacheFolder, int p_cacheSize, int p_maxRequests);
 
-private:
-    QNetworkAccessManager webCtrl;
-    QByteArray data;
+signals:
+    // @data is empty if failed to download.
+    void downloadFinished(const QByteArray &data, const QString &url);
 };
 
 #endif // VDOWNLOADER_H
@@ -1306,6 +1306,24 @@ void VEdit::makeBlockVisible(const QTextBlock &p_block)
     }
 }
 
+void VEdit::visibleBlockRange(int &p_first, int &p_last)
+{
+    p_first = 0;
+    p_last = -1;
+
+    QTextBlock block = firstVisibleBlock();
+    if (!block.isValid()) {
+        return;
+    }
+
+    p_first = p_last = block.blockNumber();
+    block = block.next();
+    while (block.isValid() && isBlockVisible(block)) {
+        p_last = block.blockNumber();
+        block = block.next();
+    }
+}
+
 bool VEdit::isBlockVisible(const QTextBlock &p_block)
 {
     if (!p_block.isValid() || !p_block.isVisible()) {
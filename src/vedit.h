@@ -135,6 +135,10 @@ public:
 
     bool isBlockVisible(const QTextBlock &p_block);
 
+    // Get the block number range [@p_first, @p_last] of the visible blocks.
+    // @p_last will be less than @p_first if there is no visible block.
+    void visibleBlockRange(int &p_first, int &p_last);
+
 signals:
     // Request VEditTab to save and exit edit mode.
     void saveAndRead();
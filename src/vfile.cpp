@@ -20,7 +20,8 @@ VFile::VFile(QObject *p_parent,
       m_type(p_type),
       m_modifiable(p_modifiable),
       m_createdTimeUtc(p_createdTimeUtc),
-      m_modifiedTimeUtc(p_modifiedTimeUtc)
+      m_modifiedTimeUtc(p_modifiedTimeUtc),
+      m_pathGeneration(0)
 {
 }
 
@@ -106,6 +107,7 @@ void VFile::deleteLocalImages()
 void VFile::setName(const QString &p_name)
 {
     m_name = p_name;
+    VDirectory::invalidatePaths();
     DocType newType = VUtils::docTypeFromName(p_name);
     if (newType != m_docType) {
         qWarning() << "setName() change the DocType. A convertion should be followed";
@@ -154,16 +156,28 @@ VNotebook *VFile::getNotebook()
     return getDirectory()->getNotebook();
 }
 
+void VFile::updatePaths() const
+{
+    if (m_pathGeneration == VDirectory::pathGeneration()) {
+        return;
+    }
+
+    const VDirectory *dir = getDirectory();
+    m_path = QDir(dir->fetchPath()).filePath(m_name);
+    m_relativePath = QDir(dir->fetchRelativePath()).filePath(m_name);
+    m_pathGeneration = VDirectory::pathGeneration();
+}
+
 QString VFile::fetchPath() const
 {
-    QString dirPath = getDirectory()->fetchPath();
-    return QDir(dirPath).filePath(m_name);
+    updatePaths();
+    return m_path;
 }
 
 QString VFile::fetchRelativePath() const
 {
-    QString dirRelativePath = getDirectory()->fetchRelativePath();
-    return QDir(dirRelativePath).filePath(m_name);
+    updatePaths();
+    return m_relativePath;
 }
 
 QString VFile::fetchBasePath() const
@@ -247,10 +261,14 @@ bool VFile::rename(const QString &p_name)
     }
 
     m_name = p_name;
+    VDirectory::invalidatePaths();
+    dir->fileRenamed(this, oldName);
 
     // Update parent directory's config file.
     if (!dir->writeToConfig()) {
         m_name = oldName;
+        VDirectory::invalidatePaths();
+        dir->fileRenamed(this, p_name);
         diskDir.rename(p_name, m_name);
         return false;
     }
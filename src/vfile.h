@@ -85,6 +85,9 @@ protected:
     // Delete the file and corresponding images
     void deleteDiskFile();
 
+    // Compute the paths of this file if the cached ones are invalid.
+    void updatePaths() const;
+
     // Delete local images of DocType::Markdown.
     void deleteLocalImages();
 
@@ -114,6 +117,13 @@ protected:
     // UTC time of last modification to this file in VNote.
     QDateTime m_modifiedTimeUtc;
 
+    // Cached absolute path and path relative to the notebook.
+    mutable QString m_path;
+    mutable QString m_relativePath;
+
+    // Path generation of VDirectory when computing the cached paths.
+    mutable quint64 m_pathGeneration;
+
     friend class VDirectory;
 };
 
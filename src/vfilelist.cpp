@@ -577,7 +577,10 @@ void VFileList::pasteFiles(VDirectory *p_destDir)
     Q_ASSERT(!clip.isEmpty() && clip["operation"] == (int)ClipboardOpType::CopyFile);
     bool isCut = clip["is_cut"].toBool();
 
-    int nrPasted = 0;
+    // Names of the files to paste, lower case, to check conflicts among them.
+    QSet<QString> destNames;
+    QVector<VFile *> srcFiles;
+    QStringList fileNames;
     for (int i = 0; i < m_copiedFiles.size(); ++i) {
         QPointer<VFile> srcFile = m_copiedFiles[i];
         if (!srcFile) {
@@ -590,39 +593,46 @@ void VFileList::pasteFiles(VDirectory *p_destDir)
             // Rename it to xx_copy.md
             fileName = VUtils::generateCopiedFileName(srcDir->fetchPath(), fileName);
         }
-        if (copyFile(p_destDir, fileName, srcFile, isCut)) {
+
+        // Check name conflict via the index of @p_destDir.
+        VFile *conflictFile = p_destDir->findFile(fileName, false);
+        if ((!conflictFile || conflictFile == srcFile)
+            && !destNames.contains(fileName.toLower())) {
+            destNames.insert(fileName.toLower());
+            srcFiles.append(srcFile);
+            fileNames.append(fileName);
+        } else {
+            showCopyFileFailure(srcFile->getName());
+        }
+    }
+
+    // Move or copy all the files at once to write each folder config once.
+    QVector<VFile *> destFiles = VDirectory::copyFiles(p_destDir, fileNames, srcFiles, isCut);
+    int nrPasted = 0;
+    for (int i = 0; i < destFiles.size(); ++i) {
+        if (destFiles[i]) {
             nrPasted++;
+            emit fileUpdated(destFiles[i]);
         } else {
-            VUtils::showMessage(QMessageBox::Warning, tr("Warning"),
-                                tr("Fail to copy note <span style=\"%1\">%2</span>.")
-                                  .arg(g_config->c_dataTextStyle).arg(srcFile->getName()),
-                                tr("Please check if there already exists a file with the same name in the target folder."),
-                                QMessageBox::Ok, QMessageBox::Ok, this);
+            showCopyFileFailure(srcFiles[i]->getName());
         }
     }
 
+    // Update the list once for all the pasted files.
+    updateFileList();
+
     qDebug() << "pasted" << nrPasted << "files sucessfully";
     clipboard->clear();
     m_copiedFiles.clear();
 }
 
-bool VFileList::copyFile(VDirectory *p_destDir, const QString &p_destName, VFile *p_file, bool p_cut)
+void VFileList::showCopyFileFailure(const QString &p_name)
 {
-    QString srcPath = QDir::cleanPath(p_file->fetchPath());
-    QString destPath = QDir::cleanPath(QDir(p_destDir->fetchPath()).filePath(p_destName));
-    if (VUtils::equalPath(srcPath, destPath)) {
-        return true;
-    }
-
-    // DocType is not allowed to change.
-    Q_ASSERT(p_file->getDocType() == VUtils::docTypeFromName(destPath));
-
-    VFile *destFile = VDirectory::copyFile(p_destDir, p_destName, p_file, p_cut);
-    updateFileList();
-    if (destFile) {
-        emit fileUpdated(destFile);
-    }
-    return destFile != NULL;
+    VUtils::showMessage(QMessageBox::Warning, tr("Warning"),
+                        tr("Fail to copy note <span style=\"%1\">%2</span>.")
+                          .arg(g_config->c_dataTextStyle).arg(p_name),
+                        tr("Please check if there already exists a file with the same name in the target folder."),
+                        QMessageBox::Ok, QMessageBox::Ok, this);
 }
 
 void VFileList::keyPressEvent(QKeyEvent *event)
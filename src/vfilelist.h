@@ -83,7 +83,9 @@ private:
 
     void copyFileInfoToClipboard(const QJsonArray &p_files, bool p_isCut);
     void pasteFiles(VDirectory *p_destDir);
-    bool copyFile(VDirectory *p_destDir, const QString &p_destName, VFile *p_file, bool p_cut);
+    // Warn that note @p_name fails to be copied.
+    void showCopyFileFailure(const QString &p_name);
+
     // New items have been added to direcotry. Update file list accordingly.
     QVector<QListWidgetItem *> updateFileListAdded();
     inline QPointer<VFile> getVFile(QListWidgetItem *p_item) const;
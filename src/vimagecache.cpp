@@ -0,0 +1,91 @@
+#include "vimagecache.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QThreadPool>
+#include "vimagedecoder.h"
+
+VImageCache::VImageCache(int p_maxSize, QObject *p_parent)
+    : QObject(p_parent), m_cache(qMax(p_maxSize, 1) * 1024)
+{
+}
+
+VImageCache::~VImageCache()
+{
+    qDebug() << "image cache: entries" << m_cache.size()
+             << "size" << m_cache.totalCost() << "KB"
+             << "hits" << m_stats.m_hits << "misses" << m_stats.m_misses
+             << "evictions" << m_stats.m_evictions << "decodes" << m_stats.m_decodes;
+}
+
+QString VImageCache::key(const QString &p_path, int p_width)
+{
+    // Images changed on disk will miss the cache.
+    qint64 mtime = 0;
+    QFileInfo info(p_path);
+    if (info.exists()) {
+        mtime = info.lastModified().toMSecsSinceEpoch();
+    }
+
+    return QString("%1:%2:%3").arg(p_width).arg(mtime).arg(p_path);
+}
+
+bool VImageCache::get(const QString &p_path, int p_width, QImage &p_image)
+{
+    const QImage *image = m_cache.object(key(p_path, p_width));
+    if (!image) {
+        ++m_stats.m_misses;
+        return false;
+    }
+
+    ++m_stats.m_hits;
+    p_image = *image;
+    return true;
+}
+
+void VImageCache::put(const QString &p_path, int p_width, const QImage &p_image)
+{
+    if (p_image.isNull()) {
+        return;
+    }
+
+    QString imageKey = key(p_path, p_width);
+    int oldSize = m_cache.size();
+    bool existed = m_cache.contains(imageKey);
+
+    // QCache will delete the image if it is larger than the cache.
+    m_cache.insert(imageKey, new QImage(p_image), p_image.byteCount() / 1024 + 1);
+
+    int evicted = oldSize + (existed ? 0 : 1) - m_cache.size();
+    if (evicted > 0) {
+        m_stats.m_evictions += evicted;
+        qDebug() << "image cache: evict" << evicted << "images, size"
+                 << m_cache.totalCost() << "KB";
+    }
+}
+
+void VImageCache::decode(const QString &p_path, int p_width)
+{
+    QPair<QString, int> image(p_path, p_width);
+    if (m_decodingImages.contains(image)) {
+        return;
+    }
+
+    m_decodingImages.insert(image);
+    ++m_stats.m_decodes;
+
+    VImageDecoder *decoder = new VImageDecoder(p_path, p_width);
+    connect(decoder, &VImageDecoder::imageDecoded,
+            this, &VImageCache::handleImageDecoded);
+    QThreadPool::globalInstance()->start(decoder);
+}
+
+void VImageCache::handleImageDecoded(const QString &p_path, const QImage &p_image, int p_width)
+{
+    m_decodingImages.remove(qMakePair(p_path, p_width));
+
+    put(p_path, p_width, p_image);
+
+    emit imageDecoded(p_path, p_image, p_width);
+}
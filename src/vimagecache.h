@@ -0,0 +1,74 @@
+#ifndef VIMAGECACHE_H
+#define VIMAGECACHE_H
+
+#include <QObject>
+#include <QString>
+#include <QImage>
+#include <QCache>
+#include <QSet>
+#include <QPair>
+
+// Process-wide LRU cache of decoded preview images shared by all the editors.
+// Bounded by the total size of the images. Keyed by the path, the
+// modification time and the width the image is decoded at.
+class VImageCache : public QObject
+{
+    Q_OBJECT
+public:
+    struct Statistics
+    {
+        Statistics() : m_hits(0), m_misses(0), m_evictions(0), m_decodes(0)
+        {
+        }
+
+        int m_hits;
+        int m_misses;
+        int m_evictions;
+        int m_decodes;
+    };
+
+    // @p_maxSize: the maximum size in MB of the images to keep.
+    explicit VImageCache(int p_maxSize, QObject *p_parent = 0);
+
+    ~VImageCache();
+
+    // Get image @p_path decoded at width @p_width.
+    // @p_path: local path or URL;
+    // @p_width: 0 for the original size;
+    // Returns false if it is not cached.
+    bool get(const QString &p_path, int p_width, QImage &p_image);
+
+    void put(const QString &p_path, int p_width, const QImage &p_image);
+
+    // Decode local image @p_path at width @p_width in the thread pool and put
+    // it in the cache. imageDecoded() will be emitted when done.
+    // Requests for an image being decoded are merged.
+    void decode(const QString &p_path, int p_width);
+
+    const Statistics &getStatistics() const;
+
+signals:
+    // @p_image is null if failed to decode.
+    void imageDecoded(const QString &p_path, const QImage &p_image, int p_width);
+
+private slots:
+    void handleImageDecoded(const QString &p_path, const QImage &p_image, int p_width);
+
+private:
+    static QString key(const QString &p_path, int p_width);
+
+    // Cost is the size in KB.
+    QCache<QString, QImage> m_cache;
+
+    // (path, width) of the images being decoded.
+    QSet<QPair<QString, int>> m_decodingImages;
+
+    Statistics m_stats;
+};
+
+inline const VImageCache::Statistics &VImageCache::getStatistics() const
+{
+    return m_stats;
+}
+
+#endif // VIMAGECACHE_H
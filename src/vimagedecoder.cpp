@@ -0,0 +1,56 @@
+#include "vimagedecoder.h"
+
+#include <QImageReader>
+#include <QDebug>
+#include "vthumbnailcache.h"
+
+extern VThumbnailCache *g_thumbnailCache;
+
+VImageDecoder::VImageDecoder(const QString &p_path, int p_width)
+    : QObject(), QRunnable(), m_path(p_path), m_width(p_width)
+{
+    setAutoDelete(true);
+}
+
+void VImageDecoder::run()
+{
+    QImage image;
+    if (m_width > 0 && g_thumbnailCache->load(m_path, m_width, image)) {
+        emit imageDecoded(m_path, image, m_width);
+        return;
+    }
+
+    QImageReader reader(m_path);
+    QSize size = reader.size();
+    bool scaled = false;
+    if (m_width > 0 && size.isValid() && size.width() > m_width) {
+        // Let the reader scale it, which is much cheaper for some formats.
+        reader.setScaledSize(scaledSize(size, m_width));
+        scaled = true;
+    }
+
+    image = reader.read();
+    if (image.isNull()) {
+        qWarning() << "fail to decode image" << m_path << reader.errorString();
+    } else if (scaled) {
+        g_thumbnailCache->save(m_path, m_width, image);
+    }
+
+    emit imageDecoded(m_path, image, m_width);
+}
+
+QSize VImageDecoder::imageSize(const QString &p_path)
+{
+    QImageReader reader(p_path);
+    return reader.size();
+}
+
+QSize VImageDecoder::scaledSize(const QSize &p_size, int p_width)
+{
+    if (p_width <= 0 || p_size.width() <= p_width) {
+        return p_size;
+    }
+
+    int height = qMax((int)((qint64)p_size.height() * p_width / p_size.width()), 1);
+    return QSize(p_width, height);
+}
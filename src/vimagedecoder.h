@@ -0,0 +1,41 @@
+#ifndef VIMAGEDECODER_H
+#define VIMAGEDECODER_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+#include <QImage>
+#include <QSize>
+
+// Decode a local image in a thread of QThreadPool.
+// Downscaled images are read from and saved to the thumbnail cache.
+// It will be deleted by the thread pool after run(), and the result is
+// delivered to the receivers in their threads via imageDecoded().
+class VImageDecoder : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    // @p_width: the width to scale the image down to. 0 to decode at full size.
+    VImageDecoder(const QString &p_path, int p_width);
+
+    void run() Q_DECL_OVERRIDE;
+
+    // Read the size of image @p_path from its header without decoding it.
+    // Returns an invalid size if failed.
+    static QSize imageSize(const QString &p_path);
+
+    // Return the size to decode an image of @p_size at, not larger than
+    // @p_width in width while keeping the aspect ratio.
+    static QSize scaledSize(const QSize &p_size, int p_width);
+
+signals:
+    // @p_image is null if failed to decode.
+    void imageDecoded(const QString &p_path, const QImage &p_image, int p_width);
+
+private:
+    QString m_path;
+
+    int m_width;
+};
+
+#endif // VIMAGEDECODER_H
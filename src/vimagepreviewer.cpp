@@ -6,6 +6,7 @@
 #include <QDir>
 #include <QUrl>
 #include <QVector>
+#include <QSet>
 #include "vmdedit.h"
 #include "vconfigmanager.h"
 #include "utils/vutils.h"
@@ -15,11 +16,17 @@
 #include "vdownloader.h"
 #include "hgmarkdownhighlighter.h"
 #include "vtextblockdata.h"
+#include "vimagedecoder.h"
+#include "vimagecache.h"
 
 extern VConfigManager *g_config;
 
+extern VImageCache *g_imageCache;
+
 const int VImagePreviewer::c_minImageWidth = 100;
 
+const int VImagePreviewer::c_decodeWidthStep = 128;
+
 VImagePreviewer::VImagePreviewer(VMdEdit *p_edit, const HGMarkdownHighlighter *p_highlighter)
     : QObject(p_edit), m_edit(p_edit), m_document(p_edit->document()),
       m_file(p_edit->getFile()), m_highlighter(p_highlighter),
@@ -35,14 +42,28 @@ VImagePreviewer::VImagePreviewer(VMdEdit *p_edit, const HGMarkdownHighlighter *p
     m_downloader = new VDownloader(this);
     connect(m_downloader, &VDownloader::downloadFinished,
             this, &VImagePreviewer::imageDownloaded);
+
+    connect(g_imageCache, &VImageCache::imageDecoded,
+            this, &VImagePreviewer::imageDecoded);
 }
 
-void VImagePreviewer::imageLinksChanged(const QVector<VElementRegion> &p_imageRegions)
+void VImagePreviewer::imageLinksChanged(const QVector<VElementRegion> &p_imageRegions,
+                                        const VRegionsDelta &p_delta)
 {
-    kickOffPreview(p_imageRegions);
+    // Image links are only moved by the change, so previews are still valid.
+    if (p_delta.isShiftOnly()) {
+        if (m_previewEnabled) {
+            m_imageRegions = p_imageRegions;
+        }
+
+        return;
+    }
+
+    kickOffPreview(p_imageRegions, p_delta);
 }
 
-void VImagePreviewer::kickOffPreview(const QVector<VElementRegion> &p_imageRegions)
+void VImagePreviewer::kickOffPreview(const QVector<VElementRegion> &p_imageRegions,
+                                     const VRegionsDelta &p_delta)
 {
     if (!m_previewEnabled) {
         Q_ASSERT(m_imageRegions.isEmpty());
@@ -54,10 +75,73 @@ void VImagePreviewer::kickOffPreview(const QVector<VElementRegion> &p_imageRegio
 
     m_isPreviewing = true;
 
+    // Splice the preview image IDs of regions. Preview images of the replaced
+    // regions may be obsolete.
+    int oldSize = m_imageRegions.size();
+    int newSize = p_imageRegions.size();
+    int start = p_delta.m_changeStart;
+    int end = p_delta.m_shiftPos;
+    QSet<long long> candidates;
+    QVector<long long> ids;
+    if (m_regionPreviewIDs.size() == oldSize
+        && p_delta.m_oldEnd <= oldSize
+        && p_delta.m_newEnd <= newSize
+        && oldSize - p_delta.m_oldEnd == newSize - p_delta.m_newEnd) {
+        ids.reserve(newSize);
+        for (int i = 0; i < p_delta.m_first; ++i) {
+            ids.append(m_regionPreviewIDs[i]);
+        }
+
+        for (int i = p_delta.m_first; i < p_delta.m_oldEnd; ++i) {
+            if (m_regionPreviewIDs[i] != -1) {
+                candidates.insert(m_regionPreviewIDs[i]);
+            }
+        }
+
+        for (int i = p_delta.m_first; i < p_delta.m_newEnd; ++i) {
+            ids.append(-1);
+        }
+
+        for (int i = p_delta.m_oldEnd; i < oldSize; ++i) {
+            ids.append(m_regionPreviewIDs[i]);
+        }
+
+        // A parse may change regions out of the changed text, such as an
+        // opening HTML comment above them. Cover the replaced regions, with
+        // their positions in current document, and the new regions.
+        int charDelta = p_delta.m_shiftPos - p_delta.m_oldShiftPos;
+        for (int i = p_delta.m_first; i < p_delta.m_oldEnd; ++i) {
+            const VElementRegion &reg = m_imageRegions[i];
+            if (reg.m_startPos < start) {
+                start = reg.m_startPos;
+            }
+
+            if (reg.m_endPos >= p_delta.m_oldShiftPos) {
+                end = qMax(end, previewBlockEnd(reg.m_endPos + charDelta));
+            }
+        }
+
+        for (int i = p_delta.m_first; i < p_delta.m_newEnd; ++i) {
+            const VElementRegion &reg = p_imageRegions[i];
+            start = qMin(start, reg.m_startPos);
+            end = qMax(end, previewBlockEnd(reg.m_endPos));
+        }
+    } else {
+        // Out of sync. Preview the whole document.
+        ids.fill(-1, newSize);
+        for (auto it = m_previewImages.begin(); it != m_previewImages.end(); ++it) {
+            candidates.insert(it.key());
+        }
+
+        start = 0;
+        end = m_document->characterCount();
+    }
+
     m_imageRegions = p_imageRegions;
+    m_regionPreviewIDs = ids;
     ++m_timeStamp;
 
-    previewImages();
+    previewImages(start, end, candidates);
 
     shrinkImageCache();
     m_isPreviewing = false;
@@ -65,17 +149,59 @@ void VImagePreviewer::kickOffPreview(const QVector<VElementRegion> &p_imageRegio
     emit previewFinished();
 }
 
-void VImagePreviewer::previewImages()
+int VImagePreviewer::previewBlockEnd(int p_pos) const
+{
+    // The preview of an image block lies in the next block.
+    QTextBlock block = m_document->findBlock(p_pos);
+    if (block.isValid() && block.next().isValid()) {
+        block = block.next();
+    }
+
+    if (!block.isValid()) {
+        return m_document->characterCount();
+    }
+
+    return block.position() + block.length();
+}
+
+void VImagePreviewer::previewImages(int p_start, int p_end, QSet<long long> &p_candidates)
 {
     // Get the width of the m_edit.
     m_imageWidth = qMax(m_edit->size().width() - 50, c_minImageWidth);
 
+    // The preview of an image block lies in the next block.
+    QTextBlock firstBlock = m_document->findBlock(p_start);
+    QTextBlock lastBlock = m_document->findBlock(p_end);
+    if (!firstBlock.isValid()) {
+        firstBlock = m_document->lastBlock();
+    }
+
+    if (!lastBlock.isValid()) {
+        lastBlock = m_document->lastBlock();
+    }
+
+    int firstNum = firstBlock.blockNumber();
+    int lastNum = qMax(lastBlock.blockNumber(), firstNum);
+
     QVector<ImageLinkInfo> imageLinks;
-    fetchImageLinksFromRegions(imageLinks);
+    fetchImageLinksFromRegions(firstBlock.position(),
+                               lastBlock.position() + lastBlock.length(),
+                               imageLinks,
+                               p_candidates);
 
     QTextCursor cursor(m_document);
-    previewImageLinks(imageLinks, cursor);
-    clearObsoletePreviewImages(cursor);
+    lastNum += previewImageLinks(imageLinks, cursor);
+
+    // Preview images not claimed by any link are obsolete.
+    for (auto id : p_candidates) {
+        auto it = m_previewImages.find(id);
+        if (it != m_previewImages.end() && it->m_timeStamp != m_timeStamp) {
+            qDebug() << "obsolete preview image" << it->toString();
+            m_previewImages.erase(it);
+        }
+    }
+
+    clearObsoletePreviewImagesInRange(firstNum, lastNum, cursor);
 }
 
 void VImagePreviewer::initImageFormat(QTextImageFormat &p_imgFormat,
@@ -90,10 +216,11 @@ void VImagePreviewer::initImageFormat(QTextImageFormat &p_imgFormat,
                                              : (int)PreviewImageType::Inline);
 }
 
-void VImagePreviewer::previewImageLinks(QVector<ImageLinkInfo> &p_imageLinks,
-                                        QTextCursor &p_cursor)
+int VImagePreviewer::previewImageLinks(QVector<ImageLinkInfo> &p_imageLinks,
+                                       QTextCursor &p_cursor)
 {
     bool hasNewPreview = false;
+    int nrNewBlocks = 0;
     EditStatus status;
     for (int i = 0; i < p_imageLinks.size(); ++i) {
         ImageLinkInfo &link = p_imageLinks[i];
@@ -119,6 +246,7 @@ void VImagePreviewer::previewImageLinks(QVector<ImageLinkInfo> &p_imageLinks,
         if (link.m_isBlock) {
             p_cursor.movePosition(QTextCursor::EndOfBlock);
             VEditUtils::insertBlockWithIndent(p_cursor);
+            ++nrNewBlocks;
         }
 
         p_cursor.insertImage(imgFormat);
@@ -129,6 +257,7 @@ void VImagePreviewer::previewImageLinks(QVector<ImageLinkInfo> &p_imageLinks,
         Q_ASSERT(!m_previewImages.contains(info.m_id));
         m_previewImages.insert(info.m_id, info);
         link.m_previewImageID = info.m_id;
+        m_regionPreviewIDs[link.m_regionIndex] = info.m_id;
 
         hasNewPreview = true;
         qDebug() << "preview new image" << info.toString();
@@ -137,6 +266,8 @@ void VImagePreviewer::previewImageLinks(QVector<ImageLinkInfo> &p_imageLinks,
     if (hasNewPreview) {
         emit m_edit->statusChanged();
     }
+
+    return nrNewBlocks;
 }
 
 void VImagePreviewer::clearObsoletePreviewImages(QTextCursor &p_cursor)
@@ -181,6 +312,32 @@ void VImagePreviewer::clearObsoletePreviewImages(QTextCursor &p_cursor)
     }
 }
 
+void VImagePreviewer::clearObsoletePreviewImagesInRange(int p_firstBlock,
+                                                        int p_lastBlock,
+                                                        QTextCursor &p_cursor)
+{
+    bool hasObsolete = false;
+    QTextBlock block = m_document->findBlockByNumber(p_lastBlock);
+    if (!block.isValid()) {
+        block = m_document->lastBlock();
+    }
+
+    // From back to front, since the block may be deleted.
+    while (block.isValid() && block.blockNumber() >= p_firstBlock) {
+        QTextBlock prevBlock = block.previous();
+        if (VTextBlockData::containsPreviewImage(block)) {
+            // Notice the short circuit.
+            hasObsolete = clearObsoletePreviewImagesOfBlock(block, p_cursor) || hasObsolete;
+        }
+
+        block = prevBlock;
+    }
+
+    if (hasObsolete) {
+        emit m_edit->statusChanged();
+    }
+}
+
 bool VImagePreviewer::isImageSourcePreviewImage(const QTextImageFormat &p_format) const
 {
     if (!p_format.isValid()) {
@@ -267,7 +424,10 @@ static bool isAllSpacesOrObject(const QString &p_text, int p_start, int p_end)
     return true;
 }
 
-void VImagePreviewer::fetchImageLinksFromRegions(QVector<ImageLinkInfo> &p_imageLinks)
+void VImagePreviewer::fetchImageLinksFromRegions(int p_start,
+                                                 int p_end,
+                                                 QVector<ImageLinkInfo> &p_imageLinks,
+                                                 QSet<long long> &p_candidates)
 {
     p_imageLinks.clear();
 
@@ -275,10 +435,17 @@ void VImagePreviewer::fetchImageLinksFromRegions(QVector<ImageLinkInfo> &p_image
         return;
     }
 
-    p_imageLinks.reserve(m_imageRegions.size());
-
     for (int i = 0; i < m_imageRegions.size(); ++i) {
         VElementRegion &reg = m_imageRegions[i];
+        if (reg.m_endPos <= p_start || reg.m_startPos >= p_end) {
+            continue;
+        }
+
+        // Check the previous preview image of this link again.
+        if (m_regionPreviewIDs[i] != -1) {
+            p_candidates.insert(m_regionPreviewIDs[i]);
+        }
+
         QTextBlock block = m_document->findBlock(reg.m_startPos);
         if (!block.isValid()) {
             continue;
@@ -289,6 +456,7 @@ void VImagePreviewer::fetchImageLinksFromRegions(QVector<ImageLinkInfo> &p_image
         QString text = block.text();
         Q_ASSERT(reg.m_endPos <= blockEnd);
         ImageLinkInfo info(reg.m_startPos, reg.m_endPos);
+        info.m_regionIndex = i;
         if ((reg.m_startPos == blockStart
              || isAllSpacesOrObject(text, 0, reg.m_startPos - blockStart))
             && (reg.m_endPos == blockEnd
@@ -305,6 +473,7 @@ void VImagePreviewer::fetchImageLinksFromRegions(QVector<ImageLinkInfo> &p_image
 
         // Check if this image link has been previewed previously.
         info.m_previewImageID = isImageLinkPreviewed(info);
+        m_regionPreviewIDs[i] = info.m_previewImageID;
 
         // Sorted in descending order of m_startPos.
         p_imageLinks.append(info);
@@ -363,7 +532,7 @@ long long VImagePreviewer::isImageLinkPreviewed(const ImageLinkInfo &p_info)
     return imageID;
 }
 
-bool VImagePreviewer::isImagePreviewBlock(const QTextBlock &p_block)
+bool VImagePreviewer::isImagePreviewBlock(const QTextBlock &p_block) const
 {
     if (!p_block.isValid()) {
         return false;
@@ -373,6 +542,57 @@ bool VImagePreviewer::isImagePreviewBlock(const QTextBlock &p_block)
     return text == QString(QChar::ObjectReplacementCharacter);
 }
 
+bool VImagePreviewer::fetchPreviewImageRegions(QVector<VElementRegion> &p_regions) const
+{
+    p_regions.clear();
+    if (m_isPreviewing || m_regionPreviewIDs.size() != m_imageRegions.size()) {
+        return false;
+    }
+
+    // m_imageRegions is in descending order.
+    int lastEnd = 0;
+    for (int i = m_imageRegions.size() - 1; i >= 0; --i) {
+        long long id = m_regionPreviewIDs[i];
+        if (id == -1) {
+            continue;
+        }
+
+        auto it = m_previewImages.find(id);
+        if (it == m_previewImages.end()) {
+            return false;
+        }
+
+        const VElementRegion &reg = m_imageRegions[i];
+        VElementRegion previewReg;
+        QTextImageFormat format;
+        if (it->m_isBlock) {
+            QTextBlock block = m_document->findBlock(reg.m_startPos).next();
+            if (!isImagePreviewBlock(block)) {
+                return false;
+            }
+
+            format = fetchFormatFromPreviewBlock(block);
+            previewReg = VElementRegion(block.position(), block.position() + block.length());
+        } else {
+            format = VPreviewUtils::fetchFormatFromPosition(m_document, reg.m_endPos);
+            previewReg = VElementRegion(reg.m_endPos, reg.m_endPos + 1);
+        }
+
+        // Regions may be stale if the document has changed since last parse.
+        if (!isImageSourcePreviewImage(format)
+            || VPreviewUtils::getPreviewImageID(format) != id
+            || previewReg.m_startPos < lastEnd) {
+            p_regions.clear();
+            return false;
+        }
+
+        lastEnd = previewReg.m_endPos;
+        p_regions.append(previewReg);
+    }
+
+    return true;
+}
+
 QString VImagePreviewer::fetchImageUrlToPreview(const QString &p_text)
 {
     QRegExp regExp(VUtils::c_imageLinkRegExp);
@@ -430,6 +650,7 @@ QString VImagePreviewer::fetchImagePathToPreview(const QString &p_text)
 void VImagePreviewer::clearAllPreviewImages()
 {
     m_imageRegions.clear();
+    m_regionPreviewIDs.clear();
     ++m_timeStamp;
 
     QTextCursor cursor(m_document);
@@ -461,25 +682,144 @@ QString VImagePreviewer::imageCacheResourceName(const QString &p_imagePath)
     }
 
     // Add it to the resource cache even if it may exist there.
+    QString name(imagePathToCacheResourceName(p_imagePath));
+    QImage image;
     QFileInfo info(p_imagePath);
+    if (!info.exists()) {
+        // URL. Try to download it if it is not cached.
+        if (!g_imageCache->get(p_imagePath, 0, image)) {
+            m_downloader->download(p_imagePath, true);
+            return QString();
+        }
+
+        m_document->addResource(QTextDocument::ImageResource, name, image);
+        m_imageCache.insert(p_imagePath, ImageInfo(name, image.width(), image.width()));
+        return name;
+    }
+
+    // Local file.
+    QSize size = VImageDecoder::imageSize(p_imagePath);
+    if (!size.isValid()) {
+        // The size is unknown until decoded.
+        if (g_imageCache->get(p_imagePath, 0, image)) {
+            m_document->addResource(QTextDocument::ImageResource, name, image);
+            m_imageCache.insert(p_imagePath, ImageInfo(name, image.width(), image.width()));
+            return name;
+        }
+
+        // Insert a placeholder of fixed size and resize it after decoding.
+        m_document->addResource(QTextDocument::ImageResource, name,
+                                placeholderImage(QSize(c_minImageWidth, c_minImageWidth)));
+        it = m_imageCache.insert(p_imagePath, ImageInfo(name, c_minImageWidth, 0));
+        it->m_sizeUnknown = true;
+        g_imageCache->decode(p_imagePath, 0);
+        return name;
+    }
+
+    int width = decodeWidth(size.width());
+    if (g_imageCache->get(p_imagePath, width, image)) {
+        m_document->addResource(QTextDocument::ImageResource, name, image);
+        m_imageCache.insert(p_imagePath, ImageInfo(name, size.width(), image.width()));
+        return name;
+    }
+
+    // Insert a placeholder with the same aspect ratio so that the layout
+    // will not change after decoding.
+    m_document->addResource(QTextDocument::ImageResource, name,
+                            placeholderImage(VImageDecoder::scaledSize(size, width)));
+    it = m_imageCache.insert(p_imagePath, ImageInfo(name, size.width(), 0));
+    it->m_decodingWidth = width;
+    g_imageCache->decode(p_imagePath, width);
+
+    return name;
+}
+
+QImage VImagePreviewer::placeholderImage(const QSize &p_size)
+{
+    QImage placeholder(p_size, QImage::Format_Mono);
+    placeholder.setColorCount(2);
+    placeholder.setColor(0, qRgb(0xee, 0xee, 0xee));
+    placeholder.setColor(1, qRgb(0xee, 0xee, 0xee));
+    placeholder.fill(0);
+    return placeholder;
+}
+
+int VImagePreviewer::decodeWidth(int p_width) const
+{
+    if (g_config->getEnablePreviewImageConstraint()) {
+        return qMin(maxDecodeWidth(m_edit->size().width()), p_width);
+    }
+
+    return p_width;
+}
+
+int VImagePreviewer::maxDecodeWidth(int p_editWidth)
+{
+    // Round it up so that images could be shared among editors of similar
+    // width, and the thumbnails survive small resizes.
+    int width = qMax(p_editWidth - 50, c_minImageWidth);
+    return (width + c_decodeWidthStep - 1) / c_decodeWidthStep * c_decodeWidthStep;
+}
+
+void VImagePreviewer::decodeImage(const QString &p_imagePath, int p_width)
+{
+    auto it = m_imageCache.find(p_imagePath);
+    Q_ASSERT(it != m_imageCache.end());
+    it->m_decodingWidth = p_width;
+
     QImage image;
-    if (info.exists()) {
-        // Local file.
-        image = QImage(p_imagePath);
+    if (g_imageCache->get(p_imagePath, p_width, image)) {
+        imageDecoded(p_imagePath, image, p_width);
     } else {
-        // URL. Try to download it.
-        m_downloader->download(p_imagePath);
+        g_imageCache->decode(p_imagePath, p_width);
+    }
+}
+
+void VImagePreviewer::imageDecoded(const QString &p_path, const QImage &p_image, int p_width)
+{
+    auto it = m_imageCache.find(p_path);
+    if (it == m_imageCache.end()) {
+        return;
     }
 
-    if (image.isNull()) {
-        return QString();
+    if (it->m_sizeUnknown) {
+        if (p_width != 0) {
+            return;
+        }
+
+        it->m_sizeUnknown = false;
+        if (p_image.isNull()) {
+            return;
+        }
+
+        // The placeholder is of fixed size. Resize the preview images.
+        m_document->addResource(QTextDocument::ImageResource, it->m_name, p_image);
+        it->m_width = p_image.width();
+        it->m_decodedWidth = p_image.width();
+
+        qDebug() << "image of unknown size decoded" << p_path << p_image.size();
+
+        updatePreviewImageWidth();
+        return;
     }
 
-    QString name(imagePathToCacheResourceName(p_imagePath));
-    m_document->addResource(QTextDocument::ImageResource, name, image);
-    m_imageCache.insert(p_imagePath, ImageInfo(name, image.width()));
+    if (it->m_decodingWidth != p_width) {
+        // Obsolete decoding.
+        return;
+    }
 
-    return name;
+    it->m_decodingWidth = 0;
+    if (p_image.isNull()) {
+        return;
+    }
+
+    // Replace the placeholder. The layout keeps the same.
+    m_document->addResource(QTextDocument::ImageResource, it->m_name, p_image);
+    it->m_decodedWidth = p_image.width();
+
+    qDebug() << "image decoded" << p_path << p_image.size();
+
+    m_edit->viewport()->update();
 }
 
 QString VImagePreviewer::imagePathToCacheResourceName(const QString &p_imagePath)
@@ -497,9 +837,11 @@ void VImagePreviewer::imageDownloaded(const QByteArray &p_data, const QString &p
             return;
         }
 
+        g_imageCache->put(p_url, 0, image);
+
         QString name(imagePathToCacheResourceName(p_url));
         m_document->addResource(QTextDocument::ImageResource, name, image);
-        m_imageCache.insert(p_url, ImageInfo(name, image.width()));
+        m_imageCache.insert(p_url, ImageInfo(name, image.width(), image.width()));
 
         qDebug() << "downloaded image cache insert" << p_url << name;
         emit requestUpdateImageLinks();
@@ -523,6 +865,14 @@ QImage VImagePreviewer::fetchCachedImageByID(long long p_id)
         return QImage();
     }
 
+    // The preview may be decoded at a smaller size.
+    if (it.value().m_decodedWidth != it.value().m_width && QFileInfo::exists(path)) {
+        QImage image(path);
+        if (!image.isNull()) {
+            return image;
+        }
+    }
+
     return m_document->resource(QTextDocument::ImageResource, it.value().m_name).value<QImage>();
 }
 
@@ -582,6 +932,19 @@ void VImagePreviewer::doUpdatePreviewImageWidth()
         emit m_edit->statusChanged();
     }
 
+    // Decode local images again if they are shown larger now.
+    for (auto it = m_imageCache.begin(); it != m_imageCache.end(); ++it) {
+        ImageInfo &info = it.value();
+        if (info.m_decodedWidth == 0 && info.m_decodingWidth == 0) {
+            // Failed to decode.
+            continue;
+        }
+
+        if (decodeWidth(info.m_width) > qMax(info.m_decodedWidth, info.m_decodingWidth)) {
+            decodeImage(it.key(), decodeWidth(info.m_width));
+        }
+    }
+
     qDebug() << "update preview image width" << updated;
 
     emit previewWidthUpdated();
@@ -626,21 +989,20 @@ bool VImagePreviewer::updatePreviewImageWidthOfBlock(const QTextBlock &p_block,
 
 void VImagePreviewer::shrinkImageCache()
 {
-    const int MaxSize = 20;
-    if (m_imageCache.size() > m_previewImages.size()
-        && m_imageCache.size() > MaxSize) {
-        QHash<QString, bool> usedImagePath;
-        for (auto it = m_previewImages.begin(); it != m_previewImages.end(); ++it) {
-            usedImagePath.insert(it->m_path, true);
-        }
-
-        for (auto it = m_imageCache.begin(); it != m_imageCache.end();) {
-            if (!usedImagePath.contains(it.key())) {
-                qDebug() << "shrink one image" << it.key();
-                it = m_imageCache.erase(it);
-            } else {
-                ++it;
-            }
+    // Decoded images are kept in the global image cache, so release the
+    // resources not used by any preview image.
+    QSet<QString> usedImagePath;
+    for (auto it = m_previewImages.begin(); it != m_previewImages.end(); ++it) {
+        usedImagePath.insert(it->m_path);
+    }
+
+    for (auto it = m_imageCache.begin(); it != m_imageCache.end();) {
+        if (!usedImagePath.contains(it.key())) {
+            qDebug() << "shrink one image" << it.key();
+            m_document->addResource(QTextDocument::ImageResource, it.value().m_name, QImage());
+            it = m_imageCache.erase(it);
+        } else {
+            ++it;
         }
     }
 }
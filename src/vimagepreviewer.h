@@ -5,6 +5,7 @@
 #include <QString>
 #include <QTextBlock>
 #include <QHash>
+#include <QSet>
 #include "hgmarkdownhighlighter.h"
 
 class QTimer;
@@ -22,7 +23,7 @@ public:
     // Whether @p_block is an image previewed block.
     // The image previewed block is a block containing only the special character
     // and whitespaces.
-    bool isImagePreviewBlock(const QTextBlock &p_block);
+    bool isImagePreviewBlock(const QTextBlock &p_block) const;
 
     QImage fetchCachedImageByID(long long p_id);
 
@@ -31,11 +32,21 @@ public:
 
     bool isPreviewing() const;
 
+    // Fetch the regions of text occupied by preview images in ascending order,
+    // according to the index of previewed image links. A block preview image
+    // occupies the whole block.
+    // Returns false if the index does not match the document.
+    bool fetchPreviewImageRegions(QVector<VElementRegion> &p_regions) const;
+
     bool isEnabled() const;
 
+    // Max width to decode local images at in an editor of width @p_editWidth.
+    static int maxDecodeWidth(int p_editWidth);
+
 public slots:
-    // Image links have changed.
-    void imageLinksChanged(const QVector<VElementRegion> &p_imageRegions);
+    // Image links have changed by @p_delta.
+    void imageLinksChanged(const QVector<VElementRegion> &p_imageRegions,
+                           const VRegionsDelta &p_delta);
 
 private slots:
     // Non-local image downloaded for preview.
@@ -44,6 +55,9 @@ private slots:
     // Update preview image width right now.
     void doUpdatePreviewImageWidth();
 
+    // Local image decoded in the thread pool.
+    void imageDecoded(const QString &p_path, const QImage &p_image, int p_width);
+
 signals:
     // Request highlighter to update image links.
     void requestUpdateImageLinks();
@@ -57,26 +71,40 @@ signals:
 private:
     struct ImageInfo
     {
-        ImageInfo(const QString &p_name, int p_width)
-            : m_name(p_name), m_width(p_width)
+        ImageInfo(const QString &p_name, int p_width, int p_decodedWidth)
+            : m_name(p_name), m_width(p_width),
+              m_decodedWidth(p_decodedWidth), m_decodingWidth(0),
+              m_sizeUnknown(false)
         {
         }
 
         QString m_name;
+
+        // Width of the original image.
         int m_width;
+
+        // Width of the image in the resource. 0 if it is still a placeholder.
+        int m_decodedWidth;
+
+        // Width of the pending decoding. 0 if there is none.
+        int m_decodingWidth;
+
+        // Whether the image is being decoded at full size to know its size.
+        // @m_width is the width of the placeholder till then.
+        bool m_sizeUnknown;
     };
 
     struct ImageLinkInfo
     {
         ImageLinkInfo()
             : m_startPos(-1), m_endPos(-1),
-              m_isBlock(false), m_previewImageID(-1)
+              m_isBlock(false), m_previewImageID(-1), m_regionIndex(-1)
         {
         }
 
         ImageLinkInfo(int p_startPos, int p_endPos)
             : m_startPos(p_startPos), m_endPos(p_endPos),
-              m_isBlock(false), m_previewImageID(-1)
+              m_isBlock(false), m_previewImageID(-1), m_regionIndex(-1)
         {
         }
 
@@ -90,6 +118,9 @@ private:
         // The previewed image ID if this link has been previewed.
         // -1 if this link has not yet been previewed.
         long long m_previewImageID;
+
+        // Index of the region of this link in m_imageRegions.
+        int m_regionIndex;
     };
 
     // Info about a previewed image.
@@ -129,27 +160,42 @@ private:
         bool m_modified;
     };
 
-    // Kick off new preview of m_imageRegions.
-    void kickOffPreview(const QVector<VElementRegion> &p_imageRegions);
+    // Kick off new preview of the image links changed by @p_delta.
+    void kickOffPreview(const QVector<VElementRegion> &p_imageRegions,
+                        const VRegionsDelta &p_delta);
 
-    // Preview images according to m_timeStamp and m_imageRegions.
-    void previewImages();
+    // Preview images of links within the blocks of [@p_start, @p_end], and
+    // clear obsolete preview images within these blocks.
+    // @p_candidates: IDs of preview images which may be obsolete. Those not
+    // claimed by any link are removed.
+    void previewImages(int p_start, int p_end, QSet<long long> &p_candidates);
 
-    // According to m_imageRegions, fetch the image link Url.
+    // According to m_imageRegions, fetch the image link Url of links within
+    // [@p_start, @p_end).
     // Will check if this link has been previewed correctly and mark the previewed
     // image with the newest timestamp.
+    // Previous preview images of these links are added to @p_candidates.
     // @p_imageLinks should be sorted in descending order of m_startPos.
-    void fetchImageLinksFromRegions(QVector<ImageLinkInfo> &p_imageLinks);
+    void fetchImageLinksFromRegions(int p_start,
+                                    int p_end,
+                                    QVector<ImageLinkInfo> &p_imageLinks,
+                                    QSet<long long> &p_candidates);
 
     // Preview not previewed image links in @p_imageLinks.
     // Insert the preview block with same indentation with the link block.
     // @p_imageLinks should be sorted in descending order of m_startPos.
-    void previewImageLinks(QVector<ImageLinkInfo> &p_imageLinks, QTextCursor &p_cursor);
+    // Returns the number of new preview blocks.
+    int previewImageLinks(QVector<ImageLinkInfo> &p_imageLinks, QTextCursor &p_cursor);
 
     // Clear obsolete preview images whose timeStamp does not match current one
     // or does not exist in the cache.
     void clearObsoletePreviewImages(QTextCursor &p_cursor);
 
+    // Clear obsolete preview images within blocks [@p_firstBlock, @p_lastBlock].
+    void clearObsoletePreviewImagesInRange(int p_firstBlock,
+                                           int p_lastBlock,
+                                           QTextCursor &p_cursor);
+
     // Clear obsolete preview image in @p_block.
     // A preview image is obsolete if it is not in the cache.
     // If it is a preview block, delete the whole block.
@@ -185,14 +231,30 @@ private:
 
     // Look up m_imageCache to get the resource name in QTextDocument's cache.
     // If there is none, insert it.
+    // Local images are inserted as placeholders of the same size, or of a
+    // fixed size if the size could not be read from the header, and decoded
+    // asynchronously.
     QString imageCacheResourceName(const QString &p_imagePath);
 
+    // Decode local image @p_imagePath at width @p_width in the thread pool.
+    void decodeImage(const QString &p_imagePath, int p_width);
+
+    // The width to decode an image of width @p_width at for display.
+    int decodeWidth(int p_width) const;
+
+    // End position of the block where the preview of the image link ending
+    // at @p_pos lies.
+    int previewBlockEnd(int p_pos) const;
+
+    // Image of size @p_size to show before the image is decoded.
+    static QImage placeholderImage(const QSize &p_size);
+
     QString imagePathToCacheResourceName(const QString &p_imagePath);
 
     // Return true if and only if there is update.
     bool updateImageWidth(QTextImageFormat &p_format);
 
-    // Clean up image cache.
+    // Remove images not used by any preview image from the image cache.
     void shrinkImageCache();
 
     void saveEditStatus(EditStatus &p_status) const;
@@ -225,6 +287,9 @@ private:
     // Regions of all the image links.
     QVector<VElementRegion> m_imageRegions;
 
+    // Preview image ID of each region in m_imageRegions. -1 if not previewed.
+    QVector<long long> m_regionPreviewIDs;
+
     // Timer for updatePreviewImageWidth().
     QTimer *m_updateTimer;
 
@@ -235,6 +300,9 @@ private:
     bool m_isPreviewing;
 
     static const int c_minImageWidth;
+
+    // Local images are decoded at a multiple of it.
+    static const int c_decodeWidthStep;
 };
 
 inline bool VImagePreviewer::isPreviewing() const
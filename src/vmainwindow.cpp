@@ -26,9 +26,16 @@
 #include "vorphanfile.h"
 #include "dialog/vorphanfileinfodialog.h"
 #include "vsingleinstanceguard.h"
+#include "vimagepreviewer.h"
+#include "vthumbnailcache.h"
+#include "vconfigwritequeue.h"
 
 extern VConfigManager *g_config;
 
+extern VThumbnailCache *g_thumbnailCache;
+
+extern VConfigWriteQueue *g_configWriteQueue;
+
 VNote *g_vnote;
 
 const int VMainWindow::c_sharedMemTimerInterval = 1000;
@@ -62,6 +69,9 @@ VMainWindow::VMainWindow(VSingleInstanceGuard *p_guard, QWidget *p_parent)
     initCaptain();
 
     initSharedMemoryWatcher();
+
+    connect(g_configWriteQueue, &VConfigWriteQueue::writeFailed,
+            this, &VMainWindow::handleConfigWriteFailed);
 }
 
 void VMainWindow::initSharedMemoryWatcher()
@@ -1748,6 +1758,17 @@ void VMainWindow::handleCurrentDirectoryChanged(const VDirectory *p_dir)
 void VMainWindow::handleCurrentNotebookChanged(const VNotebook *p_notebook)
 {
     newRootDirAct->setEnabled(p_notebook);
+
+    // Generate thumbnails of the images of the notebook in background.
+    // Wait until the edit area is laid out to get its width.
+    if (p_notebook
+        && g_config->getEnablePreviewImages()
+        && g_config->getEnablePreviewImageConstraint()) {
+        QString path = p_notebook->getPath();
+        QTimer::singleShot(0, this, [this, path]() {
+            g_thumbnailCache->prewarm(path, VImagePreviewer::maxDecodeWidth(editArea->width()));
+        });
+    }
 }
 
 void VMainWindow::resizeEvent(QResizeEvent *event)
@@ -1992,6 +2013,17 @@ void VMainWindow::showStatusMessage(const QString &p_msg)
     statusBar()->showMessage(p_msg, timeout);
 }
 
+void VMainWindow::handleConfigWriteFailed(const QStringList &p_paths)
+{
+    VUtils::showMessage(QMessageBox::Warning, tr("Warning"),
+                        tr("Fail to write the configuration of %1 folder(s).").arg(p_paths.size()),
+                        tr("Changes such as the order of notes are not saved yet and will be "
+                           "written again later. Please check if these folders are writable: "
+                           "<span style=\"%1\">%2</span>.")
+                          .arg(g_config->c_dataTextStyle).arg(p_paths.join(", ")),
+                        QMessageBox::Ok, QMessageBox::Ok, this);
+}
+
 void VMainWindow::updateStatusInfo(const VEditTabInfo &p_info)
 {
     if (m_curTab) {
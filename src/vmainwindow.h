@@ -110,6 +110,9 @@ private slots:
     // Show a temporary message in status bar.
     void showStatusMessage(const QString &p_msg);
 
+    // Warn the user that configs of folders @p_paths failed to be written.
+    void handleConfigWriteFailed(const QStringList &p_paths);
+
     // Handle Vim status updated.
     void handleVimStatusUpdated(const VVim *p_vim);
 
@@ -0,0 +1,212 @@
+#include "vmarkdownparseworker.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+
+VMarkdownParseWorker::VMarkdownParseWorker(const QVector<HighlightingStyle> &p_styles,
+                                           QObject *p_parent)
+    : QObject(p_parent), m_latestRevision(0)
+{
+    m_styleTypes.reserve(p_styles.size());
+    for (auto const &style : p_styles) {
+        m_styleTypes.append(style.type);
+    }
+
+    m_arena = pmh_arena_new();
+}
+
+VMarkdownParseWorker::~VMarkdownParseWorker()
+{
+    pmh_arena_free(m_arena);
+    m_arena = NULL;
+}
+
+void VMarkdownParseWorker::setLatestRevision(int p_revision)
+{
+    m_latestRevision.store(p_revision);
+}
+
+void VMarkdownParseWorker::parse(const HLParseRequest &p_request)
+{
+    if (p_request.m_revision != m_latestRevision.load()) {
+        qDebug() << "parse worker skip obsolete request of revision" << p_request.m_revision;
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QSharedPointer<HLParseResult> result(new HLParseResult());
+    result->m_request = p_request;
+    result->m_request.m_text.clear();
+    result->m_elements.resize(pmh_NUM_LANG_TYPES);
+
+    QByteArray ba = p_request.m_text.toUtf8();
+    if (!ba.isEmpty()) {
+        // The elements will be released by the next parse.
+        pmh_element **elements = NULL;
+        pmh_markdown_to_elements_in_arena(ba.data(), pmh_EXT_NONE, m_arena, &elements);
+        if (elements) {
+            int offset = p_request.m_offset;
+            HLOffsetTable table(p_request.m_text);
+            for (int i = 0; i < pmh_NUM_LANG_TYPES; ++i) {
+                QVector<VElementRegion> &regions = result->m_elements[i];
+                pmh_element *elem = elements[i];
+                while (elem != NULL) {
+                    // elem->pos and elem->end is the start and end position
+                    // of the element in the parsed text, in code points.
+                    if (elem->end > elem->pos) {
+                        regions.push_back(VElementRegion(table.toStringOffset(elem->pos) + offset,
+                                                         table.toStringOffset(elem->end) + offset));
+                    }
+
+                    elem = elem->next;
+                }
+            }
+        }
+    }
+
+    initBlockHighlights(p_request.m_text, *result);
+
+    qDebug() << "parse worker parse revision" << p_request.m_revision
+             << "of" << p_request.m_text.size() << "chars in" << timer.elapsed() << "ms";
+
+    emit parseFinished(result);
+}
+
+int VMarkdownParseWorker::blockIndexOfPosition(const QVector<int> &p_blockStarts, int p_pos)
+{
+    Q_ASSERT(p_blockStarts.size() > 1);
+    auto it = std::upper_bound(p_blockStarts.begin(), p_blockStarts.end() - 1, p_pos);
+    int idx = it - p_blockStarts.begin() - 1;
+    return qMax(idx, 0);
+}
+
+// Highlight unit with the position in the parsed text.
+struct HLElementUnit
+{
+    int m_start;
+    int m_end;
+    unsigned int m_styleIndex;
+};
+
+static bool HLElementUnitComp(const HLElementUnit &p_a, const HLElementUnit &p_b)
+{
+    if (p_a.m_start != p_b.m_start) {
+        return p_a.m_start < p_b.m_start;
+    }
+
+    return p_a.m_styleIndex < p_b.m_styleIndex;
+}
+
+static bool HLUnitStyleIndexComp(const HLUnit &p_a, const HLUnit &p_b)
+{
+    return p_a.styleIndex < p_b.styleIndex;
+}
+
+void VMarkdownParseWorker::initBlockHighlights(const QString &p_text,
+                                               HLParseResult &p_result) const
+{
+    const HLParseRequest &req = p_result.m_request;
+
+    // Start positions of blocks. The text of an incremental parse ends with
+    // a new line, while the text of the whole document does not.
+    QVector<int> starts;
+    starts.append(req.m_offset);
+    for (int i = 0; i < p_text.size(); ++i) {
+        if (p_text[i] == '\n') {
+            starts.append(req.m_offset + i + 1);
+        }
+    }
+
+    if (!req.m_incremental) {
+        starts.append(req.m_offset + p_text.size() + 1);
+    }
+
+    int nrBlocks = starts.size() - 1;
+    HLBlockUnits<HLUnit> &highlights = p_result.m_blockHighlights;
+
+    // Sort elements of all styles by position.
+    QVector<HLElementUnit> units;
+    for (int i = 0; i < m_styleTypes.size(); ++i) {
+        if (m_styleTypes[i] >= p_result.m_elements.size()) {
+            continue;
+        }
+
+        const QVector<VElementRegion> &regs = p_result.m_elements[m_styleTypes[i]];
+        for (auto const &reg : regs) {
+            HLElementUnit unit;
+            unit.m_start = reg.m_startPos;
+            unit.m_end = reg.m_endPos;
+            unit.m_styleIndex = i;
+            units.append(unit);
+        }
+    }
+
+    std::sort(units.begin(), units.end(), HLElementUnitComp);
+
+    // Walk through the blocks twice: count the units of each block first and
+    // then fill them in the flat array.
+    QVector<int> counts(nrBlocks, 0);
+    int blockIdx = 0;
+    for (auto const &unit : units) {
+        while (blockIdx < nrBlocks - 1 && starts[blockIdx + 1] <= unit.m_start) {
+            ++blockIdx;
+        }
+
+        int endIdx = blockIdx;
+        while (endIdx < nrBlocks - 1 && starts[endIdx + 1] <= unit.m_end) {
+            ++endIdx;
+        }
+
+        for (int i = blockIdx; i <= endIdx; ++i) {
+            ++counts[i];
+        }
+    }
+
+    highlights.setUnitCounts(counts);
+
+    // Next unit to fill of each block.
+    counts.fill(0);
+    blockIdx = 0;
+    for (auto const &unit : units) {
+        while (blockIdx < nrBlocks - 1 && starts[blockIdx + 1] <= unit.m_start) {
+            ++blockIdx;
+        }
+
+        int endIdx = blockIdx;
+        while (endIdx < nrBlocks - 1 && starts[endIdx + 1] <= unit.m_end) {
+            ++endIdx;
+        }
+
+        for (int i = blockIdx; i <= endIdx; ++i) {
+            int blockStartPos = starts[i];
+            int blockLength = starts[i + 1] - blockStartPos;
+            HLUnit hl;
+            if (i == blockIdx) {
+                hl.start = unit.m_start - blockStartPos;
+                hl.length = (blockIdx == endIdx) ?
+                            (unit.m_end - unit.m_start) : (blockLength - hl.start);
+            } else if (i == endIdx) {
+                hl.start = 0;
+                hl.length = unit.m_end - blockStartPos;
+            } else {
+                hl.start = 0;
+                hl.length = blockLength;
+            }
+
+            hl.styleIndex = unit.m_styleIndex;
+            highlights.units(i)[counts[i]++] = hl;
+        }
+    }
+
+    // Units of latter styles should be applied later.
+    for (int i = 0; i < nrBlocks; ++i) {
+        int nrUnits = highlights.unitCount(i);
+        if (nrUnits > 1) {
+            HLUnit *blockUnits = highlights.units(i);
+            std::stable_sort(blockUnits, blockUnits + nrUnits, HLUnitStyleIndexComp);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef VMARKDOWNPARSEWORKER_H
+#define VMARKDOWNPARSEWORKER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QVector>
+#include "hgmarkdownhighlighter.h"
+
+// Parse Markdown text with PEG Markdown Highlight in a background thread.
+// Results are delivered via parseFinished(), which should be connected with
+// a queued connection.
+class VMarkdownParseWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VMarkdownParseWorker(const QVector<HighlightingStyle> &p_styles,
+                                  QObject *p_parent = 0);
+
+    ~VMarkdownParseWorker();
+
+    // Set the revision of the latest request. Pending requests of other
+    // revisions are obsolete and will be skipped.
+    // Could be called from any thread.
+    void setLatestRevision(int p_revision);
+
+    // Return the index in @p_blockStarts of the block containing @p_pos.
+    // @p_blockStarts: start positions of consecutive blocks in ascending order,
+    // with the end position of the last block appended.
+    static int blockIndexOfPosition(const QVector<int> &p_blockStarts, int p_pos);
+
+public slots:
+    void parse(const HLParseRequest &p_request);
+
+signals:
+    void parseFinished(const QSharedPointer<HLParseResult> &p_result);
+
+private:
+    // Build the highlight units of each block within @p_text from the element
+    // regions of @p_result.
+    void initBlockHighlights(const QString &p_text, HLParseResult &p_result) const;
+
+    // Types of HighlightingStyles[], indexed by HLUnit.styleIndex.
+    QVector<pmh_element_type> m_styleTypes;
+
+    QAtomicInt m_latestRevision;
+
+    // Arena reused by all the parses to hold the elements.
+    pmh_arena *m_arena;
+};
+
+#endif // VMARKDOWNPARSEWORKER_H
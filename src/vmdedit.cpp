@@ -33,8 +33,12 @@ VMdEdit::VMdEdit(VFile *p_file, VDocument *p_vdoc, MarkdownConverterType p_type,
                                                 g_config->getMarkdownHighlightInterval(),
                                                 document());
 
+    m_mdHighlighter->setVisibleBlockRangeProvider([this](int &p_first, int &p_last) {
+        visibleBlockRange(p_first, p_last);
+    });
+
     connect(m_mdHighlighter, &HGMarkdownHighlighter::headersUpdated,
-            this, &VMdEdit::updateOutline);
+            this, &VMdEdit::updateHeaders);
 
     // After highlight, the cursor may trun into non-visible. We should make it visible
     // in this case.
@@ -505,6 +509,38 @@ void VMdEdit::updateOutline(const QVector<VElementRegion> &p_headerRegions)
     updateCurHeader();
 }
 
+void VMdEdit::updateHeaders(const QVector<VElementRegion> &p_headerRegions,
+                            const VRegionsDelta &p_delta)
+{
+    if (!p_delta.isShiftOnly()) {
+        updateOutline(p_headerRegions);
+        return;
+    }
+
+    // Headers within the same lines.
+    if (p_delta.m_blockDelta == 0) {
+        return;
+    }
+
+    // Line number of the first shifted line before the change.
+    QTextBlock block = document()->findBlock(p_delta.m_shiftPos);
+    if (!block.isValid()) {
+        updateOutline(p_headerRegions);
+        return;
+    }
+
+    int oldLine = block.firstLineNumber() - p_delta.m_blockDelta;
+    for (auto &header : m_headers) {
+        if (header.lineNumber >= oldLine) {
+            header.lineNumber += p_delta.m_blockDelta;
+        }
+    }
+
+    emit headersChanged(m_headers);
+
+    updateCurHeader();
+}
+
 void VMdEdit::scrollToHeader(const VAnchor &p_anchor)
 {
     if (p_anchor.lineNumber == -1
@@ -536,94 +572,89 @@ QString VMdEdit::toPlainTextWithoutImg()
 
 QString VMdEdit::getPlainTextWithoutPreviewImage() const
 {
-    QVector<Region> deletions;
-
-    while (true) {
-        deletions.clear();
+    QString text = toPlainText();
+    int nrObjects = text.count(QChar::ObjectReplacementCharacter);
+    if (nrObjects == 0) {
+        return text;
+    }
 
-        while (m_imagePreviewer->isPreviewing()) {
-            VUtils::sleepWait(100);
+    QVector<Region> deletions;
+    QVector<VElementRegion> previewRegions;
+    if (m_imagePreviewer->fetchPreviewImageRegions(previewRegions)
+        && previewRegions.size() == nrObjects) {
+        deletions.reserve(previewRegions.size());
+        for (auto const &reg : previewRegions) {
+            deletions.append(Region(reg.m_startPos, reg.m_endPos));
         }
-
-        // Iterate all the block to get positions for deletion.
+    } else {
+        // The index of the previewer does not cover all the objects.
+        // Iterate all the blocks to get positions for deletion.
+        deletions.reserve(nrObjects);
         QTextBlock block = document()->begin();
-        bool tryAgain = false;
         while (block.isValid()) {
             if (VTextBlockData::containsPreviewImage(block)) {
-                if (!getPreviewImageRegionOfBlock(block, deletions)) {
-                    tryAgain = true;
-                    break;
-                }
+                getPreviewImageRegionOfBlock(block, deletions);
             }
 
             block = block.next();
         }
+    }
 
-        if (tryAgain) {
-            continue;
+    // deletions is sorted by m_startPos.
+    // Copy the text between deletions in one pass.
+    QString res;
+    res.reserve(text.size());
+    int pos = 0;
+    for (auto const &reg : deletions) {
+        if (reg.m_startPos > pos) {
+            res.append(text.midRef(pos, reg.m_startPos - pos));
         }
 
-        QString text = toPlainText();
-        // deletions is sorted by m_startPos.
-        // From back to front.
-        for (int i = deletions.size() - 1; i >= 0; --i) {
-            const Region &reg = deletions[i];
-            qDebug() << "img region to delete" << reg.m_startPos << reg.m_endPos;
-            text.remove(reg.m_startPos, reg.m_endPos - reg.m_startPos);
-        }
+        pos = qMax(pos, reg.m_endPos);
+    }
 
-        return text;
+    if (pos < text.size()) {
+        res.append(text.midRef(pos));
     }
+
+    return res;
 }
 
-bool VMdEdit::getPreviewImageRegionOfBlock(const QTextBlock &p_block,
+void VMdEdit::getPreviewImageRegionOfBlock(const QTextBlock &p_block,
                                            QVector<Region> &p_regions) const
 {
     QTextDocument *doc = document();
     QVector<Region> regs;
     QString text = p_block.text();
     int nrOtherChar = 0;
-    int nrImage = 0;
     bool hasBlock = false;
 
-    // From back to front.
-    for (int i = text.size() - 1; i >= 0; --i) {
+    for (int i = 0; i < text.size(); ++i) {
         if (text[i].isSpace()) {
             continue;
         }
 
         if (text[i] == QChar::ObjectReplacementCharacter) {
             int pos = p_block.position() + i;
-            Q_ASSERT(doc->characterAt(pos) == QChar::ObjectReplacementCharacter);
-
             QTextImageFormat imageFormat = VPreviewUtils::fetchFormatFromPosition(doc, pos);
-            if (imageFormat.isValid()) {
-                ++nrImage;
-                bool isBlock = VPreviewUtils::getPreviewImageType(imageFormat) == PreviewImageType::Block;
-                if (isBlock) {
-                    hasBlock = true;
-                } else {
-                    regs.push_back(Region(pos, pos + 1));
-                }
-            } else {
-                return false;
+            if (imageFormat.isValid()
+                && VPreviewUtils::getPreviewImageType(imageFormat) == PreviewImageType::Block) {
+                hasBlock = true;
             }
+
+            regs.push_back(Region(pos, pos + 1));
         } else {
             ++nrOtherChar;
         }
     }
 
-    if (hasBlock) {
-        if (nrOtherChar > 0 || nrImage > 1) {
-            // Inconsistent state.
-            return false;
-        }
-
-        regs.push_back(Region(p_block.position(), p_block.position() + p_block.length()));
+    if (hasBlock && nrOtherChar == 0 && regs.size() == 1) {
+        // Delete the whole preview block.
+        regs[0] = Region(p_block.position(), p_block.position() + p_block.length());
     }
 
+    // Otherwise, just delete the objects.
     p_regions.append(regs);
-    return true;
 }
 
 void VMdEdit::handleClipboardChanged(QClipboard::Mode p_mode)
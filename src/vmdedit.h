@@ -55,6 +55,11 @@ signals:
 private slots:
     void updateOutline(const QVector<VElementRegion> &p_headerRegions);
 
+    // Header regions have been changed by @p_delta. Only shift the line
+    // numbers of headers if headers are not changed.
+    void updateHeaders(const QVector<VElementRegion> &p_headerRegions,
+                       const VRegionsDelta &p_delta);
+
     // When there is no header in current cursor, will signal an invalid header.
     void updateCurHeader();
 
@@ -100,9 +105,8 @@ private:
 
     QString getPlainTextWithoutPreviewImage() const;
 
-    // Try to get all the regions of preview image within @p_block.
-    // Returns false if preview image is not ready yet.
-    bool getPreviewImageRegionOfBlock(const QTextBlock &p_block,
+    // Get all the regions of preview image within @p_block in ascending order.
+    void getPreviewImageRegionOfBlock(const QTextBlock &p_block,
                                       QVector<Region> &p_regions) const;
 
     void finishOneAsyncJob(int p_idx);
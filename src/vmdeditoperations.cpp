@@ -165,7 +165,7 @@ bool VMdEditOperations::insertImageFromURL(const QUrl &imageUrl)
         VDownloader *downloader = new VDownloader(&dialog);
         connect(downloader, &VDownloader::downloadFinished,
                 &dialog, &VInsertImageDialog::imageDownloaded);
-        downloader->download(imageUrl.toString());
+        downloader->download(imageUrl.toString(), true);
     }
     if (dialog.exec() == QDialog::Accepted) {
         if (isLocal) {
@@ -0,0 +1,65 @@
+#ifndef VNAMEINDEX_H
+#define VNAMEINDEX_H
+
+#include <QString>
+#include <QHash>
+#include <QMultiHash>
+
+// Hash index of items by name, both case-sensitive and case-insensitive.
+// Items are not owned by the index.
+template <typename T>
+class VNameIndex
+{
+public:
+    void insert(const QString &p_name, T *p_item);
+
+    void remove(const QString &p_name, T *p_item);
+
+    // Returns NULL if there is no item named @p_name.
+    T *find(const QString &p_name, bool p_caseSensitive) const;
+
+    void clear();
+
+private:
+    QHash<QString, T *> m_names;
+
+    // Keyed by the lower case name. Names may differ only in case.
+    QMultiHash<QString, T *> m_lowerNames;
+};
+
+template <typename T>
+inline void VNameIndex<T>::insert(const QString &p_name, T *p_item)
+{
+    m_names.insert(p_name, p_item);
+    m_lowerNames.insert(p_name.toLower(), p_item);
+}
+
+template <typename T>
+inline void VNameIndex<T>::remove(const QString &p_name, T *p_item)
+{
+    auto it = m_names.find(p_name);
+    if (it != m_names.end() && it.value() == p_item) {
+        m_names.erase(it);
+    }
+
+    m_lowerNames.remove(p_name.toLower(), p_item);
+}
+
+template <typename T>
+inline T *VNameIndex<T>::find(const QString &p_name, bool p_caseSensitive) const
+{
+    if (p_caseSensitive) {
+        return m_names.value(p_name, NULL);
+    } else {
+        return m_lowerNames.value(p_name.toLower(), NULL);
+    }
+}
+
+template <typename T>
+inline void VNameIndex<T>::clear()
+{
+    m_names.clear();
+    m_lowerNames.clear();
+}
+
+#endif // VNAMEINDEX_H
@@ -1,13 +1,18 @@
 #include "vnotebook.h"
 #include <QDir>
 #include <QDebug>
+#include <QCryptographicHash>
 #include "vdirectory.h"
 #include "utils/vutils.h"
 #include "vconfigmanager.h"
 #include "vfile.h"
+#include "vnotebookindex.h"
+#include "vconfigwritequeue.h"
 
 extern VConfigManager *g_config;
 
+extern VConfigWriteQueue *g_configWriteQueue;
+
 VNotebook::VNotebook(const QString &name, const QString &path, QObject *parent)
     : QObject(parent), m_name(name)
 {
@@ -17,16 +22,22 @@ VNotebook::VNotebook(const QString &name, const QString &path, QObject *parent)
                                VUtils::directoryNameFromPath(path),
                                NULL,
                                QDateTime::currentDateTimeUtc());
+
+    QByteArray hash = QCryptographicHash::hash(m_path.toUtf8(), QCryptographicHash::Sha1);
+    QString indexFile = QString("%1.vindex").arg(QString::fromLatin1(hash.toHex()));
+    m_index = new VNotebookIndex(m_path,
+                                 QDir(g_config->getNotebookIndexFolder()).filePath(indexFile));
 }
 
 VNotebook::~VNotebook()
 {
     delete m_rootDir;
+    delete m_index;
 }
 
 bool VNotebook::readConfig()
 {
-    QJsonObject configJson = VConfigManager::readDirectoryConfig(m_path);
+    QJsonObject configJson = m_index->readDirectoryConfig(m_path);
     if (configJson.isEmpty()) {
         qWarning() << "fail to read notebook configuration" << m_path;
         return false;
@@ -76,14 +87,14 @@ QJsonObject VNotebook::toConfigJson() const
 
 bool VNotebook::writeToConfig() const
 {
-    return VConfigManager::writeDirectoryConfig(m_path, toConfigJson());
+    return m_index->writeDirectoryConfig(m_path, toConfigJson());
 }
 
 bool VNotebook::writeConfigNotebook() const
 {
     QJsonObject nbJson = toConfigJsonNotebook();
 
-    QJsonObject configJson = VConfigManager::readDirectoryConfig(m_path);
+    QJsonObject configJson = m_index->readDirectoryConfig(m_path);
     if (configJson.isEmpty()) {
         qWarning() << "fail to read notebook configuration" << m_path;
         return false;
@@ -93,7 +104,7 @@ bool VNotebook::writeConfigNotebook() const
         configJson[it.key()] = it.value();
     }
 
-    return VConfigManager::writeDirectoryConfig(m_path, configJson);
+    return m_index->writeDirectoryConfig(m_path, configJson);
 }
 
 const QString &VNotebook::getName() const
@@ -109,6 +120,8 @@ const QString &VNotebook::getPath() const
 void VNotebook::close()
 {
     m_rootDir->close();
+    g_configWriteQueue->flush();
+    m_index->save();
 }
 
 bool VNotebook::open()
@@ -186,6 +199,8 @@ bool VNotebook::deleteNotebook(VNotebook *p_notebook, bool p_deleteFiles)
         }
 
         // Delete the config file.
+        g_configWriteQueue->discard(p_notebook->getPath());
+        p_notebook->getIndex()->clear();
         if (!VConfigManager::deleteDirectoryConfig(p_notebook->getPath())) {
             ret = false;
             goto exit;
@@ -7,6 +7,7 @@
 
 class VDirectory;
 class VFile;
+class VNotebookIndex;
 
 class VNotebook : public QObject
 {
@@ -76,6 +77,9 @@ public:
     // Need to check if this notebook has been opened.
     QDateTime getCreatedTimeUtc();
 
+    // Index of the directory configs of this notebook.
+    VNotebookIndex *getIndex() const;
+
 signals:
     void contentChanged();
 
@@ -100,6 +104,8 @@ private:
 
     // Parent is NULL for root directory
     VDirectory *m_rootDir;
+
+    VNotebookIndex *m_index;
 };
 
 inline VDirectory *VNotebook::getRootDir() const
@@ -107,6 +113,11 @@ inline VDirectory *VNotebook::getRootDir() const
     return m_rootDir;
 }
 
+inline VNotebookIndex *VNotebook::getIndex() const
+{
+    return m_index;
+}
+
 inline const QString &VNotebook::getRecycleBinFolder() const
 {
     return m_recycleBinFolder;
@@ -0,0 +1,272 @@
+#include "vnotebookindex.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QJsonDocument>
+#include "vconfigmanager.h"
+#include "vconfigwritequeue.h"
+
+extern VConfigWriteQueue *g_configWriteQueue;
+
+// Magic and version of the index file.
+static const quint32 c_indexFileMagic = 0x564e4249;
+static const quint32 c_indexFileVersion = 1;
+
+// A config file modified within this interval before it is indexed may be
+// modified again without changing its modification time and size.
+static const qint64 c_racyInterval = 2000;
+
+VNotebookIndex::VNotebookIndex(const QString &p_notebookPath, const QString &p_indexFilePath)
+    : m_notebookPath(QDir::cleanPath(p_notebookPath)), m_indexFilePath(p_indexFilePath),
+      m_loaded(false), m_dirty(false)
+{
+}
+
+VNotebookIndex::~VNotebookIndex()
+{
+    if (m_loaded) {
+        qDebug() << "notebook index" << m_notebookPath << "entries" << m_entries.size()
+                 << "hits" << m_stats.m_hits << "misses" << m_stats.m_misses;
+    }
+
+    save();
+}
+
+QString VNotebookIndex::relativePath(const QString &p_path) const
+{
+    return QDir(m_notebookPath).relativeFilePath(QDir::cleanPath(p_path));
+}
+
+QJsonObject VNotebookIndex::readDirectoryConfig(const QString &p_path)
+{
+    if (!m_loaded) {
+        load();
+    }
+
+    QJsonObject pendingJson;
+    if (g_configWriteQueue->pendingConfig(p_path, pendingJson)) {
+        ++m_stats.m_hits;
+        return pendingJson;
+    }
+
+    QString key = relativePath(p_path);
+    QFileInfo info(VConfigManager::getDirConfigFilePath(p_path));
+    auto it = m_entries.find(key);
+    if (it != m_entries.end() && info.exists()) {
+        const Entry &entry = it.value();
+        if (entry.m_modifiedTime == info.lastModified().toMSecsSinceEpoch()
+            && entry.m_size == info.size()
+            && entry.m_indexedTime - entry.m_modifiedTime > c_racyInterval) {
+            QJsonObject json = QJsonDocument::fromBinaryData(entry.m_data).object();
+            if (!json.isEmpty()) {
+                ++m_stats.m_hits;
+                return json;
+            }
+        }
+    }
+
+    ++m_stats.m_misses;
+    QJsonObject json = VConfigManager::readDirectoryConfig(p_path);
+    if (json.isEmpty()) {
+        if (it != m_entries.end()) {
+            m_entries.erase(it);
+            m_dirty = true;
+        }
+    } else {
+        update(key, p_path, json);
+    }
+
+    return json;
+}
+
+bool VNotebookIndex::writeDirectoryConfig(const QString &p_path, const QJsonObject &p_json)
+{
+    if (!m_loaded) {
+        load();
+    }
+
+    // The entry will be indexed again when read.
+    if (m_entries.remove(relativePath(p_path)) > 0) {
+        m_dirty = true;
+    }
+
+    return g_configWriteQueue->writeNow(p_path, p_json);
+}
+
+void VNotebookIndex::queueDirectoryConfig(const QString &p_path, const QJsonObject &p_json)
+{
+    if (!m_loaded) {
+        load();
+    }
+
+    // The entry will be indexed again when read after the write is flushed.
+    if (m_entries.remove(relativePath(p_path)) > 0) {
+        m_dirty = true;
+    }
+
+    g_configWriteQueue->write(p_path, p_json);
+}
+
+void VNotebookIndex::update(const QString &p_key, const QString &p_path, const QJsonObject &p_json)
+{
+    // Stat after reading, since the obsolete config file may be renamed.
+    QFileInfo info(VConfigManager::getDirConfigFilePath(p_path));
+    if (!info.exists()) {
+        if (m_entries.remove(p_key) > 0) {
+            m_dirty = true;
+        }
+
+        return;
+    }
+
+    Entry entry;
+    entry.m_modifiedTime = info.lastModified().toMSecsSinceEpoch();
+    entry.m_size = info.size();
+    entry.m_indexedTime = QDateTime::currentMSecsSinceEpoch();
+    entry.m_data = QJsonDocument(p_json).toBinaryData();
+    m_entries.insert(p_key, entry);
+    m_dirty = true;
+}
+
+void VNotebookIndex::addDirectoryConfig(const QString &p_path,
+                                        const QJsonObject &p_json,
+                                        qint64 p_modifiedTime,
+                                        qint64 p_size)
+{
+    if (!m_loaded) {
+        load();
+    }
+
+    Entry entry;
+    entry.m_modifiedTime = p_modifiedTime;
+    entry.m_size = p_size;
+    entry.m_indexedTime = QDateTime::currentMSecsSinceEpoch();
+    entry.m_data = QJsonDocument(p_json).toBinaryData();
+    m_entries.insert(relativePath(p_path), entry);
+    m_dirty = true;
+}
+
+void VNotebookIndex::remove(const QString &p_path)
+{
+    if (!m_loaded) {
+        load();
+    }
+
+    QString key = relativePath(p_path);
+    QString prefix = key + "/";
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it.key() == key || it.key().startsWith(prefix)) {
+            it = m_entries.erase(it);
+            m_dirty = true;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void VNotebookIndex::clear()
+{
+    m_entries.clear();
+    m_loaded = true;
+    m_dirty = false;
+
+    if (QFile::exists(m_indexFilePath) && !QFile::remove(m_indexFilePath)) {
+        qWarning() << "fail to delete notebook index" << m_indexFilePath;
+    }
+}
+
+bool VNotebookIndex::load()
+{
+    m_loaded = true;
+
+    QFile file(m_indexFilePath);
+    if (!file.exists()) {
+        return false;
+    }
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "fail to open notebook index" << m_indexFilePath;
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version;
+    QString notebookPath;
+    in >> magic >> version;
+    if (magic != c_indexFileMagic || version != c_indexFileVersion) {
+        qWarning() << "ignore notebook index of unknown format" << m_indexFilePath;
+        return false;
+    }
+
+    in >> notebookPath;
+    if (notebookPath != m_notebookPath) {
+        qWarning() << "ignore notebook index of another notebook" << notebookPath;
+        return false;
+    }
+
+    quint32 nrEntries;
+    in >> nrEntries;
+    for (quint32 i = 0; i < nrEntries && in.status() == QDataStream::Ok; ++i) {
+        QString key;
+        Entry entry;
+        in >> key >> entry.m_modifiedTime >> entry.m_size >> entry.m_indexedTime >> entry.m_data;
+        if (in.status() == QDataStream::Ok) {
+            m_entries.insert(key, entry);
+        }
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "notebook index is corrupted" << m_indexFilePath;
+        m_entries.clear();
+        return false;
+    }
+
+    qDebug() << "load" << m_entries.size() << "directory configs from notebook index"
+             << m_indexFilePath;
+    return true;
+}
+
+bool VNotebookIndex::save()
+{
+    if (!m_dirty) {
+        return true;
+    }
+
+    QDir dir(QFileInfo(m_indexFilePath).path());
+    if (!dir.exists() && !dir.mkpath(dir.path())) {
+        qWarning() << "fail to create notebook index folder" << dir.path();
+        return false;
+    }
+
+    QSaveFile file(m_indexFilePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "fail to open notebook index to write" << m_indexFilePath;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    out << c_indexFileMagic << c_indexFileVersion << m_notebookPath;
+    out << (quint32)m_entries.size();
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        const Entry &entry = it.value();
+        out << it.key() << entry.m_modifiedTime << entry.m_size
+            << entry.m_indexedTime << entry.m_data;
+    }
+
+    if (!file.commit()) {
+        qWarning() << "fail to write notebook index" << m_indexFilePath;
+        return false;
+    }
+
+    m_dirty = false;
+    return true;
+}
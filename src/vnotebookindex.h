@@ -0,0 +1,107 @@
+#ifndef VNOTEBOOKINDEX_H
+#define VNOTEBOOKINDEX_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+
+// Consolidated index of the directory configs of one notebook, persisted to a
+// single file in the cache folder so that opening a folder need not read and
+// parse its config file.
+// The directory config files are still the source of truth. An entry is used
+// only if the modification time and size of the config file match.
+class VNotebookIndex
+{
+public:
+    struct Statistics
+    {
+        Statistics() : m_hits(0), m_misses(0)
+        {
+        }
+
+        int m_hits;
+        int m_misses;
+    };
+
+    // @p_notebookPath: the root path of the notebook;
+    // @p_indexFilePath: the file to persist the index;
+    VNotebookIndex(const QString &p_notebookPath, const QString &p_indexFilePath);
+
+    // Save the index to disk.
+    ~VNotebookIndex();
+
+    // Read the config of directory @p_path within the notebook.
+    QJsonObject readDirectoryConfig(const QString &p_path);
+
+    // Write the config of directory @p_path now.
+    bool writeDirectoryConfig(const QString &p_path, const QJsonObject &p_json);
+
+    // Queue a write of the config of directory @p_path.
+    void queueDirectoryConfig(const QString &p_path, const QJsonObject &p_json);
+
+    // Index @p_json read elsewhere as the config of directory @p_path.
+    // @p_modifiedTime and @p_size are of the config file before reading it.
+    void addDirectoryConfig(const QString &p_path,
+                            const QJsonObject &p_json,
+                            qint64 p_modifiedTime,
+                            qint64 p_size);
+
+    // Remove entries of directory @p_path and all its sub-directories.
+    void remove(const QString &p_path);
+
+    // Remove all entries and the index file.
+    void clear();
+
+    bool save();
+
+    const Statistics &getStatistics() const;
+
+private:
+    struct Entry
+    {
+        Entry() : m_modifiedTime(0), m_size(0), m_indexedTime(0)
+        {
+        }
+
+        // Modification time in ms since epoch of the config file.
+        qint64 m_modifiedTime;
+
+        // Size of the config file.
+        qint64 m_size;
+
+        // Time in ms since epoch when this entry is indexed.
+        qint64 m_indexedTime;
+
+        // Binary JSON of the config.
+        QByteArray m_data;
+    };
+
+    bool load();
+
+    // Index @p_json as the config of directory with key @p_key.
+    void update(const QString &p_key, const QString &p_path, const QJsonObject &p_json);
+
+    // Path relative to the notebook root. Used as the key of entries.
+    QString relativePath(const QString &p_path) const;
+
+    QString m_notebookPath;
+
+    QString m_indexFilePath;
+
+    QHash<QString, Entry> m_entries;
+
+    bool m_loaded;
+
+    // Whether there are changes not saved yet.
+    bool m_dirty;
+
+    Statistics m_stats;
+};
+
+inline const VNotebookIndex::Statistics &VNotebookIndex::getStatistics() const
+{
+    return m_stats;
+}
+
+#endif // VNOTEBOOKINDEX_H
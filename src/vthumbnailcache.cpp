@@ -0,0 +1,252 @@
+#include "vthumbnailcache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDirIterator>
+#include <QImageReader>
+#include <QCryptographicHash>
+#include <QMutexLocker>
+#include <QRunnable>
+#include "vimagedecoder.h"
+
+// Magic and version of the thumbnail file.
+static const quint32 c_thumbnailMagic = 0x5654484d;
+static const quint32 c_thumbnailVersion = 1;
+
+static const QString c_thumbnailSuffix = "vthumb";
+
+// Generate the thumbnails of the images within a folder.
+class VThumbnailPrewarmTask : public QRunnable
+{
+public:
+    VThumbnailPrewarmTask(VThumbnailCache *p_cache, const QString &p_folder, int p_width)
+        : m_cache(p_cache), m_folder(p_folder), m_width(p_width)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QStringList filters;
+        for (auto const &format : QImageReader::supportedImageFormats()) {
+            filters << QString("*.%1").arg(QString::fromLatin1(format));
+        }
+
+        int nrGenerated = 0;
+        QDirIterator it(m_folder, filters, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext() && !m_cache->m_stopped.load()) {
+            QString path = it.next();
+            QImageReader reader(path);
+            QSize size = reader.size();
+            if (!size.isValid() || size.width() <= m_width) {
+                continue;
+            }
+
+            QImage image;
+            if (m_cache->load(path, m_width, image)) {
+                continue;
+            }
+
+            reader.setScaledSize(VImageDecoder::scaledSize(size, m_width));
+            image = reader.read();
+            if (!image.isNull()) {
+                m_cache->save(path, m_width, image);
+                ++nrGenerated;
+            }
+        }
+
+        qDebug() << "pre-warm" << nrGenerated << "thumbnails of" << m_folder;
+    }
+
+private:
+    VThumbnailCache *m_cache;
+    QString m_folder;
+    int m_width;
+};
+
+VThumbnailCache::VThumbnailCache(const QString &p_folder, int p_maxSize)
+    : m_folder(p_folder), m_maxSize((qint64)p_maxSize * 1024 * 1024),
+      m_totalSize(0), m_stopped(0)
+{
+    m_prewarmPool.setMaxThreadCount(1);
+
+    if (!isEnabled()) {
+        return;
+    }
+
+    if (!QDir().mkpath(m_folder)) {
+        qWarning() << "fail to create thumbnail cache folder" << m_folder;
+        m_maxSize = 0;
+        return;
+    }
+
+    QDir dir(m_folder);
+    QFileInfoList files = dir.entryInfoList(QStringList() << ("*." + c_thumbnailSuffix),
+                                            QDir::Files);
+    for (auto const &file : files) {
+        m_totalSize += file.size();
+    }
+
+    qDebug() << "thumbnail cache" << m_folder << files.size() << "files"
+             << m_totalSize / 1024 << "KB";
+
+    if (m_totalSize > m_maxSize) {
+        prune();
+    }
+}
+
+VThumbnailCache::~VThumbnailCache()
+{
+    m_stopped.store(1);
+    m_prewarmPool.clear();
+    m_prewarmPool.waitForDone();
+
+    // Decoding jobs may use the cache.
+    QThreadPool::globalInstance()->waitForDone();
+}
+
+QString VThumbnailCache::thumbnailFilePath(const QString &p_path, int p_width) const
+{
+    QFileInfo info(p_path);
+    QString key = QString("%1|%2|%3|%4").arg(info.absoluteFilePath())
+                                        .arg(info.size())
+                                        .arg(info.lastModified().toMSecsSinceEpoch())
+                                        .arg(p_width);
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1);
+    return QDir(m_folder).filePath(QString("%1.%2").arg(QString::fromLatin1(hash.toHex()))
+                                                   .arg(c_thumbnailSuffix));
+}
+
+bool VThumbnailCache::load(const QString &p_path, int p_width, QImage &p_image) const
+{
+    if (!isEnabled()) {
+        return false;
+    }
+
+    QFile file(thumbnailFilePath(p_path, p_width));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version;
+    qint32 width, height, format, bytesPerLine;
+    in >> magic >> version >> width >> height >> format >> bytesPerLine;
+    if (in.status() != QDataStream::Ok
+        || magic != c_thumbnailMagic
+        || version != c_thumbnailVersion
+        || width <= 0
+        || height <= 0
+        || format <= QImage::Format_Invalid
+        || format >= QImage::NImageFormats) {
+        return false;
+    }
+
+    QImage image(width, height, (QImage::Format)format);
+    if (image.isNull() || image.bytesPerLine() != bytesPerLine) {
+        return false;
+    }
+
+    qint64 bytes = (qint64)bytesPerLine * height;
+    if (in.readRawData(reinterpret_cast<char *>(image.bits()), bytes) != bytes) {
+        return false;
+    }
+
+    p_image = image;
+    return true;
+}
+
+void VThumbnailCache::save(const QString &p_path, int p_width, const QImage &p_image)
+{
+    if (!isEnabled() || p_image.isNull()) {
+        return;
+    }
+
+    // Indexed images need the color table.
+    QImage image = p_image;
+    if (image.colorCount() > 0) {
+        image = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32
+                                                              : QImage::Format_RGB32);
+    }
+
+    QSaveFile file(thumbnailFilePath(p_path, p_width));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << c_thumbnailMagic << c_thumbnailVersion
+        << (qint32)image.width() << (qint32)image.height()
+        << (qint32)image.format() << (qint32)image.bytesPerLine();
+    out.writeRawData(reinterpret_cast<const char *>(image.constBits()),
+                     image.bytesPerLine() * image.height());
+
+    // The file is closed after commit().
+    qint64 written = file.pos();
+    if (!file.commit()) {
+        qWarning() << "fail to write thumbnail of" << p_path;
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_totalSize += written;
+    if (m_totalSize > m_maxSize) {
+        prune();
+    }
+}
+
+void VThumbnailCache::prune()
+{
+    // Leave some space to avoid pruning frequently.
+    qint64 target = m_maxSize / 4 * 3;
+
+    QDir dir(m_folder);
+    QFileInfoList files = dir.entryInfoList(QStringList() << ("*." + c_thumbnailSuffix),
+                                            QDir::Files,
+                                            QDir::Time | QDir::Reversed);
+    m_totalSize = 0;
+    for (auto const &file : files) {
+        m_totalSize += file.size();
+    }
+
+    int nrRemoved = 0;
+    for (auto const &file : files) {
+        if (m_totalSize <= target) {
+            break;
+        }
+
+        if (QFile::remove(file.absoluteFilePath())) {
+            m_totalSize -= file.size();
+            ++nrRemoved;
+        }
+    }
+
+    qDebug() << "thumbnail cache: remove" << nrRemoved << "thumbnails, size"
+             << m_totalSize / 1024 << "KB";
+}
+
+void VThumbnailCache::prewarm(const QString &p_folder, int p_width)
+{
+    if (!isEnabled() || p_width <= 0) {
+        return;
+    }
+
+    QString folder = QDir::cleanPath(p_folder);
+    {
+    QMutexLocker locker(&m_mutex);
+    if (m_prewarmedFolders.contains(folder)) {
+        return;
+    }
+
+    m_prewarmedFolders.append(folder);
+    }
+
+    m_prewarmPool.start(new VThumbnailPrewarmTask(this, folder, p_width));
+}
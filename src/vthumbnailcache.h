@@ -0,0 +1,74 @@
+#ifndef VTHUMBNAILCACHE_H
+#define VTHUMBNAILCACHE_H
+
+#include <QString>
+#include <QImage>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QThreadPool>
+
+// Cache of downscaled preview images on disk, so that large images need not
+// be decoded again when a note is opened.
+// Thumbnails are keyed by the absolute path, the size and the modification
+// time of the image, and the width it is scaled to. They are stored as raw
+// pixels which could be read without decoding.
+// The oldest written thumbnails are removed when the total size exceeds the
+// limit.
+// All the functions could be called from any thread.
+class VThumbnailCache
+{
+public:
+    // @p_folder: the folder to store thumbnails;
+    // @p_maxSize: the maximum size in MB of all thumbnails. 0 to disable it.
+    VThumbnailCache(const QString &p_folder, int p_maxSize);
+
+    // Stop pre-warming and wait for all the decoding jobs.
+    ~VThumbnailCache();
+
+    // Load the thumbnail of image @p_path scaled to width @p_width.
+    // Returns false if there is no valid one.
+    bool load(const QString &p_path, int p_width, QImage &p_image) const;
+
+    // Save @p_image as the thumbnail of image @p_path scaled to width @p_width.
+    void save(const QString &p_path, int p_width, const QImage &p_image);
+
+    // Generate thumbnails in background for all the images within @p_folder
+    // which are wider than @p_width.
+    void prewarm(const QString &p_folder, int p_width);
+
+    bool isEnabled() const;
+
+private:
+    friend class VThumbnailPrewarmTask;
+
+    QString thumbnailFilePath(const QString &p_path, int p_width) const;
+
+    // Remove the oldest thumbnails until the total size is within the limit.
+    void prune();
+
+    QString m_folder;
+
+    qint64 m_maxSize;
+
+    // Total size of thumbnails in bytes.
+    qint64 m_totalSize;
+
+    // Protect m_totalSize and pruning.
+    QMutex m_mutex;
+
+    // Folders pre-warmed in this session.
+    QStringList m_prewarmedFolders;
+
+    // Set to stop pre-warming.
+    QAtomicInt m_stopped;
+
+    // Thread pool with one thread to pre-warm.
+    QThreadPool m_prewarmPool;
+};
+
+inline bool VThumbnailCache::isEnabled() const
+{
+    return m_maxSize > 0;
+}
+
+#endif // VTHUMBNAILCACHE_H